@@ -0,0 +1,1211 @@
+#include "Benchmark.h"
+#include "Model.h"
+#include "RenderQueue.h"
+#include "IndirectRenderer.h"
+#include "UniformBuffer.h"
+#include "StreamBuffer.h"
+#include "StaticBatch.h"
+#include "FrustumCuller.h"
+#include "Bvh.h"
+#include "TriangleBvh.h"
+#include "OcclusionCuller.h"
+#include "GLExtensions.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iomanip>
+#include <random>
+
+namespace {
+
+	typedef std::chrono::high_resolution_clock Clock;
+
+	double millisecondsSince(Clock::time_point start) {
+		return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+	}
+
+}
+
+void Benchmark::runAll(const char* modelPath) {
+	importScaling(modelPath);
+	uniformUpload();
+	renderQueue();
+	renderQueue(100000);
+	frustumCulling();
+	boundingVolumeHierarchy(modelPath);
+	picking();
+	occlusionCulling();
+	instancing(modelPath);
+	multiDrawIndirect(modelPath);
+	staticBatching(modelPath);
+	positionStream();
+	depthPrepass(modelPath);
+	streaming();
+	arenaCompaction();
+}
+
+void Benchmark::importScaling(const char* modelPath, unsigned int repeat) {
+
+	Assimp::Importer importer;
+	const aiScene* scene = importer.ReadFile(modelPath, aiProcess_Triangulate | aiProcess_FlipUVs);
+	if (!scene || !scene->mRootNode) {
+		std::cout << "ERROR::BENCHMARK::" << importer.GetErrorString() << std::endl;
+		return;
+	}
+
+	// repeat the scene's meshes so the job list looks like a scene with hundreds of meshes
+	std::vector<const aiMesh*> jobs;
+	for (unsigned int r = 0; r < repeat; r++)
+		for (unsigned int i = 0; i < scene->mNumMeshes; i++)
+			jobs.push_back(scene->mMeshes[i]);
+
+	std::cout << "importScaling: " << jobs.size() << " meshes" << std::endl;
+
+	unsigned int maxThreads = std::max(1u, std::thread::hardware_concurrency());
+	double serialMs = 0.0;
+
+	for (unsigned int threads = 1; threads <= maxThreads; threads *= 2) {
+
+		std::vector<MeshData> out(jobs.size());
+		Clock::time_point start = Clock::now();
+
+		if (threads == 1) {
+			for (size_t i = 0; i < jobs.size(); i++)
+				out[i] = Model::processMesh(jobs[i]);
+		}
+		else {
+			// the calling thread works too, so the pool needs one thread less
+			ThreadPool pool(threads - 1);
+			start = Clock::now();
+			pool.parallelFor(jobs.size(), [&](size_t i) { out[i] = Model::processMesh(jobs[i]); });
+		}
+
+		double ms = millisecondsSince(start);
+		if (threads == 1) serialMs = ms;
+
+		std::cout << "  threads " << std::setw(2) << threads << ": " << std::fixed << std::setprecision(2)
+			<< ms << " ms, speedup " << serialMs / ms << "x" << std::endl;
+	}
+}
+
+void Benchmark::uniformUpload(unsigned int draws) {
+
+	// matrices travel in the FrameData/DrawData blocks, default.frag still has plain uniforms
+	Shader shader("default.vert", "default.frag", "#define USE_TEXTURE true\n");
+	shader.use();
+
+	// per draw: the object color changes, the light and samplers do not
+	std::vector<glm::vec3> colors(256);
+	for (size_t i = 0; i < colors.size(); i++)
+		colors[i] = glm::vec3(i / 255.0f, 0.5f, 1.0f - i / 255.0f);
+	glm::vec3 lightPos(1.2f, 1.0f, 2.0f);
+	glm::vec3 lightColor(1.0f);
+
+	std::cout << "uniformUpload: " << draws << " draws" << std::endl;
+	auto report = [draws](const char* label, double ms) {
+		std::cout << "  " << std::setw(24) << std::left << label << std::right << std::fixed << std::setprecision(1)
+			<< ms * 1.0e6 / draws << " ns/draw" << std::endl;
+	};
+
+	// what every draw paid before: glGetUniformLocation per call and sampler names built per texture
+	glFinish();
+	Clock::time_point start = Clock::now();
+	for (unsigned int d = 0; d < draws; d++) {
+		glUniform3fv(glGetUniformLocation(shader.ID, "objectColor"), 1, glm::value_ptr(colors[d % colors.size()]));
+		glUniform3fv(glGetUniformLocation(shader.ID, "lightPos"), 1, glm::value_ptr(lightPos));
+		glUniform3fv(glGetUniformLocation(shader.ID, "lightColor"), 1, glm::value_ptr(lightColor));
+		std::string name = "diffuse";
+		glUniform1i(glGetUniformLocation(shader.ID, ("material." + name).c_str()), 0);
+		name = "specular";
+		glUniform1i(glGetUniformLocation(shader.ID, ("material." + name).c_str()), 1);
+	}
+	glFinish();
+	report("glGetUniformLocation", millisecondsSince(start));
+
+	// cached lookups by name, unchanged values are skipped
+	start = Clock::now();
+	for (unsigned int d = 0; d < draws; d++) {
+		shader.setVec3("objectColor", colors[d % colors.size()]);
+		shader.setVec3("lightPos", lightPos);
+		shader.setVec3("lightColor", lightColor);
+		shader.setInt("material.diffuse", 0);
+		shader.setInt("material.specular", 1);
+	}
+	glFinish();
+	report("cached, by name", millisecondsSince(start));
+
+	// pre-resolved handles
+	int objectColor = shader.uniform("objectColor");
+	int lightPosHandle = shader.uniform("lightPos");
+	int lightColorHandle = shader.uniform("lightColor");
+	int diffuse = shader.uniform("material.diffuse");
+	int specular = shader.uniform("material.specular");
+	start = Clock::now();
+	for (unsigned int d = 0; d < draws; d++) {
+		shader.setVec3(objectColor, colors[d % colors.size()]);
+		shader.setVec3(lightPosHandle, lightPos);
+		shader.setVec3(lightColorHandle, lightColor);
+		shader.setInt(diffuse, 0);
+		shader.setInt(specular, 1);
+	}
+	glFinish();
+	report("cached, by handle", millisecondsSince(start));
+}
+
+void Benchmark::renderQueue(unsigned int draws) {
+
+	// a scene of 8 programs, 64 materials and 256 meshes submitted in random order, the packets
+	// are never drawn so the meshes are bounds-only stand-ins
+	std::vector<Mesh> meshes;
+	for (unsigned int i = 0; i < 256; i++)
+		meshes.push_back(Mesh(AABB(), 0));
+
+	std::mt19937 random(42);
+	RenderQueue queue;
+	queue.begin(glm::mat4(1.0f));
+	for (unsigned int d = 0; d < draws; d++) {
+		RenderPacket packet;
+		unsigned int mesh = random() % meshes.size();
+		packet.mesh = &meshes[mesh];
+		packet.materials = nullptr;
+		packet.shaders = nullptr;
+		packet.program = 1 + mesh % 8;
+		packet.features = 0;
+		packet.material = packet.materialId = mesh % 64;
+		packet.drawData = d % 16;
+		float depth = 1.0f + (random() % 10000) * 0.01f;
+		packet.key = RenderQueue::makeKey(RENDER_PASS_MAIN, d % 10 == 0, packet.program, packet.materialId, mesh, depth);
+		queue.submit(packet);
+	}
+
+	std::cout << "renderQueue: " << draws << " draws" << std::endl;
+	auto report = [](const char* label, const RenderQueue::Stats& stats) {
+		std::cout << "  " << std::setw(10) << std::left << label << std::right << stats.programChanges << " program, "
+			<< stats.materialChanges << " material, " << stats.meshChanges << " mesh, "
+			<< stats.drawDataUploads << " draw data changes" << std::endl;
+	};
+	report("submitted", queue.countStateChanges());
+
+	Clock::time_point start = Clock::now();
+	queue.sort();
+	double radixMs = millisecondsSince(start);
+	report("sorted", queue.countStateChanges());
+
+	// reference: comparison sort of the same keys
+	std::mt19937 again(42);
+	std::vector<uint64_t> keys;
+	for (unsigned int d = 0; d < draws; d++) {
+		unsigned int mesh = again() % meshes.size();
+		float depth = 1.0f + (again() % 10000) * 0.01f;
+		keys.push_back(RenderQueue::makeKey(RENDER_PASS_MAIN, d % 10 == 0, 1 + mesh % 8, mesh % 64, mesh, depth));
+	}
+	start = Clock::now();
+	std::sort(keys.begin(), keys.end());
+	double stdMs = millisecondsSince(start);
+
+	std::cout << "  sort: radix " << std::fixed << std::setprecision(3) << radixMs << " ms ("
+		<< ThreadPool::shared().size() + 1 << " threads), std::sort " << stdMs << " ms" << std::endl;
+}
+
+void Benchmark::frustumCulling(unsigned int objects, unsigned int frames) {
+
+	// boxes of 0.5 to 5 units scattered through a 400 unit cube, a 60 degree camera turning at its center
+	std::mt19937 random(7);
+	std::uniform_real_distribution<float> position(-200.0f, 200.0f), size(0.25f, 2.5f);
+	FrustumCuller culler;
+	culler.reserve(objects);
+	for (unsigned int i = 0; i < objects; i++) {
+		AABB box;
+		glm::vec3 center(position(random), position(random), position(random));
+		glm::vec3 half(size(random), size(random), size(random));
+		box.expand(center - half);
+		box.expand(center + half);
+		culler.add(box, BoundingSphere::around(box));
+	}
+	glm::mat4 projection = glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, 300.0f);
+
+	std::cout << "frustumCulling: " << objects << " objects, " << frames << " frames, " << FrustumCuller::instructionSet()
+		<< " kernel, " << ThreadPool::shared().size() + 1 << " threads" << std::endl;
+
+	const char* volumeNames[3] = { "boxes", "spheres", "both" };
+	const FrustumCuller::Volume volumes[3] = { FrustumCuller::Volume::Box, FrustumCuller::Volume::Sphere, FrustumCuller::Volume::Both };
+	std::vector<unsigned char> reference, visible;
+	for (int v = 0; v < 3; v++) {
+		// objects culled per millisecond: Frustum::intersects, SIMD on this thread, SIMD on the pool
+		double ms[3] = { 0.0, 0.0, 0.0 };
+		size_t visibleTotal = 0, mismatches = 0;
+		for (unsigned int frame = 0; frame < frames; frame++) {
+			float yaw = glm::two_pi<float>() * frame / frames;
+			Frustum frustum(projection * glm::lookAt(glm::vec3(0.0f), glm::vec3(std::sin(yaw), 0.2f, std::cos(yaw)), glm::vec3(0.0f, 1.0f, 0.0f)));
+
+			visibleTotal += culler.cullScalar(frustum, reference, volumes[v]);
+			ms[0] += culler.stats().ms;
+			for (int method = 1; method < 3; method++) {
+				culler.parallelThreshold = method == 1 ? SIZE_MAX : 0;
+				culler.cull(frustum, visible, volumes[v]);
+				ms[method] += culler.stats().ms;
+				for (size_t i = 0; i < visible.size(); i++)
+					mismatches += visible[i] != reference[i];
+			}
+		}
+		double tested = static_cast<double>(objects) * frames;
+		std::cout << "  " << std::setw(8) << std::left << volumeNames[v] << std::right << std::fixed << std::setprecision(0)
+			<< tested / ms[0] << " scalar, " << tested / ms[1] << " SIMD, " << tested / ms[2] << " SIMD threaded objects/ms, "
+			<< std::setprecision(1) << 100.0 * visibleTotal / tested << "% visible";
+		if (mismatches)
+			std::cout << ", " << mismatches << " results differ from the scalar test";
+		std::cout << std::endl;
+	}
+}
+
+void Benchmark::boundingVolumeHierarchy(const char* modelPath, unsigned int objects, unsigned int queries) {
+
+	// the same kind of scene as frustumCulling: small boxes scattered through a 400 unit cube
+	std::mt19937 random(13);
+	std::uniform_real_distribution<float> position(-200.0f, 200.0f), size(0.25f, 2.5f), jitter(-1.0f, 1.0f);
+	std::vector<AABB> boxes(objects);
+	FrustumCuller flat;
+	flat.reserve(objects);
+	for (AABB& box : boxes) {
+		glm::vec3 center(position(random), position(random), position(random));
+		glm::vec3 half(size(random), size(random), size(random));
+		box.expand(center - half);
+		box.expand(center + half);
+		flat.add(box, BoundingSphere::around(box));
+	}
+
+	Bvh bvh;
+	bvh.build(boxes);
+	const Bvh::Stats& stats = bvh.stats();
+	std::cout << "boundingVolumeHierarchy: " << objects << " objects, " << ThreadPool::shared().size() + 1 << " threads" << std::endl;
+	std::cout << "  build " << std::fixed << std::setprecision(2) << stats.buildMs << " ms (" << stats.nodes << " nodes, "
+		<< stats.leaves << " leaves, depth " << stats.depth << ")" << std::endl;
+
+	// every object moves a little, the tree is kept and only its boxes change
+	std::vector<AABB> moved(boxes);
+	for (AABB& box : moved) {
+		glm::vec3 offset(jitter(random), jitter(random), jitter(random));
+		box.min += offset;
+		box.max += offset;
+	}
+	Bvh refitted;
+	refitted.build(boxes);
+	refitted.refit(moved);
+	Bvh rebuilt;
+	rebuilt.build(moved);
+	std::cout << "  refit " << refitted.stats().refitMs << " ms after moving everything, a rebuild takes "
+		<< rebuilt.stats().buildMs << " ms" << std::endl;
+
+	// frustum: hierarchical vs FrustumCuller's flat SIMD pass on this thread
+	glm::mat4 projection = glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, 300.0f);
+	std::vector<unsigned char> visible;
+	double hierarchyMs = 0.0, flatMs = 0.0;
+	size_t nodesVisited = 0, visibleTotal = 0;
+	flat.parallelThreshold = SIZE_MAX;
+	for (unsigned int frame = 0; frame < 100; frame++) {
+		float yaw = glm::two_pi<float>() * frame / 100;
+		Frustum frustum(projection * glm::lookAt(glm::vec3(0.0f), glm::vec3(std::sin(yaw), 0.2f, std::cos(yaw)), glm::vec3(0.0f, 1.0f, 0.0f)));
+		Clock::time_point start = Clock::now();
+		size_t visited = 0;
+		visibleTotal += bvh.cull(frustum, visible, &visited);
+		hierarchyMs += millisecondsSince(start);
+		nodesVisited += visited;
+		flat.cull(frustum, visible);
+		flatMs += flat.stats().ms;
+	}
+	double tested = 100.0 * objects;
+	std::cout << "  frustum " << std::setprecision(0) << tested / hierarchyMs << " objects/ms hierarchical ("
+		<< nodesVisited / 100 << " nodes visited), " << tested / flatMs << " flat SIMD, "
+		<< std::setprecision(1) << 100.0 * visibleTotal / tested << "% visible" << std::endl;
+
+	// rays: nearest box hit from random points in random directions, against testing every box
+	std::vector<Ray> rays(queries);
+	for (Ray& ray : rays) {
+		ray.origin = glm::vec3(position(random), position(random), position(random));
+		ray.direction = glm::normalize(glm::vec3(jitter(random), jitter(random), jitter(random)) + glm::vec3(0.0f, 0.0f, 1e-3f));
+	}
+	size_t hits = 0;
+	Clock::time_point start = Clock::now();
+	for (const Ray& ray : rays) {
+		glm::vec3 inverseDirection = 1.0f / ray.direction;
+		float tMax = FLT_MAX;
+		int64_t hit = bvh.raycast(ray, tMax, [&](uint32_t primitive, float& t) {
+			float tEnter;
+			if (!Bvh::intersects(ray, inverseDirection, boxes[primitive], t, tEnter) || tEnter >= t) return false;
+			t = tEnter;
+			return true;
+		});
+		hits += hit >= 0 ? 1 : 0;
+	}
+	double rayMs = millisecondsSince(start);
+	start = Clock::now();
+	size_t bruteRays = std::min<size_t>(queries, 100);
+	for (size_t r = 0; r < bruteRays; r++) {
+		glm::vec3 inverseDirection = 1.0f / rays[r].direction;
+		float tMax = FLT_MAX, tEnter;
+		for (const AABB& box : boxes)
+			if (Bvh::intersects(rays[r], inverseDirection, box, tMax, tEnter) && tEnter < tMax)
+				tMax = tEnter;
+	}
+	double bruteRayMs = millisecondsSince(start);
+	std::cout << "  rays " << std::setprecision(0) << queries / rayMs << " per ms (" << hits << " of " << queries
+		<< " hit), " << std::setprecision(2) << bruteRays / bruteRayMs << " per ms testing every box" << std::endl;
+
+	// ranges: boxes of 20 units
+	std::vector<uint32_t> found;
+	size_t foundTotal = 0;
+	start = Clock::now();
+	for (unsigned int q = 0; q < queries; q++) {
+		AABB range;
+		glm::vec3 center(position(random), position(random), position(random));
+		range.expand(center - glm::vec3(10.0f));
+		range.expand(center + glm::vec3(10.0f));
+		found.clear();
+		bvh.query(range, found);
+		foundTotal += found.size();
+	}
+	double rangeMs = millisecondsSince(start);
+	std::cout << "  ranges " << std::setprecision(0) << queries / rangeMs << " per ms, " << std::setprecision(1)
+		<< static_cast<double>(foundTotal) / queries << " objects each" << std::endl;
+
+	// a loaded model whose instances all move a little every frame
+	Model model(modelPath);
+	size_t instanceCount = model.instances.size();
+	if (instanceCount == 0) return;
+	std::vector<glm::mat4> placed(instanceCount);
+	AABB modelBounds;
+	for (size_t i = 0; i < instanceCount; i++) {
+		placed[i] = model.instances[i].transform;
+		if (model.instanceBounds[i].valid()) modelBounds.expand(model.instanceBounds[i]);
+	}
+	if (!modelBounds.valid()) return;
+	glm::vec3 modelCenter = modelBounds.center();
+	float modelSize = glm::length(modelBounds.extent());
+
+	const unsigned int moves = 20;
+	std::vector<unsigned char> hierarchyVisible, flatVisible;
+	std::vector<uint32_t> hierarchyFound;
+	double modelRefitMs = 0.0;
+	size_t wrongBounds = 0, wrongTransforms = 0, cullMismatches = 0, queryMismatches = 0;
+	for (unsigned int move = 0; move < moves; move++) {
+		for (size_t i = 0; i < instanceCount; i++) {
+			glm::vec3 offset = glm::vec3(jitter(random), jitter(random), jitter(random)) * (0.02f * modelSize);
+			model.setInstanceTransform(i, glm::translate(glm::mat4(1.0f), offset) * placed[i]);
+		}
+		Clock::time_point moveStart = Clock::now();
+		model.refitInstances();
+		modelRefitMs += millisecondsSince(moveStart);
+
+		// bounds and the transforms the meshes upload, against recomputing them from the instances
+		FrustumCuller instanceFlat;
+		instanceFlat.reserve(instanceCount);
+		for (size_t i = 0; i < instanceCount; i++) {
+			const MeshInstance& instance = model.instances[i];
+			const Mesh& mesh = model.meshes[instance.mesh];
+			AABB expected = mesh.bounds.transformed(instance.transform);
+			const AABB& bounds = model.instanceBounds[i];
+			if (expected.valid() && (expected.min != bounds.min || expected.max != bounds.max))
+				wrongBounds++;
+			if (std::find(mesh.instanceTransforms.begin(), mesh.instanceTransforms.end(), instance.transform) == mesh.instanceTransforms.end())
+				wrongTransforms++;
+			instanceFlat.add(bounds, BoundingSphere::around(bounds));
+		}
+
+		// refit hierarchy against one test per instance
+		float yaw = glm::two_pi<float>() * move / moves;
+		glm::vec3 eye = modelCenter + glm::vec3(std::sin(yaw), 0.3f, std::cos(yaw)) * modelSize;
+		Frustum frustum(glm::perspective(glm::radians(45.0f), 16.0f / 9.0f, 0.01f * modelSize, 4.0f * modelSize)
+			* glm::lookAt(eye, modelCenter + glm::vec3(jitter(random), 0.0f, jitter(random)) * (0.25f * modelSize), glm::vec3(0.0f, 1.0f, 0.0f)));
+		model.instanceHierarchy().cull(frustum, hierarchyVisible);
+		instanceFlat.cullScalar(frustum, flatVisible);
+		for (size_t i = 0; i < instanceCount; i++)
+			if (model.instanceBounds[i].valid() && hierarchyVisible[i] != flatVisible[i])
+				cullMismatches++;
+
+		AABB range;
+		range.expand(modelCenter + glm::vec3(jitter(random), jitter(random), jitter(random)) * (0.5f * modelSize));
+		range.min -= glm::vec3(0.1f * modelSize);
+		range.max += glm::vec3(0.1f * modelSize);
+		hierarchyFound.clear();
+		model.queryInstances(range, hierarchyFound);
+		std::sort(hierarchyFound.begin(), hierarchyFound.end());
+		std::vector<uint32_t> expectedFound;
+		for (size_t i = 0; i < instanceCount; i++) {
+			const AABB& box = model.instanceBounds[i];
+			if (box.valid() && box.min.x <= range.max.x && box.max.x >= range.min.x && box.min.y <= range.max.y
+				&& box.max.y >= range.min.y && box.min.z <= range.max.z && box.max.z >= range.min.z)
+				expectedFound.push_back(static_cast<uint32_t>(i));
+		}
+		if (hierarchyFound != expectedFound)
+			queryMismatches++;
+	}
+	std::cout << "  model: " << instanceCount << " instances moved " << moves << " times, refitInstances "
+		<< std::setprecision(3) << modelRefitMs / moves << " ms (hierarchy and transform uploads)";
+	if (wrongBounds || wrongTransforms || cullMismatches || queryMismatches)
+		std::cout << ", " << wrongBounds << " bounds and " << wrongTransforms << " transforms out of date, " << cullMismatches
+			<< " culls and " << queryMismatches << " range queries differ from testing every instance";
+	std::cout << std::endl;
+}
+
+void Benchmark::picking(unsigned int gridSize, unsigned int rays) {
+
+	// a rippled height field of 2 * gridSize^2 triangles, looked at from above like a terrain
+	std::vector<glm::vec3> positions;
+	std::vector<unsigned int> indices;
+	positions.reserve((gridSize + 1) * (gridSize + 1));
+	indices.reserve(6 * gridSize * gridSize);
+	for (unsigned int z = 0; z <= gridSize; z++)
+		for (unsigned int x = 0; x <= gridSize; x++)
+			positions.push_back(glm::vec3(2.0f * x / gridSize - 1.0f, 0.05f * std::sin(0.3f * x) * std::cos(0.2f * z), 2.0f * z / gridSize - 1.0f));
+	for (unsigned int z = 0; z < gridSize; z++) {
+		for (unsigned int x = 0; x < gridSize; x++) {
+			unsigned int corner = z * (gridSize + 1) + x;
+			unsigned int quad[6] = { corner, corner + gridSize + 1, corner + 1, corner + 1, corner + gridSize + 1, corner + gridSize + 2 };
+			indices.insert(indices.end(), quad, quad + 6);
+		}
+	}
+
+	TriangleBvh triangles;
+	triangles.build(positions, indices);
+	const TriangleBvh::Stats& stats = triangles.stats();
+	std::cout << "picking: " << stats.triangles << " triangles" << std::endl;
+	std::cout << "  build " << std::fixed << std::setprecision(2) << stats.buildMs << " ms (" << stats.nodes << " 4-wide nodes, "
+		<< stats.packets << " packets of 4 triangles)" << std::endl;
+
+	// cursor rays from a camera above the grid, most of them hit
+	std::mt19937 random(17);
+	std::uniform_real_distribution<float> spread(-1.2f, 1.2f);
+	std::vector<Ray> cursorRays(rays);
+	for (Ray& ray : cursorRays) {
+		ray.origin = glm::vec3(0.0f, 2.0f, 2.0f);
+		ray.direction = glm::vec3(spread(random), -2.0f, spread(random) - 2.0f);
+	}
+	std::vector<TriangleBvh::Hit> hits(rays);
+	size_t hitCount = 0;
+	Clock::time_point start = Clock::now();
+	for (unsigned int r = 0; r < rays; r++)
+		hitCount += triangles.raycast(cursorRays[r], hits[r]) ? 1 : 0;
+	double pickMs = millisecondsSince(start);
+
+	// Moller-Trumbore on every triangle, for a few of the same rays
+	size_t bruteRays = std::min<size_t>(rays, 10), agree = 0;
+	start = Clock::now();
+	for (size_t r = 0; r < bruteRays; r++) {
+		const Ray& ray = cursorRays[r];
+		float nearest = FLT_MAX;
+		for (size_t i = 0; i < indices.size(); i += 3) {
+			glm::vec3 v0 = positions[indices[i]];
+			glm::vec3 e1 = positions[indices[i + 1]] - v0, e2 = positions[indices[i + 2]] - v0;
+			glm::vec3 p = glm::cross(ray.direction, e2);
+			float det = glm::dot(e1, p);
+			if (std::abs(det) <= 1e-12f) continue;
+			glm::vec3 s = ray.origin - v0, q = glm::cross(s, e1);
+			float u = glm::dot(s, p) / det, v = glm::dot(ray.direction, q) / det, t = glm::dot(e2, q) / det;
+			if (u >= 0.0f && v >= 0.0f && u + v <= 1.0f && t >= 0.0f && t < nearest)
+				nearest = t;
+		}
+		agree += (nearest == FLT_MAX) == !hits[r].valid() && (!hits[r].valid() || std::abs(nearest - hits[r].t) <= 1e-5f) ? 1 : 0;
+	}
+	double bruteMs = millisecondsSince(start);
+	std::cout << "  " << std::setprecision(3) << 1000.0 * pickMs / rays << " us per pick (" << hitCount << " of " << rays
+		<< " hit), " << std::setprecision(1) << bruteMs / bruteRays << " ms testing every triangle, " << agree << " of "
+		<< bruteRays << " nearest hits agree" << std::endl;
+}
+
+bool Benchmark::occlusionCulling(unsigned int objects, unsigned int frames) {
+
+	// a level of 20 x 20 rooms, 10 units wide with 3 unit high walls and a doorway in the middle of each
+	// wall, every wall half a scaled unit cube
+	const int rooms = 20;
+	const float roomSize = 10.0f, half = rooms * roomSize * 0.5f;
+	std::vector<glm::vec3> cube = {
+		{ -0.5f, -0.5f, -0.5f }, { 0.5f, -0.5f, -0.5f }, { 0.5f, 0.5f, -0.5f }, { -0.5f, 0.5f, -0.5f },
+		{ -0.5f, -0.5f, 0.5f }, { 0.5f, -0.5f, 0.5f }, { 0.5f, 0.5f, 0.5f }, { -0.5f, 0.5f, 0.5f }
+	};
+	std::vector<unsigned int> cubeIndices = {
+		0, 2, 1, 0, 3, 2, 4, 5, 6, 4, 6, 7, 0, 1, 5, 0, 5, 4, 3, 6, 2, 3, 7, 6, 0, 4, 7, 0, 7, 3, 1, 2, 6, 1, 6, 5
+	};
+	std::vector<glm::mat4> walls;
+	std::vector<AABB> wallBounds;
+	for (int line = 0; line <= rooms; line++) {
+		for (int room = 0; room < rooms; room++) {
+			for (int piece = 0; piece < 2; piece++) {
+				float along = -half + room * roomSize + (piece == 0 ? 2.0f : 8.0f);
+				float across = -half + line * roomSize;
+				glm::vec3 centers[2] = { glm::vec3(along, 1.5f, across), glm::vec3(across, 1.5f, along) };
+				glm::vec3 sizes[2] = { glm::vec3(4.0f, 3.0f, 0.2f), glm::vec3(0.2f, 3.0f, 4.0f) };
+				for (int direction = 0; direction < 2; direction++) {
+					walls.push_back(glm::scale(glm::translate(glm::mat4(1.0f), centers[direction]), sizes[direction]));
+					AABB box;
+					box.expand(centers[direction] - sizes[direction] * 0.5f);
+					box.expand(centers[direction] + sizes[direction] * 0.5f);
+					wallBounds.push_back(box);
+				}
+			}
+		}
+	}
+
+	// small objects on and above the floors of every room
+	std::mt19937 random(19);
+	std::uniform_real_distribution<float> position(-half, half), height(0.0f, 2.5f), size(0.15f, 0.6f);
+	std::vector<AABB> boxes(objects);
+	FrustumCuller frustumCuller;
+	frustumCuller.reserve(objects);
+	for (AABB& box : boxes) {
+		glm::vec3 center(position(random), height(random), position(random));
+		glm::vec3 extent(size(random), size(random), size(random));
+		box.expand(center - extent);
+		box.expand(center + extent);
+		frustumCuller.add(box, BoundingSphere::around(box));
+	}
+
+	// walk through the rooms looking around, walls in the frustum and within 60 units are the occluders
+	OcclusionCuller occlusion;
+	glm::mat4 projection = glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, 300.0f);
+	float pixelAngle = 2.0f * std::tan(glm::radians(30.0f)) / occlusion.height();
+	std::vector<unsigned char> visible, inFrustum;
+	std::vector<size_t> frameOccluders;
+	size_t frustumVisible = 0, occluded = 0, occluders = 0, triangles = 0, checked = 0, unblocked = 0;
+	double rasterMs = 0.0, testMs = 0.0;
+	for (unsigned int frame = 0; frame < frames; frame++) {
+		float progress = static_cast<float>(frame) / frames;
+		glm::vec3 eye(-half + 5.0f + progress * (rooms - 1) * roomSize, 1.7f, 5.0f);
+		float yaw = glm::two_pi<float>() * progress * 3.0f;
+		glm::mat4 viewProjection = projection * glm::lookAt(eye, eye + glm::vec3(std::sin(yaw), -0.1f, std::cos(yaw)), glm::vec3(0.0f, 1.0f, 0.0f));
+		Frustum frustum(viewProjection);
+
+		occlusion.begin(viewProjection);
+		frameOccluders.clear();
+		for (size_t i = 0; i < walls.size(); i++) {
+			if (glm::length(wallBounds[i].center() - eye) < 60.0f && frustum.intersects(wallBounds[i])) {
+				occlusion.addOccluder(cube, cubeIndices, walls[i]);
+				frameOccluders.push_back(i);
+			}
+		}
+		occlusion.rasterize();
+
+		frustumVisible += frustumCuller.cull(frustum, visible);
+		inFrustum = visible;
+		occluded += occlusion.cull(boxes.data(), boxes.size(), glm::mat4(1.0f), visible);
+
+		// every tenth frame, an occluded box whose center is on screen has to have an occluder between
+		// that center and the eye. Walls are widened by two pixels at their distance, the buffer misses
+		// slivers thinner than that.
+		if (frame % 10 == 0) {
+			for (size_t i = 0; i < boxes.size(); i++) {
+				if (!inFrustum[i] || visible[i]) continue;
+				glm::vec4 clip = viewProjection * glm::vec4(boxes[i].center(), 1.0f);
+				if (clip.w <= 0.0f || std::abs(clip.x) > clip.w || std::abs(clip.y) > clip.w) continue;
+				Ray ray{ eye, boxes[i].center() - eye };
+				glm::vec3 inverseDirection = 1.0f / ray.direction;
+				bool blocked = false;
+				for (size_t wall : frameOccluders) {
+					AABB widened = wallBounds[wall];
+					float margin = 2.0f * pixelAngle * glm::length(widened.center() - eye);
+					widened.min -= glm::vec3(margin);
+					widened.max += glm::vec3(margin);
+					float tEnter;
+					if (Bvh::intersects(ray, inverseDirection, widened, 1.0f, tEnter)) {
+						blocked = true;
+						break;
+					}
+				}
+				checked++;
+				unblocked += !blocked;
+			}
+		}
+
+		const OcclusionCuller::Stats& stats = occlusion.stats();
+		occluders += stats.occluders;
+		triangles += stats.rasterized;
+		rasterMs += stats.rasterMs;
+		testMs += stats.testMs;
+	}
+
+	std::cout << "occlusionCulling: " << objects << " objects, " << walls.size() << " walls, " << occlusion.width() << "x"
+		<< occlusion.height() << " " << OcclusionCuller::instructionSet() << ", " << ThreadPool::shared().size() + 1 << " threads" << std::endl;
+	std::cout << "  " << std::fixed << std::setprecision(0) << static_cast<double>(occluders) / frames << " occluders, "
+		<< static_cast<double>(triangles) / frames << " triangles rasterized in " << std::setprecision(3) << rasterMs / frames
+		<< " ms per frame" << std::endl;
+	std::cout << "  " << std::setprecision(0) << static_cast<double>(frustumVisible) / frames << " objects in the frustum tested in "
+		<< std::setprecision(3) << testMs / frames << " ms, " << std::setprecision(1)
+		<< (frustumVisible > 0 ? 100.0 * occluded / frustumVisible : 0.0) << "% of them occluded" << std::endl;
+
+	// a wall filling the screen 5 units ahead: boxes behind it are occluded, boxes in front of it are not
+	glm::vec3 eye(0.0f, 1.7f, 0.0f);
+	occlusion.begin(projection * glm::lookAt(eye, eye + glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f)));
+	occlusion.addOccluder(cube, cubeIndices, glm::scale(glm::translate(glm::mat4(1.0f), eye + glm::vec3(0.0f, 0.0f, -5.0f)), glm::vec3(1000.0f, 1000.0f, 0.2f)));
+	occlusion.rasterize();
+	std::uniform_real_distribution<float> across(-0.5f, 0.5f), behind(6.0f, 250.0f), inFront(0.5f, 4.0f);
+	const unsigned int placed = 1000;
+	size_t wrongBehind = 0, wrongInFront = 0;
+	for (unsigned int i = 0; i < placed; i++) {
+		for (int side = 0; side < 2; side++) {
+			float distance = side == 0 ? behind(random) : inFront(random);
+			glm::vec3 center = eye + glm::vec3(across(random), across(random), -1.0f) * distance;
+			float extent = std::min(size(random), 0.4f * distance);
+			AABB box;
+			box.expand(center - glm::vec3(extent, extent, std::min(extent, 0.4f)));
+			box.expand(center + glm::vec3(extent, extent, std::min(extent, 0.4f)));
+			if (side == 0)
+				wrongBehind += occlusion.visible(box);
+			else
+				wrongInFront += !occlusion.visible(box);
+		}
+	}
+	if (unblocked || wrongBehind || wrongInFront)
+		std::cout << "  " << unblocked << " of " << checked << " occluded boxes have nothing in front of their center, "
+			<< wrongBehind << " of " << placed << " boxes behind a full screen wall visible, " << wrongInFront << " of " << placed
+			<< " in front of it occluded" << std::endl;
+	return unblocked == 0 && wrongBehind == 0 && wrongInFront == 0;
+}
+
+void Benchmark::instancing(const char* modelPath, unsigned int copies) {
+
+	Model model(modelPath);
+	ShaderVariants shaders("model.vert", "model.frag", materialFeatureNames());
+	UniformBlockBuffer<DrawData> drawUniforms;
+
+	// a grid of copies in front of the camera
+	glm::mat4 viewProjection = glm::perspective(glm::radians(45.0f), 16.0f / 9.0f, 0.1f, 500.0f)
+		* glm::lookAt(glm::vec3(0.0f, 40.0f, 120.0f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+	unsigned int side = static_cast<unsigned int>(std::ceil(std::sqrt(static_cast<double>(copies))));
+	std::vector<glm::mat4> transforms(copies);
+	std::vector<glm::vec4> colors(copies);
+	for (unsigned int i = 0; i < copies; i++) {
+		glm::vec3 position((i % side) * 2.0f - side, 0.0f, (i / side) * 2.0f - side);
+		transforms[i] = glm::translate(glm::mat4(1.0f), position);
+		colors[i] = glm::vec4(0.5f + 0.5f * (i % 3 == 0), 0.5f + 0.5f * (i % 3 == 1), 0.5f + 0.5f * (i % 3 == 2), 1.0f);
+	}
+
+	// wait until the specialized variants are linked so both runs use the same programs
+	for (const Material& material : model.materials.materials)
+		shaders.request(material.features);
+	while (shaders.pendingCount() > 0)
+		shaders.update();
+
+	std::cout << "instancing: " << copies << " copies of " << model.meshes.size() << " meshes" << std::endl;
+	auto report = [](const char* label, double ms, unsigned int draws) {
+		std::cout << "  " << std::setw(16) << std::left << label << std::right << std::fixed << std::setprecision(2)
+			<< ms << " ms, " << draws << " draws" << std::endl;
+	};
+
+	for (int run = 0; run < 2; run++) { // the first run warms up driver caches
+		glFinish();
+		GLState::frameStats();
+		Clock::time_point start = Clock::now();
+		for (unsigned int i = 0; i < copies; i++) {
+			DrawData draw;
+			draw.model = transforms[i];
+			draw.modelViewProjection = viewProjection * transforms[i];
+			draw.normalMatrix = glm::mat4(1.0f);
+			drawUniforms.update(draw);
+			model.Draw(shaders);
+		}
+		glFinish();
+		double loopMs = millisecondsSince(start);
+		unsigned int loopDraws = GLState::frameStats().draws;
+
+		start = Clock::now();
+		DrawData world;
+		world.model = glm::mat4(1.0f);
+		world.modelViewProjection = viewProjection;
+		world.normalMatrix = glm::mat4(1.0f);
+		drawUniforms.update(world);
+		model.DrawInstanced(shaders, transforms.data(), transforms.size(), colors.data());
+		glFinish();
+		double instancedMs = millisecondsSince(start);
+		unsigned int instancedDraws = GLState::frameStats().draws;
+
+		if (run == 1) {
+			report("Draw loop", loopMs, loopDraws);
+			report("DrawInstanced", instancedMs, instancedDraws);
+		}
+	}
+}
+
+void Benchmark::multiDrawIndirect(const char* modelPath, unsigned int objects) {
+
+	if (!IndirectRenderer::supported()) {
+		std::cout << "multiDrawIndirect: skipped, needs GL 4.3" << std::endl;
+		return;
+	}
+
+	Model model(modelPath);
+	if (model.meshes.empty()) return;
+	ShaderVariants shaders("model.vert", "model.frag", materialFeatureNames());
+	IndirectRenderer indirect;
+	UniformBlockBuffer<FrameData> frameUniforms;
+	UniformBlockBuffer<DrawData> drawUniforms;
+	StreamBuffer stream(objects * StreamBuffer::uniformAlignment());
+
+	glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 40.0f, 120.0f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+	FrameData frame;
+	frame.view = view;
+	frame.projection = glm::perspective(glm::radians(45.0f), 16.0f / 9.0f, 0.1f, 500.0f);
+	frame.viewProjection = frame.projection * view;
+	frameUniforms.update(frame);
+
+	for (const Material& material : model.materials.materials) {
+		shaders.request(material.features);
+		indirect.request(material.features);
+	}
+	while (shaders.pendingCount() > 0 || indirect.pendingCount() > 0) {
+		shaders.update();
+		indirect.update();
+	}
+
+	// one mesh per object, the model's meshes repeated over a grid
+	RenderQueue queue;
+	queue.begin(view);
+	unsigned int side = static_cast<unsigned int>(std::ceil(std::sqrt(static_cast<double>(objects))));
+	for (unsigned int i = 0; i < objects; i++) {
+		DrawData draw;
+		draw.model = glm::translate(glm::mat4(1.0f), glm::vec3((i % side) * 2.0f - side, 0.0f, (i / side) * 2.0f - side));
+		draw.modelViewProjection = frame.viewProjection * draw.model;
+		draw.normalMatrix = glm::mat4(1.0f);
+		const Mesh& mesh = model.meshes[i % model.meshes.size()];
+		queue.submit(mesh, model.materials, mesh.materialIndex, shaders, queue.addDrawData(draw), mesh.bounds);
+	}
+	queue.sort();
+
+	std::cout << "multiDrawIndirect: " << objects << " objects" << std::endl;
+	auto report = [](const char* label, double submitMs, double frameMs, unsigned int draws) {
+		std::cout << "  " << std::setw(16) << std::left << label << std::right << std::fixed << std::setprecision(2)
+			<< submitMs << " ms submit, " << frameMs << " ms to glFinish, " << draws << " draw calls" << std::endl;
+	};
+
+	for (int run = 0; run < 2; run++) { // the first run warms up driver caches
+		glFinish();
+		GLState::frameStats();
+		Clock::time_point start = Clock::now();
+		queue.execute(drawUniforms);
+		double directSubmitMs = millisecondsSince(start);
+		glFinish();
+		double directMs = millisecondsSince(start);
+		unsigned int directDraws = GLState::frameStats().draws;
+
+		start = Clock::now();
+		stream.beginFrame();
+		queue.execute(stream);
+		stream.endFrame();
+		double streamedSubmitMs = millisecondsSince(start);
+		glFinish();
+		double streamedMs = millisecondsSince(start);
+		unsigned int streamedDraws = GLState::frameStats().draws;
+
+		start = Clock::now();
+		queue.execute(indirect);
+		double indirectSubmitMs = millisecondsSince(start);
+		glFinish();
+		double indirectMs = millisecondsSince(start);
+		unsigned int indirectDraws = GLState::frameStats().draws;
+
+		if (run == 1) {
+			report("Mesh::Draw", directSubmitMs, directMs, directDraws);
+			report("streamed ranges", streamedSubmitMs, streamedMs, streamedDraws);
+			report("indirect", indirectSubmitMs, indirectMs, indirectDraws);
+		}
+	}
+}
+
+void Benchmark::staticBatching(const char* modelPath, unsigned int parts) {
+
+	Model model(modelPath);
+	if (model.meshes.empty()) return;
+	ShaderVariants shaders("model.vert", "model.frag", materialFeatureNames());
+	UniformBlockBuffer<FrameData> frameUniforms;
+	UniformBlockBuffer<DrawData> drawUniforms;
+
+	glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 60.0f, 160.0f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+	FrameData frame;
+	frame.view = view;
+	frame.projection = glm::perspective(glm::radians(45.0f), 16.0f / 9.0f, 0.1f, 500.0f);
+	frame.viewProjection = frame.projection * view;
+	frameUniforms.update(frame);
+
+	for (const Material& material : model.materials.materials)
+		shaders.request(material.features);
+	while (shaders.pendingCount() > 0)
+		shaders.update();
+
+	// parts scattered over a 200 x 200 area with random yaw and scale, fixed seed so runs compare
+	std::mt19937 random(7);
+	std::uniform_real_distribution<float> position(-100.0f, 100.0f), angle(0.0f, 6.2831853f), scale(0.5f, 2.0f);
+	std::vector<glm::mat4> placements(parts);
+	for (glm::mat4& placement : placements) {
+		placement = glm::translate(glm::mat4(1.0f), glm::vec3(position(random), 0.0f, position(random)));
+		placement = glm::rotate(placement, angle(random), glm::vec3(0.0f, 1.0f, 0.0f));
+		placement = glm::scale(placement, glm::vec3(scale(random)));
+	}
+
+	StaticBatch batch;
+	for (const glm::mat4& placement : placements)
+		batch.add(model, placement);
+	batch.build();
+
+	std::cout << "staticBatching: " << parts << " parts, " << batch.stats().sourceInstances << " mesh instances, "
+		<< batch.stats().chunks << " chunks" << std::endl;
+	auto report = [](const char* label, double submitMs, double frameMs, unsigned int draws) {
+		std::cout << "  " << std::setw(16) << std::left << label << std::right << std::fixed << std::setprecision(2)
+			<< submitMs << " ms submit, " << frameMs << " ms to glFinish, " << draws << " draw calls" << std::endl;
+	};
+
+	RenderQueue queue;
+	for (int run = 0; run < 2; run++) { // the first run warms up driver caches
+		glFinish();
+		GLState::frameStats();
+		Clock::time_point start = Clock::now();
+		queue.begin(view);
+		for (const glm::mat4& placement : placements) {
+			DrawData draw;
+			draw.model = placement;
+			draw.modelViewProjection = frame.viewProjection * placement;
+			draw.normalMatrix = glm::mat4(glm::transpose(glm::inverse(glm::mat3(placement))));
+			model.submit(queue, shaders, draw);
+		}
+		queue.sort();
+		queue.execute(drawUniforms);
+		double partsSubmitMs = millisecondsSince(start);
+		glFinish();
+		double partsMs = millisecondsSince(start);
+		unsigned int partsDraws = GLState::frameStats().draws;
+
+		start = Clock::now();
+		queue.begin(view);
+		batch.submit(queue, shaders, frame.viewProjection);
+		queue.sort();
+		queue.execute(drawUniforms);
+		double batchSubmitMs = millisecondsSince(start);
+		glFinish();
+		double batchMs = millisecondsSince(start);
+		unsigned int batchDraws = GLState::frameStats().draws;
+
+		if (run == 1) {
+			report("per part", partsSubmitMs, partsMs, partsDraws);
+			report("StaticBatch", batchSubmitMs, batchMs, batchDraws);
+		}
+	}
+}
+
+void Benchmark::positionStream(unsigned int gridSize, unsigned int passes) {
+
+	// four vertices per quad so every face has its own normal, as an exporter writes hard edges
+	std::vector<Vertex> vertices;
+	std::vector<unsigned int> indices;
+	vertices.reserve(static_cast<size_t>(gridSize) * gridSize * 4);
+	indices.reserve(static_cast<size_t>(gridSize) * gridSize * 6);
+	auto height = [](float x, float z) { return 0.05f * std::sin(x * 0.3f) * std::cos(z * 0.2f); };
+	for (unsigned int z = 0; z < gridSize; z++) {
+		for (unsigned int x = 0; x < gridSize; x++) {
+			unsigned int base = static_cast<unsigned int>(vertices.size());
+			glm::vec3 corners[4] = {
+				glm::vec3(x, height(float(x), float(z)), z), glm::vec3(x + 1, height(float(x + 1), float(z)), z),
+				glm::vec3(x + 1, height(float(x + 1), float(z + 1)), z + 1), glm::vec3(x, height(float(x), float(z + 1)), z + 1) };
+			glm::vec3 normal = glm::normalize(glm::cross(corners[3] - corners[0], corners[1] - corners[0]));
+			for (const glm::vec3& corner : corners) {
+				Vertex v;
+				v.Position = (corner - glm::vec3(gridSize * 0.5f, 0.0f, gridSize * 0.5f)) / float(gridSize);
+				v.Normal = normal;
+				v.TexCoords = glm::vec2(corner.x, corner.z) / float(gridSize);
+				vertices.push_back(v);
+			}
+			unsigned int quad[6] = { 0, 2, 1, 0, 3, 2 };
+			for (unsigned int i : quad)
+				indices.push_back(base + i);
+		}
+	}
+	size_t vertexCount = vertices.size(), indexCount = indices.size();
+	Mesh mesh(std::move(vertices), std::move(indices), 0, GeometryResidency::GpuOnly, true);
+	const GeometryArena::Entry& entry = GeometryArena::shared().entry(mesh.geometry());
+
+	Shader depth("depth.vert", "depth.frag");
+	UniformBlockBuffer<DrawData> drawUniforms;
+	DrawData draw;
+	draw.model = glm::mat4(1.0f);
+	draw.modelViewProjection = glm::perspective(glm::radians(45.0f), 16.0f / 9.0f, 0.1f, 10.0f)
+		* glm::lookAt(glm::vec3(0.0f, 0.8f, 0.8f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+	draw.normalMatrix = glm::mat4(1.0f);
+	drawUniforms.update(draw);
+
+	PipelineDesc depthOnly;
+	depthOnly.colorWrite = false;
+	GLState::setPipeline(PipelineState::get(depthOnly));
+	depth.use();
+
+	std::cout << "positionStream: " << indexCount / 3 << " triangles, " << vertexCount << " vertices welded to "
+		<< entry.positionCount << " positions" << std::endl;
+	auto report = [&](const char* label, size_t streamBytes, double cpuMs, double gpuMs) {
+		std::cout << "  " << std::setw(16) << std::left << label << std::right << std::fixed << std::setprecision(2)
+			<< streamBytes / 1024.0 / 1024.0 << " MB vertex stream, " << cpuMs / passes << " ms per pass to glFinish, "
+			<< gpuMs / passes << " ms GPU, " << streamBytes / (gpuMs / passes / 1000.0) / 1024.0 / 1024.0 / 1024.0
+			<< " GB/s (stream size over GPU time)" << std::endl;
+	};
+
+	GLuint query;
+	glGenQueries(1, &query);
+	for (int run = 0; run < 2; run++) { // the first run warms up driver caches
+		double cpuMs[2], gpuMs[2];
+		for (int positions = 0; positions < 2; positions++) {
+			glFinish();
+			Clock::time_point start = Clock::now();
+			glBeginQuery(GL_TIME_ELAPSED, query);
+			for (unsigned int pass = 0; pass < passes; pass++) {
+				glClear(GL_DEPTH_BUFFER_BIT);
+				if (positions)
+					mesh.DrawPositions();
+				else
+					mesh.Draw();
+			}
+			glEndQuery(GL_TIME_ELAPSED);
+			glFinish();
+			cpuMs[positions] = millisecondsSince(start);
+			GLuint64 nanoseconds = 0;
+			glGetQueryObjectui64v(query, GL_QUERY_RESULT, &nanoseconds);
+			gpuMs[positions] = nanoseconds / 1000000.0;
+		}
+		if (run == 1) {
+			report("Vertex", vertexCount * sizeof(Vertex), cpuMs[0], gpuMs[0]);
+			report("position stream", entry.positionCount * sizeof(glm::vec3), cpuMs[1], gpuMs[1]);
+		}
+	}
+	glDeleteQueries(1, &query);
+}
+
+void Benchmark::depthPrepass(const char* modelPath, unsigned int copies) {
+
+	ModelOptions options;
+	options.positionStream = true;
+	Model model(modelPath, options);
+	if (model.meshes.empty()) return;
+	ShaderVariants shaders("model.vert", "model.frag", materialFeatureNames());
+	UniformBlockBuffer<FrameData> frameUniforms;
+	StreamBuffer stream(copies * model.meshes.size() * StreamBuffer::uniformAlignment());
+
+	glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 2.0f, 30.0f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+	FrameData frame;
+	frame.view = view;
+	frame.projection = glm::perspective(glm::radians(45.0f), 16.0f / 9.0f, 0.1f, 500.0f);
+	frame.viewProjection = frame.projection * view;
+	frameUniforms.update(frame);
+
+	for (const Material& material : model.materials.materials)
+		shaders.request(material.features);
+	while (shaders.pendingCount() > 0)
+		shaders.update();
+
+	// copies stacked in depth behind each other, the sort key puts the program and material before
+	// the depth so the far ones are not guaranteed to be drawn last
+	std::mt19937 random(11);
+	std::uniform_real_distribution<float> spread(-6.0f, 6.0f), depth(-60.0f, 10.0f);
+	RenderQueue queue;
+	queue.begin(view);
+	for (unsigned int i = 0; i < copies; i++) {
+		DrawData draw;
+		draw.model = glm::translate(glm::mat4(1.0f), glm::vec3(spread(random), spread(random) * 0.5f, depth(random)));
+		draw.modelViewProjection = frame.viewProjection * draw.model;
+		draw.normalMatrix = glm::mat4(1.0f);
+		model.submit(queue, shaders, draw);
+	}
+	queue.sort();
+
+	GLenum target = GLExt::pipelineStatistics ? GL_FRAGMENT_SHADER_INVOCATIONS : GL_SAMPLES_PASSED;
+	GLuint queries[2];
+	glGenQueries(2, queries);
+	std::cout << "depthPrepass: " << copies << " copies, " << queue.size() << " packets, counting "
+		<< (GLExt::pipelineStatistics ? "fragment shader invocations" : "samples passed") << std::endl;
+	if (GLExt::pipelineStatistics)
+		std::cout << "  the prepass modes include the empty depth shader, unless the driver skips it" << std::endl;
+
+	struct Mode {
+		const char* label;
+		DepthPrepass prepass;
+		GLenum depthFunc;
+	};
+	const Mode modes[3] = {
+		{ "no prepass", DepthPrepass::Off, GL_LEQUAL },
+		{ "prepass LEQUAL", DepthPrepass::All, GL_LEQUAL },
+		{ "prepass EQUAL", DepthPrepass::All, GL_EQUAL }
+	};
+	for (int run = 0; run < 2; run++) { // the first run warms up driver caches
+		for (const Mode& mode : modes) {
+			queue.setDepthPrepass(mode.prepass, mode.depthFunc);
+			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+			glFinish();
+			Clock::time_point start = Clock::now();
+			glBeginQuery(GL_TIME_ELAPSED, queries[0]);
+			glBeginQuery(target, queries[1]);
+			stream.beginFrame();
+			queue.execute(stream);
+			stream.endFrame();
+			glEndQuery(target);
+			glEndQuery(GL_TIME_ELAPSED);
+			glFinish();
+			double frameMs = millisecondsSince(start);
+			GLuint64 nanoseconds = 0, fragments = 0;
+			glGetQueryObjectui64v(queries[0], GL_QUERY_RESULT, &nanoseconds);
+			glGetQueryObjectui64v(queries[1], GL_QUERY_RESULT, &fragments);
+			if (run == 1) {
+				std::cout << "  " << std::setw(16) << std::left << mode.label << std::right << std::fixed << std::setprecision(2)
+					<< frameMs << " ms to glFinish, " << nanoseconds / 1000000.0 << " ms GPU, " << fragments << " fragments, "
+					<< queue.stats().draws + queue.stats().prepassDraws << " draws" << std::endl;
+			}
+		}
+	}
+	queue.setDepthPrepass(DepthPrepass::Off);
+	glDeleteQueries(2, queries);
+}
+
+void Benchmark::streaming(unsigned int kilobytesPerFrame, unsigned int frames) {
+
+	size_t bytes = static_cast<size_t>(kilobytesPerFrame) * 1024;
+	std::vector<unsigned char> payload(bytes);
+	for (size_t i = 0; i < bytes; i++)
+		payload[i] = static_cast<unsigned char>(i * 31);
+
+	// every frame's upload is read by the GPU straight away, the way a draw would read it
+	GLuint buffers[2];
+	glGenBuffers(2, buffers);
+	GLuint source = buffers[0], sink = buffers[1];
+	GLState::bindBuffer(GL_COPY_WRITE_BUFFER, sink);
+	glBufferData(GL_COPY_WRITE_BUFFER, bytes, NULL, GL_STATIC_DRAW);
+	GLState::bindBuffer(GL_COPY_WRITE_BUFFER, source);
+	glBufferData(GL_COPY_WRITE_BUFFER, bytes, NULL, GL_STREAM_DRAW);
+
+	std::cout << "streaming: " << kilobytesPerFrame << " KB per frame, " << frames << " frames" << std::endl;
+	auto report = [&](const char* label, double uploadMs, double stallMs, double totalMs) {
+		double megabytes = static_cast<double>(bytes) * frames / (1024.0 * 1024.0);
+		std::cout << "  " << std::setw(22) << std::left << label << std::right << std::fixed << std::setprecision(2)
+			<< uploadMs / frames << " ms upload per frame (" << megabytes / (uploadMs / 1000.0) << " MB/s), "
+			<< stallMs / frames << " ms stalled per frame, " << totalMs << " ms to glFinish" << std::endl;
+	};
+	auto consume = [&](GLuint buffer, GLintptr offset) {
+		GLState::bindBuffer(GL_COPY_READ_BUFFER, buffer);
+		GLState::bindBuffer(GL_COPY_WRITE_BUFFER, sink);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, offset, 0, bytes);
+	};
+
+	for (int run = 0; run < 2; run++) { // the first run warms up driver caches
+
+		// the driver has to wait for (or copy around) last frame's read before overwriting
+		glFinish();
+		double uploadMs = 0.0;
+		Clock::time_point start = Clock::now();
+		for (unsigned int frame = 0; frame < frames; frame++) {
+			Clock::time_point upload = Clock::now();
+			GLState::bindBuffer(GL_COPY_WRITE_BUFFER, source);
+			glBufferSubData(GL_COPY_WRITE_BUFFER, 0, bytes, payload.data());
+			uploadMs += millisecondsSince(upload);
+			consume(source, 0);
+		}
+		glFinish();
+		if (run == 1) report("glBufferSubData", uploadMs, 0.0, millisecondsSince(start));
+
+		// fresh storage every frame, the old one is released when the GPU is done with it
+		uploadMs = 0.0;
+		start = Clock::now();
+		for (unsigned int frame = 0; frame < frames; frame++) {
+			Clock::time_point upload = Clock::now();
+			GLState::bindBuffer(GL_COPY_WRITE_BUFFER, source);
+			glBufferData(GL_COPY_WRITE_BUFFER, bytes, payload.data(), GL_STREAM_DRAW);
+			uploadMs += millisecondsSince(upload);
+			consume(source, 0);
+		}
+		glFinish();
+		if (run == 1) report("orphaning glBufferData", uploadMs, 0.0, millisecondsSince(start));
+
+		for (int persistent = 0; persistent < 2; persistent++) {
+			if (persistent && !GLExt::bufferStorage) {
+				if (run == 1) std::cout << "  StreamBuffer persistent: skipped, needs GL 4.4" << std::endl;
+				continue;
+			}
+			StreamBuffer stream(bytes, persistent != 0);
+			stream.frameStats();
+			uploadMs = 0.0;
+			start = Clock::now();
+			for (unsigned int frame = 0; frame < frames; frame++) {
+				Clock::time_point upload = Clock::now();
+				stream.beginFrame();
+				StreamBuffer::Allocation allocation = stream.write(payload.data(), bytes, 256);
+				stream.flush();
+				uploadMs += millisecondsSince(upload);
+				consume(allocation.buffer, allocation.offset);
+				stream.endFrame();
+			}
+			glFinish();
+			double totalMs = millisecondsSince(start);
+			StreamBuffer::Stats stats = stream.frameStats();
+			if (run == 1) {
+				report(persistent ? "StreamBuffer persistent" : "StreamBuffer mapped", uploadMs, stats.stallMs, totalMs);
+				std::cout << "    memcpy alone " << std::fixed << std::setprecision(2)
+					<< static_cast<double>(stats.bytes) / (1024.0 * 1024.0) / (stats.copyMs / 1000.0) << " MB/s, "
+					<< stats.stalls << " of " << frames << " frames waited on a fence" << std::endl;
+			}
+		}
+	}
+
+	GLState::forgetBuffer(source);
+	GLState::forgetBuffer(sink);
+	glDeleteBuffers(2, buffers);
+}
+
+void Benchmark::arenaCompaction(unsigned int meshes) {
+
+	GeometryArena& arena = GeometryArena::shared();
+
+	// meshes of different sizes with a few instances each, every other one removed again: the holes
+	// are only reused by new meshes that happen to fit
+	std::mt19937 random(23);
+	std::uniform_int_distribution<unsigned int> vertexCount(24, 2000), instanceCount(1, 16);
+	std::vector<GeometryArena::Handle> handles(meshes);
+	std::vector<std::vector<Vertex>> vertices(meshes);
+	std::vector<std::vector<unsigned int>> indices(meshes);
+	std::vector<glm::mat4> transforms;
+	for (unsigned int m = 0; m < meshes; m++) {
+		vertices[m].resize(vertexCount(random));
+		for (size_t v = 0; v < vertices[m].size(); v++) {
+			Vertex& vertex = vertices[m][v];
+			vertex.Position = glm::vec3(static_cast<float>(m), static_cast<float>(v), 0.0f);
+			vertex.Normal = glm::vec3(0.0f, 1.0f, 0.0f);
+			vertex.TexCoords = glm::vec2(static_cast<float>(v) / vertices[m].size(), 0.0f);
+		}
+		indices[m].resize(vertices[m].size() / 2 * 3);
+		for (size_t i = 0; i < indices[m].size(); i++)
+			indices[m][i] = static_cast<unsigned int>((i * 7) % vertices[m].size());
+		handles[m] = arena.add(vertices[m].data(), vertices[m].size(), indices[m].data(), indices[m].size());
+		transforms.assign(instanceCount(random), glm::translate(glm::mat4(1.0f), glm::vec3(static_cast<float>(m), 0.0f, 0.0f)));
+		arena.setInstances(handles[m], transforms.data(), transforms.size());
+	}
+	for (unsigned int m = 1; m < meshes; m += 2)
+		arena.remove(handles[m]);
+
+	std::cout << "arenaCompaction: " << meshes << " meshes added, every other one removed" << std::endl;
+	std::cout << "  before: ";
+	arena.printReport();
+	glFinish();
+	Clock::time_point start = Clock::now();
+	arena.compact();
+	glFinish();
+	double ms = millisecondsSince(start);
+	std::cout << "  after:  ";
+	arena.printReport();
+
+	// the moved ranges have to read back as they were added
+	size_t changed = 0;
+	std::vector<Vertex> readVertices;
+	std::vector<unsigned int> readIndices;
+	for (unsigned int m = 0; m < meshes; m += 2) {
+		arena.read(handles[m], readVertices, readIndices);
+		bool same = readVertices.size() == vertices[m].size() && readIndices == indices[m];
+		for (size_t v = 0; same && v < readVertices.size(); v++)
+			same = readVertices[v].Position == vertices[m][v].Position && readVertices[v].TexCoords == vertices[m][v].TexCoords;
+		changed += !same;
+		arena.remove(handles[m]);
+	}
+	std::cout << "  compact() " << std::fixed << std::setprecision(2) << ms << " ms to glFinish";
+	if (changed)
+		std::cout << ", " << changed << " of " << (meshes + 1) / 2 << " meshes read back different";
+	std::cout << std::endl;
+}
@@ -0,0 +1,66 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+// Timing runs started with "--bench" on the command line instead of opening the viewer.
+// They need a current GL context, so main() calls them after GLAD has been loaded.
+namespace Benchmark {
+
+	void runAll(const char* modelPath);
+
+	// CPU side mesh conversion (Model::processMesh) with 1..N threads
+	void importScaling(const char* modelPath, unsigned int repeat = 64);
+
+	// cost of setting the per-draw uniforms: name lookups every call vs Shader's cache and handles
+	void uniformUpload(unsigned int draws = 100000);
+
+	// RenderQueue: sort time and state changes per frame for a shuffled scene of many small draws
+	void renderQueue(unsigned int draws = 10000);
+
+	// FrustumCuller over random boxes and spheres: Frustum::intersects one by one vs the SIMD kernel on
+	// one thread and on the pool, in objects culled per millisecond
+	void frustumCulling(unsigned int objects = 100000, unsigned int frames = 100);
+
+	// Bvh over random boxes: binned SAH build and refit times, hierarchical frustum culling against
+	// FrustumCuller, nearest-hit rays and box range queries per millisecond. Then the instances of a
+	// model are moved through Model::setInstanceTransform and refitInstances, and the refit hierarchy's
+	// culls and range queries are checked against testing every instance.
+	void boundingVolumeHierarchy(const char* modelPath, unsigned int objects = 100000, unsigned int queries = 10000);
+
+	// TriangleBvh over a height field of 2 * gridSize^2 triangles (a million by default): build time and
+	// time per cursor ray, against intersecting every triangle
+	void picking(unsigned int gridSize = 708, unsigned int rays = 10000);
+
+	// OcclusionCuller in a level of rooms with doorways: nearby walls rasterized as occluders, then the
+	// objects left by frustum culling tested against them, with the share occluded and the cost per frame.
+	// Occluded boxes are checked for a wall between them and the eye, and boxes placed behind and in front
+	// of a full screen wall for the expected result, false when any of them fails. Needs no GL context,
+	// main() also runs it alone with "--test-occlusion" before GLFW is initialized.
+	bool occlusionCulling(unsigned int objects = 100000, unsigned int frames = 100);
+
+	// copies of one model: Model::Draw per copy with its own DrawData vs a single Model::DrawInstanced
+	void instancing(const char* modelPath, unsigned int copies = 10000);
+
+	// the same sorted RenderQueue submitted with one draw per mesh vs IndirectRenderer (GL 4.3)
+	void multiDrawIndirect(const char* modelPath, unsigned int objects = 50000);
+
+	// a scene of parts placed copies of a model: one draw per mesh instance vs StaticBatch chunks
+	void staticBatching(const char* modelPath, unsigned int parts = 500);
+
+	// depth-only passes over a dense, flat shaded grid: full interleaved vertices vs the welded position stream
+	void positionStream(unsigned int gridSize = 512, unsigned int passes = 20);
+
+	// overlapping copies of a model with and without RenderQueue's depth prepass: fragment shader
+	// invocations (samples passed before GL 4.6), GPU time and time to glFinish
+	void depthPrepass(const char* modelPath, unsigned int copies = 2000);
+
+	// per-frame uploads the GPU reads right after: glBufferSubData, orphaning glBufferData and StreamBuffer
+	// (unsynchronized map and persistent), bandwidth on the CPU side and time stalled waiting for the GPU
+	void streaming(unsigned int kilobytesPerFrame = 4096, unsigned int frames = 120);
+
+	// GeometryArena fragmented by adding meshes and removing every other one, its report before and after
+	// compact(), the time compact() takes and whether the meshes it moved read back unchanged
+	void arenaCompaction(unsigned int meshes = 1000);
+
+}
+
+#endif
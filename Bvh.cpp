@@ -0,0 +1,376 @@
+#include "Bvh.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+
+namespace {
+
+	typedef std::chrono::high_resolution_clock Clock;
+
+	double millisecondsSince(Clock::time_point start) {
+		return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+	}
+
+	// ranges at least this large are binned in parallel chunks of CHUNK_SIZE
+	const size_t PARALLEL_PRIMITIVES = 16384;
+	const size_t CHUNK_SIZE = 4096;
+
+	float halfArea(const AABB& box) {
+		if (!box.valid()) return 0.0f;
+		glm::vec3 e = box.extent();
+		return e.x * e.y + e.y * e.z + e.z * e.x;
+	}
+
+	struct Bin {
+		AABB bounds;
+		uint32_t count = 0;
+	};
+
+	struct Bins {
+		Bin bins[3][Bvh::BIN_COUNT];
+
+		void merge(const Bins& other) {
+			for (int axis = 0; axis < 3; axis++) {
+				for (unsigned int i = 0; i < Bvh::BIN_COUNT; i++) {
+					bins[axis][i].bounds.expand(other.bins[axis][i].bounds);
+					bins[axis][i].count += other.bins[axis][i].count;
+				}
+			}
+		}
+	};
+
+	// boxes and centroids of a node's primitives
+	struct Extent {
+		AABB bounds;
+		AABB centroids;
+
+		void merge(const Extent& other) {
+			bounds.expand(other.bounds);
+			centroids.expand(other.centroids);
+		}
+	};
+
+	// what the builder moves around: partitioning these instead of indices keeps every pass over a
+	// node sequential in memory
+	struct Reference {
+		AABB bounds;
+		glm::vec3 centroid;
+		uint32_t primitive;
+	};
+
+	struct Task {
+		uint32_t node;
+		uint32_t begin, end;
+		unsigned int depth;
+	};
+
+	// the bin of a centroid along one axis, scale is BIN_COUNT / extent shrunk a little so the
+	// largest centroid still lands in the last bin
+	unsigned int binOf(float centroid, float minimum, float scale) {
+		int bin = static_cast<int>((centroid - minimum) * scale);
+		return static_cast<unsigned int>(std::min(std::max(bin, 0), static_cast<int>(Bvh::BIN_COUNT) - 1));
+	}
+
+	// work split into CHUNK_SIZE pieces on the pool when the range is large and parallel is set,
+	// partial results merged in chunk order
+	template<typename Result, typename Gather>
+	Result reduceRange(size_t begin, size_t end, bool parallel, Gather gather) {
+		size_t count = end - begin;
+		if (!parallel || count < PARALLEL_PRIMITIVES) {
+			Result result;
+			gather(begin, end, result);
+			return result;
+		}
+		size_t chunks = (count + CHUNK_SIZE - 1) / CHUNK_SIZE;
+		std::vector<Result> partial(chunks);
+		ThreadPool::shared().parallelFor(chunks, [&](size_t chunk) {
+			size_t first = begin + chunk * CHUNK_SIZE;
+			gather(first, std::min(end, first + CHUNK_SIZE), partial[chunk]);
+		});
+		for (size_t chunk = 1; chunk < chunks; chunk++)
+			partial[0].merge(partial[chunk]);
+		return partial[0];
+	}
+
+}
+
+void Bvh::clear() {
+	nodeList.clear();
+	order.clear();
+	orderedBounds.clear();
+	lastStats = Stats();
+}
+
+void Bvh::build(const AABB* bounds, size_t count) {
+
+	Clock::time_point start = Clock::now();
+	clear();
+	lastStats.primitives = count;
+	if (count == 0) return;
+
+	ThreadPool& pool = ThreadPool::shared();
+	std::vector<Reference> references(count);
+	pool.parallelFor(count, [&](size_t i) {
+		references[i].bounds = bounds[i];
+		references[i].centroid = bounds[i].valid() ? bounds[i].center() : glm::vec3(0.0f);
+		references[i].primitive = static_cast<uint32_t>(i);
+	}, CHUNK_SIZE);
+
+	// a binary tree with single primitive leaves has 2n - 1 nodes, larger leaves only need fewer
+	nodeList.resize(2 * count - 1);
+	std::atomic<uint32_t> nodeCount(1);
+	std::atomic<size_t> leafCount(0);
+	unsigned int depth = 0;
+
+	auto split = [&](const Task& task, bool parallel, Task* children) -> bool {
+
+		Extent extent = reduceRange<Extent>(task.begin, task.end, parallel, [&](size_t first, size_t end, Extent& out) {
+			for (size_t i = first; i < end; i++) {
+				out.bounds.expand(references[i].bounds);
+				out.centroids.expand(references[i].centroid);
+			}
+		});
+		Node& node = nodeList[task.node];
+		node.bounds = extent.bounds;
+
+		uint32_t count = task.end - task.begin;
+		if (count <= maxLeafSize) {
+			node.first = task.begin;
+			node.count = count;
+			leafCount++;
+			return false;
+		}
+
+		glm::vec3 centroidMin = extent.centroids.min;
+		glm::vec3 centroidSize = extent.centroids.extent();
+		glm::vec3 scale(0.0f);
+		for (int axis = 0; axis < 3; axis++)
+			if (centroidSize[axis] > 0.0f)
+				scale[axis] = BIN_COUNT * (1.0f - 1e-5f) / centroidSize[axis];
+
+		int bestAxis = -1;
+		unsigned int bestBin = 0;
+		if (task.depth < MAX_SAH_DEPTH) {
+			Bins bins = reduceRange<Bins>(task.begin, task.end, parallel, [&](size_t first, size_t end, Bins& out) {
+				for (size_t i = first; i < end; i++) {
+					const Reference& reference = references[i];
+					for (int axis = 0; axis < 3; axis++) {
+						if (scale[axis] == 0.0f) continue;
+						Bin& bin = out.bins[axis][binOf(reference.centroid[axis], centroidMin[axis], scale[axis])];
+						bin.bounds.expand(reference.bounds);
+						bin.count++;
+					}
+				}
+			});
+
+			// surface area cost of every plane between two bins, swept from both sides
+			float bestCost = FLT_MAX;
+			for (int axis = 0; axis < 3; axis++) {
+				if (scale[axis] == 0.0f) continue;
+				float leftArea[BIN_COUNT];
+				uint32_t leftCount[BIN_COUNT];
+				AABB box;
+				uint32_t n = 0;
+				for (unsigned int i = 0; i + 1 < BIN_COUNT; i++) {
+					box.expand(bins.bins[axis][i].bounds);
+					n += bins.bins[axis][i].count;
+					leftArea[i] = halfArea(box);
+					leftCount[i] = n;
+				}
+				box = AABB();
+				n = 0;
+				for (unsigned int i = BIN_COUNT - 1; i > 0; i--) {
+					box.expand(bins.bins[axis][i].bounds);
+					n += bins.bins[axis][i].count;
+					if (n == 0 || leftCount[i - 1] == 0) continue;
+					float cost = leftArea[i - 1] * leftCount[i - 1] + halfArea(box) * n;
+					if (cost < bestCost) {
+						bestCost = cost;
+						bestAxis = axis;
+						bestBin = i;
+					}
+				}
+			}
+		}
+
+		Reference* first = references.data() + task.begin;
+		Reference* last = references.data() + task.end;
+		Reference* middle = first;
+		if (bestAxis >= 0) {
+			middle = std::partition(first, last, [&](const Reference& reference) {
+				return binOf(reference.centroid[bestAxis], centroidMin[bestAxis], scale[bestAxis]) < bestBin;
+			});
+		}
+		if (middle == first || middle == last) {
+			// deep, or every centroid in one place: halve along the widest axis
+			int axis = centroidSize.x >= centroidSize.y ? (centroidSize.x >= centroidSize.z ? 0 : 2) : (centroidSize.y >= centroidSize.z ? 1 : 2);
+			middle = first + count / 2;
+			std::nth_element(first, middle, last, [axis](const Reference& a, const Reference& b) {
+				return a.centroid[axis] < b.centroid[axis];
+			});
+		}
+
+		uint32_t pair = nodeCount.fetch_add(2);
+		node.first = pair;
+		node.count = 0;
+		uint32_t mid = task.begin + static_cast<uint32_t>(middle - first);
+		children[0] = { pair, task.begin, mid, task.depth + 1 };
+		children[1] = { pair + 1, mid, task.end, task.depth + 1 };
+		return true;
+	};
+
+	// level by level: while a level has fewer nodes than threads each node is binned in parallel
+	// chunks, after that the nodes of a level are split side by side
+	std::vector<Task> level(1, Task{ 0, 0, static_cast<uint32_t>(count), 0 });
+	while (!level.empty()) {
+		depth++;
+		std::vector<Task> next(level.size() * 2);
+		std::vector<unsigned char> inner(level.size());
+		if (level.size() > pool.size()) {
+			pool.parallelFor(level.size(), [&](size_t i) {
+				inner[i] = split(level[i], false, &next[2 * i]) ? 1 : 0;
+			});
+		}
+		else {
+			for (size_t i = 0; i < level.size(); i++)
+				inner[i] = split(level[i], true, &next[2 * i]) ? 1 : 0;
+		}
+		level.clear();
+		for (size_t i = 0; i < inner.size(); i++) {
+			if (!inner[i]) continue;
+			level.push_back(next[2 * i]);
+			level.push_back(next[2 * i + 1]);
+		}
+	}
+	nodeList.resize(nodeCount.load());
+
+	order.resize(count);
+	orderedBounds.resize(count);
+	pool.parallelFor(count, [&](size_t i) {
+		order[i] = references[i].primitive;
+		orderedBounds[i] = references[i].bounds;
+	}, CHUNK_SIZE);
+
+	lastStats.nodes = nodeList.size();
+	lastStats.leaves = leafCount.load();
+	lastStats.depth = depth;
+	lastStats.buildMs = millisecondsSince(start);
+}
+
+void Bvh::refit(const AABB* bounds) {
+
+	if (nodeList.empty()) return;
+	Clock::time_point start = Clock::now();
+
+	ThreadPool::shared().parallelFor(nodeList.size(), [&](size_t i) {
+		Node& node = nodeList[i];
+		if (!node.leaf()) return;
+		AABB box;
+		for (uint32_t k = node.first; k < node.first + node.count; k++) {
+			orderedBounds[k] = bounds[order[k]];
+			box.expand(orderedBounds[k]);
+		}
+		node.bounds = box;
+	}, 1024);
+
+	// children always come after their parent
+	for (size_t i = nodeList.size(); i-- > 0;) {
+		Node& node = nodeList[i];
+		if (node.leaf()) continue;
+		node.bounds = nodeList[node.first].bounds;
+		node.bounds.expand(nodeList[node.first + 1].bounds);
+	}
+
+	lastStats.refitMs = millisecondsSince(start);
+}
+
+size_t Bvh::cull(const Frustum& frustum, std::vector<unsigned char>& visible, size_t* nodesVisited) const {
+
+	visible.assign(order.size(), 0);
+	if (nodesVisited) *nodesVisited = 0;
+	if (nodeList.empty()) return 0;
+
+	// planes still to be tested, one bit each: a box fully inside a plane clears its bit for the subtree
+	auto classify = [&frustum](const AABB& box, uint32_t& planes) -> bool {
+		for (int k = 0; k < 6; k++) {
+			if (!(planes & (1u << k))) continue;
+			const glm::vec4& plane = frustum.planes[k];
+			glm::vec3 n(plane);
+			glm::vec3 furthest(n.x >= 0.0f ? box.max.x : box.min.x, n.y >= 0.0f ? box.max.y : box.min.y, n.z >= 0.0f ? box.max.z : box.min.z);
+			if (glm::dot(n, furthest) + plane.w < 0.0f) return false;
+			glm::vec3 nearest(n.x >= 0.0f ? box.min.x : box.max.x, n.y >= 0.0f ? box.min.y : box.max.y, n.z >= 0.0f ? box.min.z : box.max.z);
+			if (glm::dot(n, nearest) + plane.w >= 0.0f) planes &= ~(1u << k);
+		}
+		return true;
+	};
+
+	struct Entry {
+		uint32_t node;
+		uint32_t planes;
+	};
+	Entry stack[64];
+	int top = 0;
+	stack[top++] = { 0, 0x3Fu };
+	size_t visibleCount = 0, visited = 0;
+	while (top > 0) {
+		Entry entry = stack[--top];
+		const Node& node = nodeList[entry.node];
+		visited++;
+		if (entry.planes && !classify(node.bounds, entry.planes)) continue;
+		if (node.leaf()) {
+			for (uint32_t i = node.first; i < node.first + node.count; i++) {
+				uint32_t planes = entry.planes;
+				if (planes && !classify(orderedBounds[i], planes)) continue;
+				visible[order[i]] = 1;
+				visibleCount++;
+			}
+			continue;
+		}
+		stack[top++] = { node.first + 1, entry.planes };
+		stack[top++] = { node.first, entry.planes };
+	}
+
+	if (nodesVisited) *nodesVisited = visited;
+	return visibleCount;
+}
+
+void Bvh::query(const AABB& range, std::vector<uint32_t>& out) const {
+
+	if (nodeList.empty() || !range.valid()) return;
+
+	auto overlaps = [&range](const AABB& box) {
+		return box.min.x <= range.max.x && box.max.x >= range.min.x
+			&& box.min.y <= range.max.y && box.max.y >= range.min.y
+			&& box.min.z <= range.max.z && box.max.z >= range.min.z;
+	};
+
+	uint32_t stack[64];
+	int top = 0;
+	stack[top++] = 0;
+	while (top > 0) {
+		const Node& node = nodeList[stack[--top]];
+		if (!overlaps(node.bounds)) continue;
+		if (node.leaf()) {
+			for (uint32_t i = node.first; i < node.first + node.count; i++)
+				if (overlaps(orderedBounds[i]))
+					out.push_back(order[i]);
+			continue;
+		}
+		stack[top++] = node.first + 1;
+		stack[top++] = node.first;
+	}
+}
+
+bool Bvh::intersects(const Ray& ray, const glm::vec3& inverseDirection, const AABB& box, float tMax, float& tEnter) {
+
+	if (!box.valid()) return false;
+	glm::vec3 t0 = (box.min - ray.origin) * inverseDirection;
+	glm::vec3 t1 = (box.max - ray.origin) * inverseDirection;
+	glm::vec3 entry = glm::min(t0, t1);
+	glm::vec3 exit = glm::max(t0, t1);
+	tEnter = std::max(std::max(entry.x, entry.y), std::max(entry.z, 0.0f));
+	float tExit = std::min(std::min(exit.x, exit.y), std::min(exit.z, tMax));
+	return tEnter <= tExit;
+}
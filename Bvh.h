@@ -0,0 +1,134 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "Frustum.h"
+
+struct Ray {
+	glm::vec3 origin;
+	glm::vec3 direction; // need not be normalized, hit distances are in units of its length
+};
+
+// Bounding volume hierarchy over any set of boxes (mesh instances, triangles). Built top down with
+// binned SAH: the levels near the root bin their primitives in parallel chunks, further down whole
+// subtrees are split side by side on ThreadPool::shared(). Primitives are referred to by their index
+// in the array given to build(); refit() takes new boxes for the same primitives and keeps the tree,
+// which stays valid for moving objects but degrades the further they travel.
+class Bvh {
+
+public:
+	static const unsigned int BIN_COUNT = 16;
+	// deeper nodes are split at the median, which keeps any 32-bit primitive count under 64 levels
+	// and the fixed traversal stacks from overflowing
+	static const unsigned int MAX_SAH_DEPTH = 28;
+
+	// 32 bytes. Children are allocated in pairs after their parent: inner nodes have count 0 and
+	// children first and first + 1, leaves hold primitiveIndices()[first, first + count).
+	struct Node {
+		AABB bounds;
+		uint32_t first = 0;
+		uint32_t count = 0;
+
+		bool leaf() const { return count > 0; }
+	};
+
+	struct Stats {
+		size_t primitives = 0;
+		size_t nodes = 0;
+		size_t leaves = 0;
+		unsigned int depth = 0;
+		double buildMs = 0.0;
+		double refitMs = 0.0;
+	};
+
+	// nodes with at most this many primitives become leaves
+	unsigned int maxLeafSize = 4;
+
+	void build(const AABB* bounds, size_t count);
+	void build(const std::vector<AABB>& bounds) { build(bounds.data(), bounds.size()); }
+	// same primitives as the last build, new boxes
+	void refit(const AABB* bounds);
+	void refit(const std::vector<AABB>& bounds) { refit(bounds.data()); }
+	void clear();
+
+	bool empty() const { return nodeList.empty(); }
+	const std::vector<Node>& nodes() const { return nodeList; }
+	const std::vector<uint32_t>& primitiveIndices() const { return order; }
+	const Stats& stats() const { return lastStats; }
+
+	// visible[i] becomes 1 for every primitive whose box passes. Whole subtrees inside the frustum are
+	// taken without further tests, the rest only test the planes their parent straddles.
+	// Returns the number of visible primitives.
+	size_t cull(const Frustum& frustum, std::vector<unsigned char>& visible, size_t* nodesVisited = nullptr) const;
+
+	// appends every primitive whose box overlaps range
+	void query(const AABB& range, std::vector<uint32_t>& out) const;
+
+	// nearest hit closer than tMax, front to back. intersect(primitive, tMax) tests one primitive and
+	// returns true after lowering tMax to its hit distance; the nearest primitive is returned, or -1.
+	template<typename Intersect>
+	int64_t raycast(const Ray& ray, float& tMax, Intersect intersect) const;
+
+	// slab test, tEnter is where the ray enters the box (0 when it starts inside)
+	static bool intersects(const Ray& ray, const glm::vec3& inverseDirection, const AABB& box, float tMax, float& tEnter);
+
+private:
+	std::vector<Node> nodeList;
+	std::vector<uint32_t> order;
+	std::vector<AABB> orderedBounds; // primitive boxes in leaf order, for the tests inside a leaf
+	Stats lastStats;
+};
+
+template<typename Intersect>
+int64_t Bvh::raycast(const Ray& ray, float& tMax, Intersect intersect) const {
+
+	int64_t hit = -1;
+	if (nodeList.empty()) return hit;
+
+	glm::vec3 inverseDirection = 1.0f / ray.direction;
+	float tEnter;
+	if (!intersects(ray, inverseDirection, nodeList[0].bounds, tMax, tEnter)) return hit;
+
+	// the nearer child is visited first, the other is pushed with its entry distance so it can be
+	// skipped once a closer hit has been found
+	struct Entry {
+		uint32_t node;
+		float t;
+	};
+	Entry stack[64];
+	int top = 0;
+	stack[top++] = { 0, tEnter };
+	while (top > 0) {
+		Entry entry = stack[--top];
+		if (entry.t > tMax) continue;
+		const Node& node = nodeList[entry.node];
+		if (node.leaf()) {
+			for (uint32_t i = node.first; i < node.first + node.count; i++)
+				if (intersect(order[i], tMax))
+					hit = order[i];
+			continue;
+		}
+		float tLeft, tRight;
+		bool left = intersects(ray, inverseDirection, nodeList[node.first].bounds, tMax, tLeft);
+		bool right = intersects(ray, inverseDirection, nodeList[node.first + 1].bounds, tMax, tRight);
+		if (left && right) {
+			bool leftFirst = tLeft <= tRight;
+			stack[top++] = leftFirst ? Entry{ node.first + 1, tRight } : Entry{ node.first, tLeft };
+			stack[top++] = leftFirst ? Entry{ node.first, tLeft } : Entry{ node.first + 1, tRight };
+		}
+		else if (left) {
+			stack[top++] = { node.first, tLeft };
+		}
+		else if (right) {
+			stack[top++] = { node.first + 1, tRight };
+		}
+	}
+	return hit;
+}
+
+#endif
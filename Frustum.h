@@ -0,0 +1,133 @@
+#ifndef FRUSTUM_H
+#define FRUSTUM_H
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+// Axis aligned bounding box
+struct AABB
+{
+    glm::vec3 min = glm::vec3(FLT_MAX);
+    glm::vec3 max = glm::vec3(-FLT_MAX);
+
+    bool valid() const { return min.x <= max.x && min.y <= max.y && min.z <= max.z; }
+    glm::vec3 center() const { return (min + max) * 0.5f; }
+    glm::vec3 extent() const { return max - min; }
+
+    void expand(const glm::vec3& p)
+    {
+        min = glm::min(min, p);
+        max = glm::max(max, p);
+    }
+
+    void expand(const AABB& other)
+    {
+        min = glm::min(min, other.min);
+        max = glm::max(max, other.max);
+    }
+
+    // Box around the eight transformed corners (Arvo's method)
+    AABB transformed(const glm::mat4& m) const
+    {
+        AABB result;
+        if (!valid()) return result;
+
+        glm::vec3 translation(m[3]);
+        result.min = translation;
+        result.max = translation;
+        for (int col = 0; col < 3; col++) {
+            for (int row = 0; row < 3; row++) {
+                float a = m[col][row] * min[col];
+                float b = m[col][row] * max[col];
+                result.min[row] += std::min(a, b);
+                result.max[row] += std::max(a, b);
+            }
+        }
+        return result;
+    }
+};
+
+// Sphere around a mesh, usually tighter than the box for round or diagonal shapes
+struct BoundingSphere
+{
+    glm::vec3 center = glm::vec3(0.0f);
+    float radius = -1.0f;
+
+    bool valid() const { return radius >= 0.0f; }
+
+    // the sphere through the corners of a box
+    static BoundingSphere around(const AABB& box)
+    {
+        BoundingSphere result;
+        if (!box.valid()) return result;
+        result.center = box.center();
+        result.radius = glm::length(box.extent()) * 0.5f;
+        return result;
+    }
+
+    // radius scaled by the largest axis scale, so it stays conservative under non-uniform scaling
+    BoundingSphere transformed(const glm::mat4& m) const
+    {
+        BoundingSphere result;
+        if (!valid()) return result;
+        result.center = glm::vec3(m * glm::vec4(center, 1.0f));
+        float scale = std::max(glm::length(glm::vec3(m[0])), std::max(glm::length(glm::vec3(m[1])), glm::length(glm::vec3(m[2]))));
+        result.radius = radius * scale;
+        return result;
+    }
+};
+
+// Six clip planes (ax + by + cz + d >= 0 inside) extracted from a view projection matrix.
+// Pass projection * view * model to get the planes in that model's local space.
+struct Frustum
+{
+    glm::vec4 planes[6];
+
+    Frustum() {}
+
+    explicit Frustum(const glm::mat4& m)
+    {
+        // Gribb/Hartmann, glm is column major so row i is (m[0][i], m[1][i], m[2][i], m[3][i])
+        glm::vec4 row0(m[0][0], m[1][0], m[2][0], m[3][0]);
+        glm::vec4 row1(m[0][1], m[1][1], m[2][1], m[3][1]);
+        glm::vec4 row2(m[0][2], m[1][2], m[2][2], m[3][2]);
+        glm::vec4 row3(m[0][3], m[1][3], m[2][3], m[3][3]);
+
+        planes[0] = row3 + row0; // left
+        planes[1] = row3 - row0; // right
+        planes[2] = row3 + row1; // bottom
+        planes[3] = row3 - row1; // top
+        planes[4] = row3 + row2; // near
+        planes[5] = row3 - row2; // far
+
+        for (glm::vec4& plane : planes)
+            plane /= glm::length(glm::vec3(plane));
+    }
+
+    // false only when the box is completely outside one of the planes
+    bool intersects(const AABB& box) const
+    {
+        for (const glm::vec4& plane : planes) {
+            // corner furthest along the plane normal
+            glm::vec3 p(plane.x >= 0.0f ? box.max.x : box.min.x,
+                        plane.y >= 0.0f ? box.max.y : box.min.y,
+                        plane.z >= 0.0f ? box.max.z : box.min.z);
+            if (glm::dot(glm::vec3(plane), p) + plane.w < 0.0f)
+                return false;
+        }
+        return true;
+    }
+
+    bool intersects(const BoundingSphere& sphere) const
+    {
+        for (const glm::vec4& plane : planes)
+            if (glm::dot(glm::vec3(plane), sphere.center) + plane.w < -sphere.radius)
+                return false;
+        return true;
+    }
+};
+
+#endif
@@ -0,0 +1,250 @@
+#include "FrustumCuller.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define FRUSTUMCULLER_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define FRUSTUMCULLER_SSE2
+#endif
+
+namespace {
+
+	// four visibility bytes for each 4-bit movemask, x86 is little endian
+	const uint32_t MASK_BYTES[16] = {
+		0x00000000, 0x00000001, 0x00000100, 0x00000101, 0x00010000, 0x00010001, 0x00010100, 0x00010101,
+		0x01000000, 0x01000001, 0x01000100, 0x01000101, 0x01010000, 0x01010001, 0x01010100, 0x01010101
+	};
+
+	unsigned int bitCount(unsigned int mask) {
+		unsigned int count = 0;
+		for (; mask; mask &= mask - 1) count++;
+		return count;
+	}
+
+	// plane coefficients split out once per cull, the kernels broadcast them
+	struct Planes {
+		float nx[6], ny[6], nz[6], d[6];
+		float ax[6], ay[6], az[6]; // |n|
+	};
+
+	Planes splitPlanes(const Frustum& frustum) {
+		Planes p;
+		for (int i = 0; i < 6; i++) {
+			const glm::vec4& plane = frustum.planes[i];
+			p.nx[i] = plane.x;
+			p.ny[i] = plane.y;
+			p.nz[i] = plane.z;
+			p.d[i] = plane.w;
+			p.ax[i] = std::abs(plane.x);
+			p.ay[i] = std::abs(plane.y);
+			p.az[i] = std::abs(plane.z);
+		}
+		return p;
+	}
+
+}
+
+void FrustumCuller::clear() {
+	for (std::vector<float>* column : { &centerX, &centerY, &centerZ, &extentX, &extentY, &extentZ,
+		&sphereX, &sphereY, &sphereZ, &sphereRadius })
+		column->clear();
+}
+
+void FrustumCuller::reserve(size_t count) {
+	for (std::vector<float>* column : { &centerX, &centerY, &centerZ, &extentX, &extentY, &extentZ,
+		&sphereX, &sphereY, &sphereZ, &sphereRadius })
+		column->reserve(count);
+}
+
+size_t FrustumCuller::add(const AABB& box, const BoundingSphere& sphere) {
+	size_t index = size();
+	for (std::vector<float>* column : { &centerX, &centerY, &centerZ, &extentX, &extentY, &extentZ,
+		&sphereX, &sphereY, &sphereZ, &sphereRadius })
+		column->push_back(0.0f);
+	set(index, box, sphere);
+	return index;
+}
+
+void FrustumCuller::set(size_t index, const AABB& box, const BoundingSphere& sphere) {
+
+	// an empty box is outside every plane, a missing sphere falls back to the one around the box
+	glm::vec3 center = box.valid() ? box.center() : glm::vec3(0.0f);
+	glm::vec3 extent = box.valid() ? box.extent() * 0.5f : glm::vec3(-FLT_MAX);
+	BoundingSphere bounding = sphere.valid() ? sphere : BoundingSphere::around(box);
+	if (!bounding.valid()) bounding.radius = -FLT_MAX;
+
+	centerX[index] = center.x;
+	centerY[index] = center.y;
+	centerZ[index] = center.z;
+	extentX[index] = extent.x;
+	extentY[index] = extent.y;
+	extentZ[index] = extent.z;
+	sphereX[index] = bounding.center.x;
+	sphereY[index] = bounding.center.y;
+	sphereZ[index] = bounding.center.z;
+	sphereRadius[index] = bounding.radius;
+}
+
+const char* FrustumCuller::instructionSet() {
+#if defined(FRUSTUMCULLER_AVX2)
+	return "AVX2";
+#elif defined(FRUSTUMCULLER_SSE2)
+	return "SSE2";
+#else
+	return "scalar";
+#endif
+}
+
+size_t FrustumCuller::cull(const Frustum& frustum, std::vector<unsigned char>& visible, Volume volume) {
+
+	auto start = std::chrono::high_resolution_clock::now();
+	size_t count = size();
+	visible.resize(count);
+
+	size_t visibleCount = 0;
+	size_t blocks = (count + BLOCK_SIZE - 1) / BLOCK_SIZE;
+	if (count < parallelThreshold || blocks < 2) {
+		visibleCount = cullRange(frustum, visible.data(), 0, count, volume);
+		blocks = 1;
+	}
+	else {
+		std::vector<size_t> blockVisible(blocks);
+		ThreadPool::shared().parallelFor(blocks, [&](size_t block) {
+			size_t first = block * BLOCK_SIZE;
+			blockVisible[block] = cullRange(frustum, visible.data(), first, std::min(count, first + BLOCK_SIZE), volume);
+		});
+		for (size_t n : blockVisible)
+			visibleCount += n;
+	}
+
+	lastStats.tested = count;
+	lastStats.visible = visibleCount;
+	lastStats.blocks = static_cast<unsigned int>(blocks);
+	lastStats.ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	return visibleCount;
+}
+
+size_t FrustumCuller::cullScalar(const Frustum& frustum, std::vector<unsigned char>& visible, Volume volume) {
+
+	auto start = std::chrono::high_resolution_clock::now();
+	size_t count = size();
+	visible.resize(count);
+
+	size_t visibleCount = 0;
+	for (size_t i = 0; i < count; i++) {
+		bool inside = true;
+		if (volume != Volume::Box) {
+			BoundingSphere sphere;
+			sphere.center = glm::vec3(sphereX[i], sphereY[i], sphereZ[i]);
+			sphere.radius = sphereRadius[i];
+			inside = frustum.intersects(sphere);
+		}
+		if (inside && volume != Volume::Sphere) {
+			AABB box;
+			glm::vec3 center(centerX[i], centerY[i], centerZ[i]), extent(extentX[i], extentY[i], extentZ[i]);
+			box.min = center - extent;
+			box.max = center + extent;
+			inside = frustum.intersects(box);
+		}
+		visible[i] = inside ? 1 : 0;
+		visibleCount += inside ? 1 : 0;
+	}
+
+	lastStats.tested = count;
+	lastStats.visible = visibleCount;
+	lastStats.blocks = 1;
+	lastStats.ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	return visibleCount;
+}
+
+size_t FrustumCuller::cullRange(const Frustum& frustum, unsigned char* visible, size_t first, size_t end, Volume volume) const {
+
+	const Planes p = splitPlanes(frustum);
+	const bool testBox = volume != Volume::Sphere;
+	const bool testSphere = volume != Volume::Box;
+	size_t visibleCount = 0;
+	size_t i = first;
+
+#if defined(FRUSTUMCULLER_AVX2)
+	const __m256 zero = _mm256_setzero_ps();
+	for (; i + 8 <= end; i += 8) {
+		__m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+		if (testSphere) {
+			__m256 x = _mm256_loadu_ps(&sphereX[i]), y = _mm256_loadu_ps(&sphereY[i]), z = _mm256_loadu_ps(&sphereZ[i]);
+			__m256 r = _mm256_loadu_ps(&sphereRadius[i]);
+			for (int k = 0; k < 6; k++) {
+				__m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, _mm256_set1_ps(p.nx[k])), _mm256_mul_ps(y, _mm256_set1_ps(p.ny[k]))),
+					_mm256_add_ps(_mm256_mul_ps(z, _mm256_set1_ps(p.nz[k])), _mm256_set1_ps(p.d[k])));
+				inside = _mm256_and_ps(inside, _mm256_cmp_ps(_mm256_add_ps(distance, r), zero, _CMP_GE_OQ));
+			}
+		}
+		if (testBox && _mm256_movemask_ps(inside) != 0) {
+			__m256 x = _mm256_loadu_ps(&centerX[i]), y = _mm256_loadu_ps(&centerY[i]), z = _mm256_loadu_ps(&centerZ[i]);
+			__m256 ex = _mm256_loadu_ps(&extentX[i]), ey = _mm256_loadu_ps(&extentY[i]), ez = _mm256_loadu_ps(&extentZ[i]);
+			for (int k = 0; k < 6; k++) {
+				__m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, _mm256_set1_ps(p.nx[k])), _mm256_mul_ps(y, _mm256_set1_ps(p.ny[k]))),
+					_mm256_add_ps(_mm256_mul_ps(z, _mm256_set1_ps(p.nz[k])), _mm256_set1_ps(p.d[k])));
+				__m256 radius = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ex, _mm256_set1_ps(p.ax[k])), _mm256_mul_ps(ey, _mm256_set1_ps(p.ay[k]))),
+					_mm256_mul_ps(ez, _mm256_set1_ps(p.az[k])));
+				inside = _mm256_and_ps(inside, _mm256_cmp_ps(_mm256_add_ps(distance, radius), zero, _CMP_GE_OQ));
+			}
+		}
+		unsigned int mask = static_cast<unsigned int>(_mm256_movemask_ps(inside));
+		std::memcpy(visible + i, &MASK_BYTES[mask & 15], 4);
+		std::memcpy(visible + i + 4, &MASK_BYTES[mask >> 4], 4);
+		visibleCount += bitCount(mask);
+	}
+#elif defined(FRUSTUMCULLER_SSE2)
+	const __m128 zero = _mm_setzero_ps();
+	for (; i + 4 <= end; i += 4) {
+		__m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+		if (testSphere) {
+			__m128 x = _mm_loadu_ps(&sphereX[i]), y = _mm_loadu_ps(&sphereY[i]), z = _mm_loadu_ps(&sphereZ[i]);
+			__m128 r = _mm_loadu_ps(&sphereRadius[i]);
+			for (int k = 0; k < 6; k++) {
+				__m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(p.nx[k])), _mm_mul_ps(y, _mm_set1_ps(p.ny[k]))),
+					_mm_add_ps(_mm_mul_ps(z, _mm_set1_ps(p.nz[k])), _mm_set1_ps(p.d[k])));
+				inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(distance, r), zero));
+			}
+		}
+		if (testBox && _mm_movemask_ps(inside) != 0) {
+			__m128 x = _mm_loadu_ps(&centerX[i]), y = _mm_loadu_ps(&centerY[i]), z = _mm_loadu_ps(&centerZ[i]);
+			__m128 ex = _mm_loadu_ps(&extentX[i]), ey = _mm_loadu_ps(&extentY[i]), ez = _mm_loadu_ps(&extentZ[i]);
+			for (int k = 0; k < 6; k++) {
+				__m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(p.nx[k])), _mm_mul_ps(y, _mm_set1_ps(p.ny[k]))),
+					_mm_add_ps(_mm_mul_ps(z, _mm_set1_ps(p.nz[k])), _mm_set1_ps(p.d[k])));
+				__m128 radius = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ex, _mm_set1_ps(p.ax[k])), _mm_mul_ps(ey, _mm_set1_ps(p.ay[k]))),
+					_mm_mul_ps(ez, _mm_set1_ps(p.az[k])));
+				inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(distance, radius), zero));
+			}
+		}
+		unsigned int mask = static_cast<unsigned int>(_mm_movemask_ps(inside));
+		std::memcpy(visible + i, &MASK_BYTES[mask], 4);
+		visibleCount += bitCount(mask);
+	}
+#endif
+
+	// the last few objects, or all of them without SIMD
+	for (; i < end; i++) {
+		bool inside = true;
+		for (int k = 0; k < 6 && inside; k++) {
+			if (testSphere)
+				inside = sphereX[i] * p.nx[k] + sphereY[i] * p.ny[k] + sphereZ[i] * p.nz[k] + p.d[k] + sphereRadius[i] >= 0.0f;
+			if (inside && testBox) {
+				float distance = centerX[i] * p.nx[k] + centerY[i] * p.ny[k] + centerZ[i] * p.nz[k] + p.d[k];
+				float radius = extentX[i] * p.ax[k] + extentY[i] * p.ay[k] + extentZ[i] * p.az[k];
+				inside = distance + radius >= 0.0f;
+			}
+		}
+		visible[i] = inside ? 1 : 0;
+		visibleCount += inside ? 1 : 0;
+	}
+	return visibleCount;
+}
@@ -0,0 +1,115 @@
+#include "GLExtensions.h"
+
+#include <iostream>
+#include <unordered_set>
+
+namespace {
+
+	std::unordered_set<std::string> extensions;
+
+}
+
+namespace GLExt {
+
+	bool programBinary = false;
+	GetProgramBinaryProc GetProgramBinary = NULL;
+	ProgramBinaryProc ProgramBinary = NULL;
+	ProgramParameteriProc ProgramParameteri = NULL;
+
+	bool parallelShaderCompile = false;
+	MaxShaderCompilerThreadsProc MaxShaderCompilerThreads = NULL;
+
+	bool baseInstance = false;
+	DrawElementsInstancedBaseVertexBaseInstanceProc DrawElementsInstancedBaseVertexBaseInstance = NULL;
+
+	bool multiDrawIndirect = false;
+	MultiDrawElementsIndirectProc MultiDrawElementsIndirect = NULL;
+
+	bool computeShader = false;
+	DispatchComputeProc DispatchCompute = NULL;
+	MemoryBarrierProc MemoryBarriers = NULL;
+	BindImageTextureProc BindImageTexture = NULL;
+	ClearBufferSubDataProc ClearBufferSubData = NULL;
+
+	bool indirectCount = false;
+	MultiDrawElementsIndirectCountProc MultiDrawElementsIndirectCount = NULL;
+
+	bool pipelineStatistics = false;
+
+	bool bufferStorage = false;
+	BufferStorageProc BufferStorage = NULL;
+
+}
+
+bool GLExt::hasVersion(int major, int minor) {
+	return GLVersion.major > major || (GLVersion.major == major && GLVersion.minor >= minor);
+}
+
+bool GLExt::hasExtension(const std::string& name) {
+	return extensions.count(name) != 0;
+}
+
+void GLExt::load(GLADloadproc loader) {
+
+	extensions.clear();
+	GLint count = 0;
+	glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+	for (GLint i = 0; i < count; i++)
+		extensions.insert(reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, i)));
+
+	if (hasVersion(4, 1) || hasExtension("GL_ARB_get_program_binary")) {
+		GetProgramBinary = (GetProgramBinaryProc)loader("glGetProgramBinary");
+		ProgramBinary = (ProgramBinaryProc)loader("glProgramBinary");
+		ProgramParameteri = (ProgramParameteriProc)loader("glProgramParameteri");
+
+		GLint formats = 0;
+		glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+		programBinary = GetProgramBinary && ProgramBinary && ProgramParameteri && formats > 0;
+	}
+
+	if (hasExtension("GL_KHR_parallel_shader_compile"))
+		MaxShaderCompilerThreads = (MaxShaderCompilerThreadsProc)loader("glMaxShaderCompilerThreadsKHR");
+	else if (hasExtension("GL_ARB_parallel_shader_compile"))
+		MaxShaderCompilerThreads = (MaxShaderCompilerThreadsProc)loader("glMaxShaderCompilerThreadsARB");
+	parallelShaderCompile = MaxShaderCompilerThreads != NULL;
+	if (parallelShaderCompile)
+		MaxShaderCompilerThreads(0xFFFFFFFF); // as many threads as the driver wants
+
+	if (hasVersion(4, 2) || hasExtension("GL_ARB_base_instance"))
+		DrawElementsInstancedBaseVertexBaseInstance = (DrawElementsInstancedBaseVertexBaseInstanceProc)loader("glDrawElementsInstancedBaseVertexBaseInstance");
+	baseInstance = DrawElementsInstancedBaseVertexBaseInstance != NULL;
+
+	if (hasVersion(4, 3))
+		MultiDrawElementsIndirect = (MultiDrawElementsIndirectProc)loader("glMultiDrawElementsIndirect");
+	multiDrawIndirect = MultiDrawElementsIndirect != NULL && baseInstance;
+
+	if (hasVersion(4, 3)) {
+		DispatchCompute = (DispatchComputeProc)loader("glDispatchCompute");
+		MemoryBarriers = (MemoryBarrierProc)loader("glMemoryBarrier");
+		BindImageTexture = (BindImageTextureProc)loader("glBindImageTexture");
+		ClearBufferSubData = (ClearBufferSubDataProc)loader("glClearBufferSubData");
+	}
+	computeShader = DispatchCompute && MemoryBarriers && BindImageTexture && ClearBufferSubData;
+
+	if (hasVersion(4, 6))
+		MultiDrawElementsIndirectCount = (MultiDrawElementsIndirectCountProc)loader("glMultiDrawElementsIndirectCount");
+	else if (hasExtension("GL_ARB_indirect_parameters"))
+		MultiDrawElementsIndirectCount = (MultiDrawElementsIndirectCountProc)loader("glMultiDrawElementsIndirectCountARB");
+	indirectCount = MultiDrawElementsIndirectCount != NULL;
+
+	pipelineStatistics = hasVersion(4, 6) || hasExtension("GL_ARB_pipeline_statistics_query");
+
+	if (hasVersion(4, 4) || hasExtension("GL_ARB_buffer_storage"))
+		BufferStorage = (BufferStorageProc)loader("glBufferStorage");
+	bufferStorage = BufferStorage != NULL;
+
+	std::cout << "OpenGL " << glGetString(GL_VERSION) << " (" << glGetString(GL_RENDERER) << ")"
+		<< ", program binaries: " << (programBinary ? "yes" : "no")
+		<< ", parallel shader compile: " << (parallelShaderCompile ? "yes" : "no")
+		<< ", base instance: " << (baseInstance ? "yes" : "no")
+		<< ", multi draw indirect: " << (multiDrawIndirect ? "yes" : "no")
+		<< ", compute: " << (computeShader ? "yes" : "no")
+		<< ", indirect count: " << (indirectCount ? "yes" : "no")
+		<< ", pipeline statistics: " << (pipelineStatistics ? "yes" : "no")
+		<< ", buffer storage: " << (bufferStorage ? "yes" : "no") << std::endl;
+}
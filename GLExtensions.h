@@ -0,0 +1,118 @@
+#ifndef GLEXTENSIONS_H
+#define GLEXTENSIONS_H
+
+#include <glad/glad.h>
+
+#include <string>
+
+// The bundled GLAD loader only covers core 3.3. Entry points from newer versions are loaded here at
+// runtime when the context (or an ARB extension) provides them; every feature has a flag to check first.
+
+#ifndef GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+#define GL_PROGRAM_BINARY_FORMATS 0x87FF
+#endif
+
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_MAX_SHADER_COMPILER_THREADS_KHR 0x91B0
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+#ifndef GL_DRAW_INDIRECT_BUFFER
+#define GL_DRAW_INDIRECT_BUFFER 0x8F3F
+#endif
+
+#ifndef GL_SHADER_STORAGE_BUFFER
+#define GL_SHADER_STORAGE_BUFFER 0x90D2
+#endif
+
+#ifndef GL_COMPUTE_SHADER
+#define GL_COMPUTE_SHADER 0x91B9
+#define GL_SHADER_IMAGE_ACCESS_BARRIER_BIT 0x00000020
+#define GL_COMMAND_BARRIER_BIT 0x00000040
+#define GL_BUFFER_UPDATE_BARRIER_BIT 0x00000200
+#define GL_SHADER_STORAGE_BARRIER_BIT 0x00002000
+#endif
+
+#ifndef GL_PARAMETER_BUFFER
+#define GL_PARAMETER_BUFFER 0x80EE
+#endif
+
+#ifndef GL_FRAGMENT_SHADER_INVOCATIONS
+#define GL_FRAGMENT_SHADER_INVOCATIONS 0x82F4
+#endif
+
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#define GL_MAP_COHERENT_BIT 0x0080
+#define GL_DYNAMIC_STORAGE_BIT 0x0100
+#endif
+
+namespace GLExt {
+
+	typedef void (APIENTRYP GetProgramBinaryProc)(GLuint program, GLsizei bufSize, GLsizei* length, GLenum* binaryFormat, void* binary);
+	typedef void (APIENTRYP ProgramBinaryProc)(GLuint program, GLenum binaryFormat, const void* binary, GLsizei length);
+	typedef void (APIENTRYP ProgramParameteriProc)(GLuint program, GLenum pname, GLint value);
+	typedef void (APIENTRYP MaxShaderCompilerThreadsProc)(GLuint count);
+	typedef void (APIENTRYP DrawElementsInstancedBaseVertexBaseInstanceProc)(GLenum mode, GLsizei count, GLenum type,
+		const void* indices, GLsizei instancecount, GLint basevertex, GLuint baseinstance);
+	typedef void (APIENTRYP MultiDrawElementsIndirectProc)(GLenum mode, GLenum type, const void* indirect, GLsizei drawcount, GLsizei stride);
+	typedef void (APIENTRYP DispatchComputeProc)(GLuint x, GLuint y, GLuint z);
+	typedef void (APIENTRYP MemoryBarrierProc)(GLbitfield barriers);
+	typedef void (APIENTRYP BindImageTextureProc)(GLuint unit, GLuint texture, GLint level, GLboolean layered, GLint layer,
+		GLenum access, GLenum format);
+	typedef void (APIENTRYP ClearBufferSubDataProc)(GLenum target, GLenum internalformat, GLintptr offset, GLsizeiptr size,
+		GLenum format, GLenum type, const void* data);
+	typedef void (APIENTRYP MultiDrawElementsIndirectCountProc)(GLenum mode, GLenum type, const void* indirect, GLintptr drawcount,
+		GLsizei maxdrawcount, GLsizei stride);
+	typedef void (APIENTRYP BufferStorageProc)(GLenum target, GLsizeiptr size, const void* data, GLbitfield flags);
+
+	// GL 4.1 / GL_ARB_get_program_binary, with at least one binary format
+	extern bool programBinary;
+	extern GetProgramBinaryProc GetProgramBinary;
+	extern ProgramBinaryProc ProgramBinary;
+	extern ProgramParameteriProc ProgramParameteri;
+
+	// GL_KHR_parallel_shader_compile (or the ARB version): compiles and links run on driver threads,
+	// GL_COMPLETION_STATUS_KHR can be polled without waiting for them
+	extern bool parallelShaderCompile;
+	extern MaxShaderCompilerThreadsProc MaxShaderCompilerThreads;
+
+	// GL 4.2 / GL_ARB_base_instance: instanced attributes start at baseinstance instead of 0
+	extern bool baseInstance;
+	extern DrawElementsInstancedBaseVertexBaseInstanceProc DrawElementsInstancedBaseVertexBaseInstance;
+
+	// GL 4.3: glMultiDrawElementsIndirect, shader storage buffers and GLSL 430 (IndirectRenderer)
+	extern bool multiDrawIndirect;
+	extern MultiDrawElementsIndirectProc MultiDrawElementsIndirect;
+
+	// GL 4.3: compute shaders, image load/store and buffer clears (GpuCuller)
+	extern bool computeShader;
+	extern DispatchComputeProc DispatchCompute;
+	extern MemoryBarrierProc MemoryBarriers; // glMemoryBarrier, MemoryBarrier is a macro in winnt.h
+	extern BindImageTextureProc BindImageTexture;
+	extern ClearBufferSubDataProc ClearBufferSubData;
+
+	// GL 4.6 / GL_ARB_indirect_parameters: the draw count is read from GL_PARAMETER_BUFFER
+	extern bool indirectCount;
+	extern MultiDrawElementsIndirectCountProc MultiDrawElementsIndirectCount;
+
+	// GL 4.6 / GL_ARB_pipeline_statistics_query: glBeginQuery(GL_FRAGMENT_SHADER_INVOCATIONS) and friends,
+	// no new entry points
+	extern bool pipelineStatistics;
+
+	// GL 4.4 / GL_ARB_buffer_storage: immutable storage that can stay mapped while the GPU reads it (StreamBuffer)
+	extern bool bufferStorage;
+	extern BufferStorageProc BufferStorage;
+
+	// call once after gladLoadGLLoader with the same loader
+	void load(GLADloadproc loader);
+
+	bool hasVersion(int major, int minor);
+	bool hasExtension(const std::string& name);
+
+}
+
+#endif
@@ -0,0 +1,260 @@
+#include "GLState.h"
+
+#include <functional>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+bool PipelineDesc::operator==(const PipelineDesc& other) const {
+	return depthTest == other.depthTest && depthWrite == other.depthWrite && depthFunc == other.depthFunc
+		&& blend == other.blend && blendSrc == other.blendSrc && blendDst == other.blendDst
+		&& cullFace == other.cullFace && cullMode == other.cullMode && frontFace == other.frontFace
+		&& colorWrite == other.colorWrite;
+}
+
+size_t PipelineDesc::hash() const {
+	size_t h = 0;
+	auto mix = [&h](size_t value) { h ^= std::hash<size_t>()(value) + 0x9e3779b9 + (h << 6) + (h >> 2); };
+	mix(depthTest); mix(depthWrite); mix(depthFunc);
+	mix(blend); mix(blendSrc); mix(blendDst);
+	mix(cullFace); mix(cullMode); mix(frontFace);
+	mix(colorWrite);
+	return h;
+}
+
+const PipelineState* PipelineState::get(const PipelineDesc& desc) {
+	static std::unordered_multimap<size_t, std::unique_ptr<PipelineState>> states;
+
+	size_t hash = desc.hash();
+	auto range = states.equal_range(hash);
+	for (auto it = range.first; it != range.second; ++it)
+		if (it->second->desc == desc)
+			return it->second.get();
+
+	PipelineState* state = new PipelineState(desc);
+	states.emplace(hash, std::unique_ptr<PipelineState>(state));
+	return state;
+}
+
+namespace {
+
+	const GLuint UNKNOWN = ~0u;
+
+	struct IndexedBinding {
+		GLuint buffer;
+		GLintptr offset;
+		GLsizeiptr size; // -1 for glBindBufferBase
+	};
+
+	// the buffer targets the renderer uses, anything else is passed through untracked
+	enum BufferSlot { ARRAY_SLOT, ELEMENT_SLOT, UNIFORM_SLOT, BUFFER_SLOTS };
+
+	struct Shadow {
+		GLuint program;
+		GLuint vao;
+		GLuint buffers[BUFFER_SLOTS];
+		IndexedBinding uniformBindings[GLState::MAX_BUFFER_BINDINGS];
+		unsigned int activeUnit;
+		GLuint textures[GLState::MAX_TEXTURE_UNITS];
+		const PipelineState* pipeline;
+		PipelineDesc applied;
+		bool appliedKnown;
+	};
+
+	Shadow shadow;
+	GLState::Stats stats;
+	bool initialized = false;
+
+	int bufferSlot(GLenum target) {
+		switch (target) {
+		case GL_ARRAY_BUFFER: return ARRAY_SLOT;
+		case GL_ELEMENT_ARRAY_BUFFER: return ELEMENT_SLOT;
+		case GL_UNIFORM_BUFFER: return UNIFORM_SLOT;
+		default: return -1;
+		}
+	}
+
+	Shadow& state() {
+		if (!initialized) {
+			GLState::invalidate();
+			initialized = true;
+		}
+		return shadow;
+	}
+
+	bool changed(GLuint& current, GLuint value) {
+		if (current == value) {
+			stats.elided++;
+			return false;
+		}
+		current = value;
+		stats.issued++;
+		return true;
+	}
+
+	void setCapability(GLenum capability, bool enable) {
+		if (enable) glEnable(capability);
+		else glDisable(capability);
+	}
+
+}
+
+void GLState::invalidate() {
+	shadow.program = UNKNOWN;
+	shadow.vao = UNKNOWN;
+	for (GLuint& buffer : shadow.buffers) buffer = UNKNOWN;
+	for (IndexedBinding& binding : shadow.uniformBindings) binding = { UNKNOWN, 0, 0 };
+	shadow.activeUnit = UNKNOWN;
+	for (GLuint& texture : shadow.textures) texture = UNKNOWN;
+	shadow.pipeline = nullptr;
+	shadow.appliedKnown = false;
+	initialized = true;
+}
+
+void GLState::useProgram(GLuint program) {
+	if (changed(state().program, program))
+		glUseProgram(program);
+}
+
+GLuint GLState::program() {
+	GLuint program = state().program;
+	return program == UNKNOWN ? 0 : program;
+}
+
+void GLState::bindVertexArray(GLuint vao) {
+	if (changed(state().vao, vao)) {
+		glBindVertexArray(vao);
+		// the element buffer binding is part of the vertex array
+		shadow.buffers[ELEMENT_SLOT] = UNKNOWN;
+	}
+}
+
+void GLState::bindBuffer(GLenum target, GLuint buffer) {
+	int slot = bufferSlot(target);
+	if (slot < 0) {
+		stats.issued++;
+		glBindBuffer(target, buffer);
+	}
+	else if (changed(state().buffers[slot], buffer)) {
+		glBindBuffer(target, buffer);
+	}
+}
+
+void GLState::bindBufferBase(GLenum target, GLuint index, GLuint buffer) {
+	Shadow& s = state();
+	if (target == GL_UNIFORM_BUFFER && index < MAX_BUFFER_BINDINGS) {
+		IndexedBinding& binding = s.uniformBindings[index];
+		if (binding.buffer == buffer && binding.size == -1) {
+			stats.elided++;
+			return;
+		}
+		binding = { buffer, 0, -1 };
+	}
+	stats.issued++;
+	glBindBufferBase(target, index, buffer);
+	// indexed binds also replace the generic binding point
+	int slot = bufferSlot(target);
+	if (slot >= 0) s.buffers[slot] = buffer;
+}
+
+void GLState::bindBufferRange(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size) {
+	Shadow& s = state();
+	if (target == GL_UNIFORM_BUFFER && index < MAX_BUFFER_BINDINGS) {
+		IndexedBinding& binding = s.uniformBindings[index];
+		if (binding.buffer == buffer && binding.offset == offset && binding.size == size) {
+			stats.elided++;
+			return;
+		}
+		binding = { buffer, offset, size };
+	}
+	stats.issued++;
+	glBindBufferRange(target, index, buffer, offset, size);
+	int slot = bufferSlot(target);
+	if (slot >= 0) s.buffers[slot] = buffer;
+}
+
+void GLState::bindTexture(unsigned int unit, GLuint texture) {
+	Shadow& s = state();
+	if (unit >= MAX_TEXTURE_UNITS) {
+		stats.issued += 2;
+		glActiveTexture(GL_TEXTURE0 + unit);
+		glBindTexture(GL_TEXTURE_2D, texture);
+		s.activeUnit = unit;
+		return;
+	}
+	if (s.textures[unit] == texture) {
+		stats.elided++;
+		return;
+	}
+	if (changed(s.activeUnit, unit))
+		glActiveTexture(GL_TEXTURE0 + unit);
+	s.textures[unit] = texture;
+	stats.issued++;
+	glBindTexture(GL_TEXTURE_2D, texture);
+}
+
+void GLState::setPipeline(const PipelineState* pipeline) {
+	Shadow& s = state();
+	if (pipeline == s.pipeline) {
+		stats.elided++;
+		return;
+	}
+
+	const PipelineDesc& next = pipeline->desc;
+	const PipelineDesc& last = s.applied;
+	bool all = !s.appliedKnown;
+	unsigned int calls = 0;
+
+	if (all || next.depthTest != last.depthTest) { setCapability(GL_DEPTH_TEST, next.depthTest); calls++; }
+	if (all || next.depthWrite != last.depthWrite) { glDepthMask(next.depthWrite ? GL_TRUE : GL_FALSE); calls++; }
+	if (all || next.depthFunc != last.depthFunc) { glDepthFunc(next.depthFunc); calls++; }
+	if (all || next.blend != last.blend) { setCapability(GL_BLEND, next.blend); calls++; }
+	if (all || next.blendSrc != last.blendSrc || next.blendDst != last.blendDst) { glBlendFunc(next.blendSrc, next.blendDst); calls++; }
+	if (all || next.cullFace != last.cullFace) { setCapability(GL_CULL_FACE, next.cullFace); calls++; }
+	if (all || next.cullMode != last.cullMode) { glCullFace(next.cullMode); calls++; }
+	if (all || next.frontFace != last.frontFace) { glFrontFace(next.frontFace); calls++; }
+	if (all || next.colorWrite != last.colorWrite) {
+		GLboolean write = next.colorWrite ? GL_TRUE : GL_FALSE;
+		glColorMask(write, write, write, write);
+		calls++;
+	}
+
+	stats.issued += calls;
+	s.pipeline = pipeline;
+	s.applied = next;
+	s.appliedKnown = true;
+}
+
+void GLState::forgetProgram(GLuint program) {
+	if (state().program == program) shadow.program = UNKNOWN;
+}
+
+void GLState::forgetBuffer(GLuint buffer) {
+	Shadow& s = state();
+	for (GLuint& bound : s.buffers)
+		if (bound == buffer) bound = UNKNOWN;
+	for (IndexedBinding& binding : s.uniformBindings)
+		if (binding.buffer == buffer) binding.buffer = UNKNOWN;
+}
+
+void GLState::forgetTexture(GLuint texture) {
+	for (GLuint& bound : state().textures)
+		if (bound == texture) bound = UNKNOWN;
+}
+
+void GLState::forgetVertexArray(GLuint vao) {
+	if (state().vao == vao) {
+		shadow.vao = UNKNOWN;
+		shadow.buffers[ELEMENT_SLOT] = UNKNOWN;
+	}
+}
+
+void GLState::countDraw() {
+	stats.draws++;
+}
+
+GLState::Stats GLState::frameStats() {
+	Stats frame = stats;
+	stats = Stats();
+	return frame;
+}
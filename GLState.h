@@ -0,0 +1,79 @@
+#ifndef GLSTATE_H
+#define GLSTATE_H
+
+#include <glad/glad.h>
+
+#include <cstddef>
+
+// Fixed-function state that is set as a whole. Pipeline states are interned: get() returns the same
+// object for equal descriptions, so comparing two states is a pointer compare and switching between
+// them only touches the fields that differ.
+struct PipelineDesc {
+	bool depthTest = true;
+	bool depthWrite = true;
+	GLenum depthFunc = GL_LESS;
+	bool blend = false;
+	GLenum blendSrc = GL_SRC_ALPHA;
+	GLenum blendDst = GL_ONE_MINUS_SRC_ALPHA;
+	bool cullFace = true;
+	GLenum cullMode = GL_BACK;
+	GLenum frontFace = GL_CCW;
+	bool colorWrite = true;
+
+	bool operator==(const PipelineDesc& other) const;
+	size_t hash() const;
+};
+
+class PipelineState {
+public:
+	const PipelineDesc desc;
+	const size_t hash;
+
+	static const PipelineState* get(const PipelineDesc& desc);
+
+private:
+	explicit PipelineState(const PipelineDesc& desc) : desc(desc), hash(desc.hash()) {}
+};
+
+// Shadow copy of the context's bindings. Every bind goes through here and is dropped when the
+// value is already current, code that talks to GL directly has to call invalidate() afterwards.
+// Single context, context thread only.
+namespace GLState {
+
+	static const unsigned int MAX_TEXTURE_UNITS = 16;
+	static const unsigned int MAX_BUFFER_BINDINGS = 16;
+
+	struct Stats {
+		unsigned int issued = 0; // state calls that reached the driver
+		unsigned int elided = 0; // redundant ones that were dropped
+		unsigned int draws = 0;
+	};
+
+	void useProgram(GLuint program);
+	void bindVertexArray(GLuint vao);
+	void bindBuffer(GLenum target, GLuint buffer);
+	void bindBufferBase(GLenum target, GLuint index, GLuint buffer);
+	void bindBufferRange(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size);
+	// GL_TEXTURE_2D on a unit, switches the active unit only when needed
+	void bindTexture(unsigned int unit, GLuint texture);
+	void setPipeline(const PipelineState* state);
+
+	// the program bound through useProgram, 0 when unknown
+	GLuint program();
+
+	// deleted names may come back from glGen*, forget every binding that refers to them
+	void forgetProgram(GLuint program);
+	void forgetBuffer(GLuint buffer);
+	void forgetTexture(GLuint texture);
+	void forgetVertexArray(GLuint vao);
+
+	// assume nothing about the context, the next bind of every kind is issued
+	void invalidate();
+
+	void countDraw();
+	// counters since the last call, call once per frame
+	Stats frameStats();
+
+}
+
+#endif
@@ -0,0 +1,481 @@
+#include "GeometryArena.h"
+#include "Mesh.h"
+#include "GLExtensions.h"
+#include "GLState.h"
+
+#include <algorithm>
+#include <iostream>
+
+namespace {
+
+	// initial capacities in elements, buffers double when a range does not fit
+	const size_t INITIAL_VERTICES = 1 << 16;
+	const size_t INITIAL_INDICES = 1 << 18;
+	const size_t INITIAL_INSTANCES = 1 << 12;
+	const size_t INITIAL_POSITIONS = 1 << 16;
+	const size_t INITIAL_POSITION_INDICES = 1 << 18;
+
+	GLuint createBuffer(size_t bytes) {
+		GLuint buffer;
+		glGenBuffers(1, &buffer);
+		GLState::bindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+		glBufferData(GL_COPY_WRITE_BUFFER, bytes, NULL, GL_STATIC_DRAW);
+		return buffer;
+	}
+
+	void deleteBuffer(GLuint buffer) {
+		GLState::forgetBuffer(buffer);
+		glDeleteBuffers(1, &buffer);
+	}
+
+}
+
+bool RangeAllocator::allocate(size_t size, size_t& offset) {
+
+	std::map<size_t, size_t>::iterator best = freeBlocks.end();
+	for (std::map<size_t, size_t>::iterator it = freeBlocks.begin(); it != freeBlocks.end(); ++it)
+		if (it->second >= size && (best == freeBlocks.end() || it->second < best->second))
+			best = it;
+	if (best == freeBlocks.end()) return false;
+
+	offset = best->first;
+	size_t remaining = best->second - size;
+	freeBlocks.erase(best);
+	if (remaining > 0)
+		freeBlocks[offset + size] = remaining;
+	used += size;
+	return true;
+}
+
+void RangeAllocator::free(size_t offset, size_t size) {
+
+	if (size == 0) return;
+	used -= size;
+
+	std::map<size_t, size_t>::iterator it = freeBlocks.insert(std::make_pair(offset, size)).first;
+
+	std::map<size_t, size_t>::iterator next = std::next(it);
+	if (next != freeBlocks.end() && it->first + it->second == next->first) {
+		it->second += next->second;
+		freeBlocks.erase(next);
+	}
+	if (it != freeBlocks.begin()) {
+		std::map<size_t, size_t>::iterator prev = std::prev(it);
+		if (prev->first + prev->second == it->first) {
+			prev->second += it->second;
+			freeBlocks.erase(it);
+		}
+	}
+}
+
+void RangeAllocator::grow(size_t newCapacity) {
+
+	if (newCapacity <= capacity) return;
+	if (!freeBlocks.empty()) {
+		std::map<size_t, size_t>::iterator last = std::prev(freeBlocks.end());
+		if (last->first + last->second == capacity) {
+			last->second += newCapacity - capacity;
+			capacity = newCapacity;
+			return;
+		}
+	}
+	freeBlocks[capacity] = newCapacity - capacity;
+	capacity = newCapacity;
+}
+
+void RangeAllocator::reset(size_t capacity, size_t used) {
+	this->capacity = capacity;
+	this->used = used;
+	freeBlocks.clear();
+	if (used < capacity)
+		freeBlocks[used] = capacity - used;
+}
+
+bool RangeAllocator::packed() const {
+	return freeBlocks.empty() || (freeBlocks.size() == 1 && freeBlocks.begin()->first == used);
+}
+
+size_t RangeAllocator::largestFreeBlock() const {
+	size_t largest = 0;
+	for (const std::pair<const size_t, size_t>& block : freeBlocks)
+		largest = std::max(largest, block.second);
+	return largest;
+}
+
+GeometryArena& GeometryArena::shared() {
+	// the buffers belong to the context, deleting them at static destruction time would be too late
+	static GeometryArena* arena = new GeometryArena();
+	return *arena;
+}
+
+GeometryArena::GeometryArena()
+	: indirectVAO(0), positionVAO(0), positionBuffer(0), positionIndexBuffer(0), drawIndexBuffer(0), drawIndexCount(0),
+	attributeInstanceOffset(0), positionInstanceOffset(0)
+{
+
+	vertexBuffer = createBuffer(INITIAL_VERTICES * sizeof(Vertex));
+	indexBuffer = createBuffer(INITIAL_INDICES * sizeof(unsigned int));
+	instanceBuffer = createBuffer(INITIAL_INSTANCES * sizeof(glm::mat4));
+	vertexAllocator.reset(INITIAL_VERTICES, 0);
+	indexAllocator.reset(INITIAL_INDICES, 0);
+	instanceAllocator.reset(INITIAL_INSTANCES, 0);
+
+	glGenVertexArrays(1, &vao);
+	glGenVertexArrays(1, &streamVAO);
+
+	bindGeometry(vao);
+	for (unsigned int i = 0; i < 4; i++) {
+		glEnableVertexAttribArray(3 + i);
+		glVertexAttribDivisor(3 + i, 1);
+	}
+	pointInstanceAttributes(0, attributeInstanceOffset);
+	// instance color and id are only streamed by drawStream, everything else reads these constants
+	glVertexAttrib4f(7, 1.0f, 1.0f, 1.0f, 1.0f);
+	glVertexAttribI4ui(8, 0, 0, 0, 0);
+
+	bindGeometry(streamVAO);
+	for (unsigned int location = 3; location <= 8; location++) {
+		glEnableVertexAttribArray(location);
+		glVertexAttribDivisor(location, 1);
+	}
+
+	// unbind so a later element buffer bind cannot land in the arena's VAOs
+	GLState::bindVertexArray(0);
+}
+
+void GeometryArena::bindGeometry(GLuint vertexArray) {
+
+	GLState::bindVertexArray(vertexArray);
+	GLState::bindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+	GLState::bindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+
+	// offsets stay 0, every draw passes its own base vertex and first index
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
+	glEnableVertexAttribArray(1);
+	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Normal));
+	glEnableVertexAttribArray(2);
+	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
+}
+
+void GeometryArena::pointInstanceAttributes(size_t offset, size_t& pointedAt) {
+
+	GLState::bindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+	for (unsigned int i = 0; i < 4; i++)
+		glVertexAttribPointer(3 + i, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(offset * sizeof(glm::mat4) + i * sizeof(glm::vec4)));
+	pointedAt = offset;
+}
+
+void GeometryArena::bindPositions() {
+
+	GLState::bindVertexArray(positionVAO);
+	GLState::bindBuffer(GL_ELEMENT_ARRAY_BUFFER, positionIndexBuffer);
+	GLState::bindBuffer(GL_ARRAY_BUFFER, positionBuffer);
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*)0);
+	pointInstanceAttributes(positionInstanceOffset, positionInstanceOffset);
+}
+
+void GeometryArena::buffersChanged() {
+
+	bindGeometry(vao);
+	pointInstanceAttributes(attributeInstanceOffset, attributeInstanceOffset);
+	bindGeometry(streamVAO);
+	if (indirectVAO)
+		bindGeometry(indirectVAO);
+	if (positionVAO)
+		bindPositions();
+	GLState::bindVertexArray(0);
+}
+
+void GeometryArena::upload(GLuint buffer, size_t byteOffset, size_t bytes, const void* data) {
+	// through the copy target, binding GL_ELEMENT_ARRAY_BUFFER would change whatever VAO is bound
+	GLState::bindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+	glBufferSubData(GL_COPY_WRITE_BUFFER, byteOffset, bytes, data);
+}
+
+size_t GeometryArena::allocate(RangeAllocator& allocator, GLuint& buffer, size_t elementSize, size_t count) {
+
+	size_t offset = 0;
+	if (count == 0 || allocator.allocate(count, offset))
+		return offset;
+
+	// grow on the GPU: copy everything into a buffer at least twice the size, offsets stay valid
+	size_t newCapacity = std::max(allocator.capacity * 2, allocator.capacity + count);
+	GLuint grown = createBuffer(newCapacity * elementSize);
+	GLState::bindBuffer(GL_COPY_READ_BUFFER, buffer);
+	glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, allocator.capacity * elementSize);
+	deleteBuffer(buffer);
+	buffer = grown;
+
+	allocator.grow(newCapacity);
+	allocator.allocate(count, offset);
+	buffersChanged();
+	return offset;
+}
+
+GeometryArena::Handle GeometryArena::add(const Vertex* vertices, size_t vertexCount, const unsigned int* indices, size_t indexCount) {
+
+	Handle handle;
+	if (!freeHandles.empty()) {
+		handle = freeHandles.back();
+		freeHandles.pop_back();
+	}
+	else {
+		handle = static_cast<Handle>(entries.size());
+		entries.push_back(Entry());
+	}
+
+	Entry entry;
+	entry.vertexOffset = allocate(vertexAllocator, vertexBuffer, sizeof(Vertex), vertexCount);
+	entry.vertexCount = vertexCount;
+	entry.indexOffset = allocate(indexAllocator, indexBuffer, sizeof(unsigned int), indexCount);
+	entry.indexCount = indexCount;
+	entry.live = true;
+	entries[handle] = entry;
+
+	upload(vertexBuffer, entry.vertexOffset * sizeof(Vertex), vertexCount * sizeof(Vertex), vertices);
+	upload(indexBuffer, entry.indexOffset * sizeof(unsigned int), indexCount * sizeof(unsigned int), indices);
+	return handle;
+}
+
+void GeometryArena::read(Handle handle, std::vector<Vertex>& vertices, std::vector<unsigned int>& indices) const {
+
+	const Entry& entry = entries[handle];
+	vertices.resize(entry.vertexCount);
+	indices.resize(entry.indexCount);
+	if (entry.vertexCount > 0) {
+		GLState::bindBuffer(GL_COPY_READ_BUFFER, vertexBuffer);
+		glGetBufferSubData(GL_COPY_READ_BUFFER, entry.vertexOffset * sizeof(Vertex), entry.vertexCount * sizeof(Vertex), vertices.data());
+	}
+	if (entry.indexCount > 0) {
+		GLState::bindBuffer(GL_COPY_READ_BUFFER, indexBuffer);
+		glGetBufferSubData(GL_COPY_READ_BUFFER, entry.indexOffset * sizeof(unsigned int), entry.indexCount * sizeof(unsigned int), indices.data());
+	}
+}
+
+void GeometryArena::setInstances(Handle handle, const glm::mat4* transforms, size_t count) {
+
+	if (entries[handle].instanceCount != count) {
+		instanceAllocator.free(entries[handle].instanceOffset, entries[handle].instanceCount);
+		size_t offset = allocate(instanceAllocator, instanceBuffer, sizeof(glm::mat4), count);
+		entries[handle].instanceOffset = offset;
+		entries[handle].instanceCount = count;
+	}
+	const Entry& entry = entries[handle];
+	upload(instanceBuffer, entry.instanceOffset * sizeof(glm::mat4), count * sizeof(glm::mat4), transforms);
+}
+
+void GeometryArena::setPositions(Handle handle, const glm::vec3* positions, size_t count, const unsigned int* indices, size_t indexCount) {
+
+	if (positionVAO == 0) {
+		positionBuffer = createBuffer(INITIAL_POSITIONS * sizeof(glm::vec3));
+		positionIndexBuffer = createBuffer(INITIAL_POSITION_INDICES * sizeof(unsigned int));
+		positionAllocator.reset(INITIAL_POSITIONS, 0);
+		positionIndexAllocator.reset(INITIAL_POSITION_INDICES, 0);
+		glGenVertexArrays(1, &positionVAO);
+		bindPositions();
+		for (unsigned int i = 0; i < 4; i++) {
+			glEnableVertexAttribArray(3 + i);
+			glVertexAttribDivisor(3 + i, 1);
+		}
+		GLState::bindVertexArray(0);
+	}
+
+	Entry& entry = entries[handle];
+	positionAllocator.free(entry.positionOffset, entry.positionCount);
+	positionIndexAllocator.free(entry.positionIndexOffset, entry.positionIndexCount);
+	size_t positionOffset = allocate(positionAllocator, positionBuffer, sizeof(glm::vec3), count);
+	size_t positionIndexOffset = allocate(positionIndexAllocator, positionIndexBuffer, sizeof(unsigned int), indexCount);
+
+	// allocate only grows buffers, entries is untouched and the reference still good
+	entry.positionOffset = positionOffset;
+	entry.positionCount = count;
+	entry.positionIndexOffset = positionIndexOffset;
+	entry.positionIndexCount = indexCount;
+	upload(positionBuffer, positionOffset * sizeof(glm::vec3), count * sizeof(glm::vec3), positions);
+	upload(positionIndexBuffer, positionIndexOffset * sizeof(unsigned int), indexCount * sizeof(unsigned int), indices);
+}
+
+void GeometryArena::remove(Handle handle) {
+
+	Entry& entry = entries[handle];
+	if (!entry.live) return;
+
+	vertexAllocator.free(entry.vertexOffset, entry.vertexCount);
+	indexAllocator.free(entry.indexOffset, entry.indexCount);
+	instanceAllocator.free(entry.instanceOffset, entry.instanceCount);
+	positionAllocator.free(entry.positionOffset, entry.positionCount);
+	positionIndexAllocator.free(entry.positionIndexOffset, entry.positionIndexCount);
+	entry = Entry();
+	freeHandles.push_back(handle);
+}
+
+void GeometryArena::draw(Handle handle) {
+
+	const Entry& entry = entries[handle];
+	if (entry.indexCount == 0 || entry.instanceCount == 0) return;
+
+	GLState::bindVertexArray(vao);
+	const void* firstIndex = (void*)(entry.indexOffset * sizeof(unsigned int));
+	if (GLExt::baseInstance) {
+		GLExt::DrawElementsInstancedBaseVertexBaseInstance(GL_TRIANGLES, static_cast<GLsizei>(entry.indexCount), GL_UNSIGNED_INT,
+			firstIndex, static_cast<GLsizei>(entry.instanceCount), static_cast<GLint>(entry.vertexOffset), static_cast<GLuint>(entry.instanceOffset));
+	}
+	else {
+		// without base instance the matrices are found by moving the attribute offsets
+		if (attributeInstanceOffset != entry.instanceOffset)
+			pointInstanceAttributes(entry.instanceOffset, attributeInstanceOffset);
+		glDrawElementsInstancedBaseVertex(GL_TRIANGLES, static_cast<GLsizei>(entry.indexCount), GL_UNSIGNED_INT,
+			firstIndex, static_cast<GLsizei>(entry.instanceCount), static_cast<GLint>(entry.vertexOffset));
+	}
+	GLState::countDraw();
+}
+
+void GeometryArena::drawPositions(Handle handle) {
+
+	const Entry& entry = entries[handle];
+	if (entry.positionIndexCount == 0) {
+		draw(handle);
+		return;
+	}
+	if (entry.instanceCount == 0) return;
+
+	GLState::bindVertexArray(positionVAO);
+	const void* firstIndex = (void*)(entry.positionIndexOffset * sizeof(unsigned int));
+	if (GLExt::baseInstance) {
+		GLExt::DrawElementsInstancedBaseVertexBaseInstance(GL_TRIANGLES, static_cast<GLsizei>(entry.positionIndexCount), GL_UNSIGNED_INT,
+			firstIndex, static_cast<GLsizei>(entry.instanceCount), static_cast<GLint>(entry.positionOffset), static_cast<GLuint>(entry.instanceOffset));
+	}
+	else {
+		if (positionInstanceOffset != entry.instanceOffset)
+			pointInstanceAttributes(entry.instanceOffset, positionInstanceOffset);
+		glDrawElementsInstancedBaseVertex(GL_TRIANGLES, static_cast<GLsizei>(entry.positionIndexCount), GL_UNSIGNED_INT,
+			firstIndex, static_cast<GLsizei>(entry.instanceCount), static_cast<GLint>(entry.positionOffset));
+	}
+	GLState::countDraw();
+}
+
+void GeometryArena::drawStream(Handle handle, const InstanceStream& stream, size_t first, size_t count) {
+
+	const Entry& entry = entries[handle];
+	if (entry.indexCount == 0 || count == 0) return;
+
+	GLState::bindVertexArray(streamVAO);
+
+	// the stream is rewritten every call, so the attribute offsets are set per draw
+	GLState::bindBuffer(GL_ARRAY_BUFFER, stream.transformBuffer);
+	for (unsigned int i = 0; i < 4; i++)
+		glVertexAttribPointer(3 + i, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4),
+			(void*)(stream.transformOffset + first * sizeof(glm::mat4) + i * sizeof(glm::vec4)));
+	GLState::bindBuffer(GL_ARRAY_BUFFER, stream.colorBuffer);
+	glVertexAttribPointer(7, 4, GL_FLOAT, GL_FALSE, sizeof(glm::vec4), (void*)(stream.colorOffset + first * sizeof(glm::vec4)));
+	GLState::bindBuffer(GL_ARRAY_BUFFER, stream.idBuffer);
+	glVertexAttribIPointer(8, 1, GL_UNSIGNED_INT, sizeof(unsigned int), (void*)(stream.idOffset + first * sizeof(unsigned int)));
+
+	glDrawElementsInstancedBaseVertex(GL_TRIANGLES, static_cast<GLsizei>(entry.indexCount), GL_UNSIGNED_INT,
+		(void*)(entry.indexOffset * sizeof(unsigned int)), static_cast<GLsizei>(count), static_cast<GLint>(entry.vertexOffset));
+	GLState::countDraw();
+}
+
+void GeometryArena::bindIndirect(size_t instanceCount) {
+
+	if (indirectVAO == 0) {
+		glGenVertexArrays(1, &indirectVAO);
+		glGenBuffers(1, &drawIndexBuffer);
+		bindGeometry(indirectVAO);
+		glEnableVertexAttribArray(8);
+		glVertexAttribDivisor(8, 1);
+	}
+	GLState::bindVertexArray(indirectVAO);
+
+	if (instanceCount > drawIndexCount) {
+		drawIndexCount = std::max(instanceCount, drawIndexCount * 2);
+		std::vector<unsigned int> sequence(drawIndexCount);
+		for (size_t i = 0; i < sequence.size(); i++)
+			sequence[i] = static_cast<unsigned int>(i);
+		GLState::bindBuffer(GL_ARRAY_BUFFER, drawIndexBuffer);
+		glBufferData(GL_ARRAY_BUFFER, sequence.size() * sizeof(unsigned int), sequence.data(), GL_STATIC_DRAW);
+		glVertexAttribIPointer(8, 1, GL_UNSIGNED_INT, sizeof(unsigned int), (void*)0);
+	}
+}
+
+void GeometryArena::compactBuffer(RangeAllocator& allocator, GLuint& buffer, size_t elementSize,
+	size_t Entry::* offset, size_t Entry::* count) {
+
+	if (allocator.packed()) return;
+
+	// live ranges in buffer order, so packing never moves a range past its neighbour
+	std::vector<Entry*> live;
+	for (Entry& entry : entries)
+		if (entry.live && entry.*count > 0)
+			live.push_back(&entry);
+	std::sort(live.begin(), live.end(), [offset](const Entry* a, const Entry* b) { return a->*offset < b->*offset; });
+
+	GLuint packed = createBuffer(allocator.capacity * elementSize);
+	GLState::bindBuffer(GL_COPY_READ_BUFFER, buffer);
+	size_t cursor = 0;
+	for (Entry* entry : live) {
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+			entry->*offset * elementSize, cursor * elementSize, entry->*count * elementSize);
+		entry->*offset = cursor;
+		cursor += entry->*count;
+	}
+	deleteBuffer(buffer);
+	buffer = packed;
+	allocator.reset(allocator.capacity, cursor);
+}
+
+void GeometryArena::compact() {
+
+	compactBuffer(vertexAllocator, vertexBuffer, sizeof(Vertex), &Entry::vertexOffset, &Entry::vertexCount);
+	compactBuffer(indexAllocator, indexBuffer, sizeof(unsigned int), &Entry::indexOffset, &Entry::indexCount);
+	compactBuffer(instanceAllocator, instanceBuffer, sizeof(glm::mat4), &Entry::instanceOffset, &Entry::instanceCount);
+	if (positionVAO) {
+		compactBuffer(positionAllocator, positionBuffer, sizeof(glm::vec3), &Entry::positionOffset, &Entry::positionCount);
+		compactBuffer(positionIndexAllocator, positionIndexBuffer, sizeof(unsigned int), &Entry::positionIndexOffset, &Entry::positionIndexCount);
+	}
+	attributeInstanceOffset = 0;
+	positionInstanceOffset = 0;
+	buffersChanged();
+}
+
+GeometryArena::BufferStats GeometryArena::stats(const RangeAllocator& allocator, size_t elementSize) {
+
+	BufferStats stats;
+	stats.capacityBytes = allocator.capacity * elementSize;
+	stats.usedBytes = allocator.used * elementSize;
+	stats.freeBlocks = allocator.freeBlockCount();
+	size_t freeElements = allocator.capacity - allocator.used;
+	stats.fragmentation = freeElements > 0 ? 1.0f - float(allocator.largestFreeBlock()) / float(freeElements) : 0.0f;
+	return stats;
+}
+
+GeometryArena::BufferStats GeometryArena::vertexStats() const {
+	return stats(vertexAllocator, sizeof(Vertex));
+}
+
+GeometryArena::BufferStats GeometryArena::indexStats() const {
+	return stats(indexAllocator, sizeof(unsigned int));
+}
+
+GeometryArena::BufferStats GeometryArena::instanceStats() const {
+	return stats(instanceAllocator, sizeof(glm::mat4));
+}
+
+GeometryArena::BufferStats GeometryArena::positionStats() const {
+	return stats(positionAllocator, sizeof(glm::vec3));
+}
+
+void GeometryArena::printReport() const {
+
+	const char* names[4] = { "vertices", "indices", "instances", "positions" };
+	BufferStats all[4] = { vertexStats(), indexStats(), instanceStats(), positionStats() };
+
+	std::cout << "Geometry arena:";
+	for (int i = 0; i < (positionVAO ? 4 : 3); i++) {
+		std::cout << (i ? "," : "") << " " << names[i] << " " << all[i].usedBytes / 1024 << " / " << all[i].capacityBytes / 1024
+			<< " KB (" << all[i].freeBlocks << " free blocks, " << int(all[i].fragmentation * 100.0f + 0.5f) << "% fragmented)";
+	}
+	std::cout << std::endl;
+}
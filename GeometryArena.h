@@ -0,0 +1,134 @@
+#ifndef GEOMETRYARENA_H
+#define GEOMETRYARENA_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <map>
+#include <vector>
+
+struct Vertex;
+struct InstanceStream;
+
+// Ranges of a linear buffer, free blocks kept by offset so a freed block merges with free neighbours.
+class RangeAllocator {
+
+public:
+	RangeAllocator() : capacity(0), used(0) {}
+
+	// best fit, false when no free block is large enough
+	bool allocate(size_t size, size_t& offset);
+	void free(size_t offset, size_t size);
+	// the new space is one free block at the end (merged with a free tail)
+	void grow(size_t newCapacity);
+	// everything below used is taken, the rest is one block (after compaction)
+	void reset(size_t capacity, size_t used);
+
+	size_t capacity;
+	size_t used;
+	size_t freeBlockCount() const { return freeBlocks.size(); }
+	size_t largestFreeBlock() const;
+	// every used element is below every free one
+	bool packed() const;
+
+private:
+	std::map<size_t, size_t> freeBlocks; // offset -> size
+};
+
+// All mesh geometry of the Vertex format lives in one vertex, one index and one instance buffer.
+// Meshes keep a handle and draw with glDrawElementsInstancedBaseVertex from the arena's single VAO,
+// so consecutive meshes switch nothing but offsets. Buffers grow by copying on the GPU, and
+// compact() packs live ranges to the front; both move data, never handles.
+class GeometryArena {
+
+public:
+	typedef unsigned int Handle;
+	static const Handle INVALID = ~0u;
+
+	// offsets and counts in elements (vertices, indices, matrices)
+	struct Entry {
+		size_t vertexOffset = 0, vertexCount = 0;
+		size_t indexOffset = 0, indexCount = 0;
+		size_t instanceOffset = 0, instanceCount = 0;
+		// optional position-only copy with its own (welded) indices, 0 counts when there is none
+		size_t positionOffset = 0, positionCount = 0;
+		size_t positionIndexOffset = 0, positionIndexCount = 0;
+		bool live = false;
+	};
+
+	struct BufferStats {
+		size_t capacityBytes;
+		size_t usedBytes;
+		size_t freeBlocks;
+		float fragmentation; // 1 - largest free block / all free space
+	};
+
+	// lives as long as the GL context, never destroyed
+	static GeometryArena& shared();
+
+	Handle add(const Vertex* vertices, size_t vertexCount, const unsigned int* indices, size_t indexCount);
+	void setInstances(Handle handle, const glm::mat4* transforms, size_t count);
+	// tightly packed positions for passes that need nothing else (depth, shadows, picking)
+	void setPositions(Handle handle, const glm::vec3* positions, size_t count, const unsigned int* indices, size_t indexCount);
+	bool hasPositions(Handle handle) const { return entries[handle].positionIndexCount > 0; }
+	void remove(Handle handle);
+
+	const Entry& entry(Handle handle) const { return entries[handle]; }
+	// copy an entry's geometry back from the GPU, for meshes that kept no CPU copy (GeometryResidency)
+	void read(Handle handle, std::vector<Vertex>& vertices, std::vector<unsigned int>& indices) const;
+
+	// every instance of the entry in one draw
+	void draw(Handle handle);
+	// every instance from the position stream (attributes 0 and 3-6 only), the full vertices without one
+	void drawPositions(Handle handle);
+	// instances [first, first + count) of a stream instead of the entry's own transforms
+	void drawStream(Handle handle, const InstanceStream& stream, size_t first, size_t count);
+
+	// bind the VAO for glMultiDrawElementsIndirect: geometry plus attribute 8 reading 0, 1, 2, ...
+	// per instance, so it carries baseInstance + gl_InstanceID (GLSL 430 has no gl_BaseInstance)
+	void bindIndirect(size_t instanceCount);
+
+	// pack live ranges to the front of each buffer
+	void compact();
+
+	BufferStats vertexStats() const;
+	BufferStats indexStats() const;
+	BufferStats instanceStats() const;
+	BufferStats positionStats() const;
+	void printReport() const;
+
+private:
+	GeometryArena();
+
+	GLuint vao;       // attributes 0-6, instance matrices at instanceOffset 0 (or attributeInstanceOffset)
+	GLuint streamVAO; // attributes 0-2 shared, 3-8 pointed at an InstanceStream per draw
+	GLuint indirectVAO; // attributes 0-2 shared, 8 from drawIndexBuffer, created on first use
+	GLuint positionVAO; // attribute 0 from positionBuffer, 3-6 like vao, created with the first position stream
+	GLuint vertexBuffer, indexBuffer, instanceBuffer;
+	GLuint positionBuffer, positionIndexBuffer;
+	GLuint drawIndexBuffer;
+	size_t drawIndexCount;
+	RangeAllocator vertexAllocator, indexAllocator, instanceAllocator;
+	RangeAllocator positionAllocator, positionIndexAllocator;
+	// where attributes 3-6 of vao and positionVAO currently start, without base instance
+	size_t attributeInstanceOffset, positionInstanceOffset;
+
+	std::vector<Entry> entries;
+	std::vector<Handle> freeHandles;
+
+	// element buffer and attributes 0-2 of a VAO, which is left bound
+	void bindGeometry(GLuint vertexArray);
+	// the VAO has to be bound, pointedAt remembers the offset for it
+	void pointInstanceAttributes(size_t offset, size_t& pointedAt);
+	void bindPositions();
+	size_t allocate(RangeAllocator& allocator, GLuint& buffer, size_t elementSize, size_t count);
+	void compactBuffer(RangeAllocator& allocator, GLuint& buffer, size_t elementSize,
+		size_t Entry::* offset, size_t Entry::* count);
+	// every buffer name may have changed, re-point both VAOs
+	void buffersChanged();
+	static void upload(GLuint buffer, size_t byteOffset, size_t bytes, const void* data);
+	static BufferStats stats(const RangeAllocator& allocator, size_t elementSize);
+};
+
+#endif
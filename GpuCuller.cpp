@@ -0,0 +1,263 @@
+#include "GpuCuller.h"
+#include "GLExtensions.h"
+#include "GLState.h"
+#include "Material.h"
+#include "Frustum.h"
+
+#include <algorithm>
+#include <cstring>
+
+#ifndef GL_TEXTURE_FETCH_BARRIER_BIT
+#define GL_TEXTURE_FETCH_BARRIER_BIT 0x00000008
+#endif
+
+namespace {
+
+	// first texture unit after the material maps
+	const unsigned int PYRAMID_UNIT = MATERIAL_UNIT_COUNT;
+
+	const GLuint CULL_GROUP_SIZE = 64;  // local_size_x of cull.comp
+	const GLuint PYRAMID_GROUP_SIZE = 8; // local_size_x/y of hiz.comp
+
+	// counters: frustum culled, occlusion culled, then one draw count per run
+	const size_t STAT_COUNTERS = 2;
+
+	GLuint groups(GLuint count, GLuint size) {
+		return (count + size - 1) / size;
+	}
+
+	// grow a buffer to hold at least bytes, contents are not kept
+	void reserve(GLenum target, GLuint buffer, size_t& capacity, size_t bytes, GLenum usage) {
+		if (bytes <= capacity) return;
+		capacity = std::max(bytes, capacity * 2);
+		GLState::bindBuffer(target, buffer);
+		glBufferData(target, capacity, NULL, usage);
+	}
+
+}
+
+bool GpuCuller::supported() {
+	return GLExt::computeShader && GLExt::multiDrawIndirect;
+}
+
+GpuCuller::GpuCuller()
+	: occlusion(true), commandCapacity(0), counterCapacity(0), depthTexture(0), depthFramebuffer(0), pyramid(0),
+	depthWidth(0), depthHeight(0), pyramidLevels(0), pyramidValid(false), pyramidViewProjection(1.0f),
+	currentViewProjection(1.0f), frame(0)
+{
+	cullProgram = Shader::compute("cull.comp");
+	depthProgram = Shader::compute("hiz.comp", "#define FROM_DEPTH\n");
+	reduceProgram = Shader::compute("hiz.comp");
+
+	GLuint buffers[3];
+	glGenBuffers(3, buffers);
+	instanceBuffer = buffers[0];
+	commandBuffer = buffers[1];
+	counterBuffer = buffers[2];
+
+	for (Readback& readback : readbacks) {
+		glGenBuffers(1, &readback.buffer);
+		GLState::bindBuffer(GL_COPY_WRITE_BUFFER, readback.buffer);
+		glBufferData(GL_COPY_WRITE_BUFFER, STAT_COUNTERS * sizeof(GLuint), NULL, GL_STREAM_READ);
+	}
+}
+
+GpuCuller::~GpuCuller() {
+	GLuint buffers[3] = { instanceBuffer, commandBuffer, counterBuffer };
+	for (GLuint buffer : buffers)
+		GLState::forgetBuffer(buffer);
+	glDeleteBuffers(3, buffers);
+
+	for (Readback& readback : readbacks) {
+		if (readback.fence)
+			glDeleteSync(readback.fence);
+		GLState::forgetBuffer(readback.buffer);
+		glDeleteBuffers(1, &readback.buffer);
+	}
+
+	GLState::forgetTexture(depthTexture);
+	GLState::forgetTexture(pyramid);
+	glDeleteTextures(1, &depthTexture);
+	glDeleteTextures(1, &pyramid);
+	glDeleteFramebuffers(1, &depthFramebuffer);
+}
+
+void GpuCuller::cull(const std::vector<CullInstance>& instances, size_t runCount) {
+
+	collectReadbacks();
+	if (!cullProgram->isValid()) return;
+
+	size_t counters = STAT_COUNTERS + runCount;
+	GLState::bindBuffer(GL_SHADER_STORAGE_BUFFER, instanceBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, instances.size() * sizeof(CullInstance), instances.data(), GL_STREAM_DRAW);
+	reserve(GL_DRAW_INDIRECT_BUFFER, commandBuffer, commandCapacity, std::max<size_t>(1, instances.size()) * 5 * sizeof(GLuint), GL_STREAM_DRAW);
+	reserve(GL_SHADER_STORAGE_BUFFER, counterBuffer, counterCapacity, counters * sizeof(GLuint), GL_STREAM_DRAW);
+
+	// counters start at 0, without a draw count every slot is drawn so unused ones need 0 instances
+	GLState::bindBuffer(GL_SHADER_STORAGE_BUFFER, counterBuffer);
+	GLExt::ClearBufferSubData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, 0, counters * sizeof(GLuint), GL_RED_INTEGER, GL_UNSIGNED_INT, NULL);
+	if (!GLExt::indirectCount) {
+		GLState::bindBuffer(GL_SHADER_STORAGE_BUFFER, commandBuffer);
+		GLExt::ClearBufferSubData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, 0, instances.size() * 5 * sizeof(GLuint),
+			GL_RED_INTEGER, GL_UNSIGNED_INT, NULL);
+	}
+	if (instances.empty()) return;
+
+	GLState::bindBufferBase(GL_SHADER_STORAGE_BUFFER, CULL_INSTANCE_BINDING, instanceBuffer);
+	GLState::bindBufferBase(GL_SHADER_STORAGE_BUFFER, CULL_COMMAND_BINDING, commandBuffer);
+	GLState::bindBufferBase(GL_SHADER_STORAGE_BUFFER, CULL_COUNTER_BINDING, counterBuffer);
+
+	Frustum frustum(currentViewProjection);
+	cullProgram->use();
+	cullProgram->setInt("instanceCount", static_cast<int>(instances.size()));
+	for (int i = 0; i < 6; i++)
+		cullProgram->setVec4("frustumPlanes[" + std::to_string(i) + "]", frustum.planes[i]);
+	bool testOcclusion = occlusion && pyramidValid;
+	cullProgram->setBool("occlusion", testOcclusion);
+	if (testOcclusion) {
+		cullProgram->setMat4("pyramidViewProjection", pyramidViewProjection);
+		cullProgram->setInt("pyramid", static_cast<int>(PYRAMID_UNIT));
+		GLState::bindTexture(PYRAMID_UNIT, pyramid);
+	}
+	GLExt::DispatchCompute(groups(static_cast<GLuint>(instances.size()), CULL_GROUP_SIZE), 1, 1);
+	GLExt::MemoryBarriers(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+
+	// the culled counts go to the oldest readback slot, it was collected above or is dropped now
+	Readback& readback = readbacks[frame % READBACK_FRAMES];
+	if (readback.fence)
+		glDeleteSync(readback.fence);
+	GLState::bindBuffer(GL_COPY_READ_BUFFER, counterBuffer);
+	GLState::bindBuffer(GL_COPY_WRITE_BUFFER, readback.buffer);
+	glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, STAT_COUNTERS * sizeof(GLuint));
+	readback.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	readback.tested = static_cast<unsigned int>(instances.size());
+	readback.frame = frame;
+	frame++;
+}
+
+void GpuCuller::drawRun(size_t run, GLuint slot, GLuint maxCount) {
+
+	const void* first = (void*)(slot * 5 * sizeof(GLuint));
+	GLState::bindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+	if (GLExt::indirectCount) {
+		GLState::bindBuffer(GL_PARAMETER_BUFFER, counterBuffer);
+		GLExt::MultiDrawElementsIndirectCount(GL_TRIANGLES, GL_UNSIGNED_INT, first,
+			static_cast<GLintptr>((STAT_COUNTERS + run) * sizeof(GLuint)), static_cast<GLsizei>(maxCount), 0);
+	}
+	else {
+		GLExt::MultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, first, static_cast<GLsizei>(maxCount), 0);
+	}
+	GLState::countDraw();
+}
+
+void GpuCuller::collectReadbacks() {
+
+	// oldest slot first so the newest finished readback wins, nothing here waits for the GPU
+	for (unsigned int i = 0; i < READBACK_FRAMES; i++) {
+		Readback& readback = readbacks[(frame + i) % READBACK_FRAMES];
+		if (!readback.fence) continue;
+		GLenum status = glClientWaitSync(readback.fence, 0, 0);
+		if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) continue;
+
+		GLuint counts[STAT_COUNTERS];
+		GLState::bindBuffer(GL_COPY_READ_BUFFER, readback.buffer);
+		glGetBufferSubData(GL_COPY_READ_BUFFER, 0, sizeof(counts), counts);
+		glDeleteSync(readback.fence);
+		readback.fence = 0;
+
+		lastStats.tested = readback.tested;
+		lastStats.frustumCulled = counts[0];
+		lastStats.occlusionCulled = counts[1];
+		lastStats.drawn = readback.tested - counts[0] - counts[1];
+		lastStats.latency = frame - readback.frame;
+	}
+}
+
+void GpuCuller::resizeDepth(int width, int height) {
+
+	if (width == depthWidth && height == depthHeight) return;
+	depthWidth = width;
+	depthHeight = height;
+
+	if (!depthTexture) {
+		glGenTextures(1, &depthTexture);
+		glGenTextures(1, &pyramid);
+		glGenFramebuffers(1, &depthFramebuffer);
+	}
+
+	GLState::bindTexture(PYRAMID_UNIT, depthTexture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH24_STENCIL8, width, height, 0, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8, NULL);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_NONE);
+
+	GLint drawFramebuffer = 0;
+	glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &drawFramebuffer);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, depthFramebuffer);
+	glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, depthTexture, 0);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, drawFramebuffer);
+
+	// level 0 is half the framebuffer, every level halves again down to 1x1
+	GLState::bindTexture(PYRAMID_UNIT, pyramid);
+	int levelWidth = std::max(1, width / 2), levelHeight = std::max(1, height / 2);
+	pyramidLevels = 0;
+	for (;;) {
+		glTexImage2D(GL_TEXTURE_2D, pyramidLevels, GL_R32F, levelWidth, levelHeight, 0, GL_RED, GL_FLOAT, NULL);
+		pyramidLevels++;
+		if (levelWidth == 1 && levelHeight == 1) break;
+		levelWidth = std::max(1, levelWidth / 2);
+		levelHeight = std::max(1, levelHeight / 2);
+	}
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, pyramidLevels - 1);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	pyramidValid = false;
+}
+
+void GpuCuller::captureDepth(GLuint framebuffer, int width, int height) {
+
+	if (width <= 0 || height <= 0 || !depthProgram->isValid() || !reduceProgram->isValid()) return;
+	resizeDepth(width, height);
+
+	GLint drawFramebuffer = 0, readFramebuffer = 0;
+	glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &drawFramebuffer);
+	glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &readFramebuffer);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, depthFramebuffer);
+	glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, readFramebuffer);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, drawFramebuffer);
+
+	buildPyramid();
+	pyramidViewProjection = currentViewProjection;
+	pyramidValid = true;
+}
+
+void GpuCuller::buildPyramid() {
+
+	int sourceWidth = depthWidth, sourceHeight = depthHeight;
+	int levelWidth = std::max(1, depthWidth / 2), levelHeight = std::max(1, depthHeight / 2);
+
+	for (int level = 0; level < pyramidLevels; level++) {
+		Shader& program = level == 0 ? *depthProgram : *reduceProgram;
+		program.use();
+		if (level == 0) {
+			program.setInt("depthTexture", static_cast<int>(PYRAMID_UNIT));
+			GLState::bindTexture(PYRAMID_UNIT, depthTexture);
+		}
+		else {
+			GLExt::BindImageTexture(0, pyramid, level - 1, GL_FALSE, 0, GL_READ_ONLY, GL_R32F);
+		}
+		GLExt::BindImageTexture(1, pyramid, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+		program.setInt("sourceWidth", sourceWidth);
+		program.setInt("sourceHeight", sourceHeight);
+
+		GLExt::DispatchCompute(groups(levelWidth, PYRAMID_GROUP_SIZE), groups(levelHeight, PYRAMID_GROUP_SIZE), 1);
+		GLExt::MemoryBarriers(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
+
+		sourceWidth = levelWidth;
+		sourceHeight = levelHeight;
+		levelWidth = std::max(1, levelWidth / 2);
+		levelHeight = std::max(1, levelHeight / 2);
+	}
+}
@@ -0,0 +1,114 @@
+#ifndef GPUCULLER_H
+#define GPUCULLER_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <memory>
+#include <vector>
+
+#include "Shader.h"
+
+// Shader storage binding points of cull.comp, after IndirectRenderer's
+enum CullBindingPoint : GLuint {
+	CULL_INSTANCE_BINDING = 2,
+	CULL_COMMAND_BINDING = 3,
+	CULL_COUNTER_BINDING = 4
+};
+
+// std430 element of CullInstances: one drawn instance and the command that draws it
+struct CullInstance {
+	glm::vec4 sphere;        // world space center, radius
+	GLuint count;            // indices
+	GLuint firstIndex;
+	GLint baseVertex;
+	GLuint record;           // DrawRecord index, becomes baseInstance
+	GLuint batch;            // counter of the run it is drawn in
+	GLuint slot;             // first command of that run
+	GLuint padding[2];
+};
+
+// Visibility on the GPU (GL 4.3): a compute pass tests each instance's bounding sphere against the
+// frustum and against a max-depth pyramid of the previous frame, and appends the survivors of every
+// run to its range of an indirect command buffer with an atomic counter. The counters are the draw
+// counts of glMultiDrawElementsIndirectCount; without GL_ARB_indirect_parameters the command buffer
+// is cleared first and every slot of a run is drawn, culled ones with zero instances.
+//
+// The occlusion test uses last frame's depth, so an object that comes out from behind an occluder
+// shows up one frame late. The culled/drawn numbers are copied to a small ring of buffers and read
+// a few frames later once their fence has passed, the CPU never waits for them.
+class GpuCuller {
+
+public:
+	struct Stats {
+		unsigned int tested = 0;
+		unsigned int frustumCulled = 0;
+		unsigned int occlusionCulled = 0;
+		unsigned int drawn = 0;
+		unsigned int latency = 0; // frames between the cull and this readback
+	};
+
+	// GLExt::computeShader and GLExt::multiDrawIndirect
+	static bool supported();
+
+	GpuCuller();
+	~GpuCuller();
+	GpuCuller(const GpuCuller&) = delete;
+	GpuCuller& operator=(const GpuCuller&) = delete;
+
+	// off: frustum test only
+	bool occlusion;
+
+	// camera of the frame being drawn, call before cull() and captureDepth()
+	void setCamera(const glm::mat4& viewProjection) { currentViewProjection = viewProjection; }
+
+	// false when cull.comp did not build, cull() then does nothing and drawRun() has no commands to draw
+	bool valid() const { return cullProgram && cullProgram->isValid(); }
+
+	// run the cull pass for this frame's instances, runCount counters
+	void cull(const std::vector<CullInstance>& instances, size_t runCount);
+	// draw run's commands [slot, slot + maxCount) with the counter's draw count
+	void drawRun(size_t run, GLuint slot, GLuint maxCount);
+
+	// depth of the frame just drawn, from a framebuffer with a GL_DEPTH24_STENCIL8 depth buffer
+	// (the default one), becomes the occlusion pyramid for the next cull
+	void captureDepth(GLuint framebuffer, int width, int height);
+
+	// the newest readback that has arrived
+	const Stats& stats() const { return lastStats; }
+
+private:
+	static const unsigned int READBACK_FRAMES = 4;
+
+	struct Readback {
+		GLuint buffer = 0;
+		GLsync fence = 0;
+		unsigned int tested = 0;
+		unsigned int frame = 0;
+	};
+
+	std::unique_ptr<Shader> cullProgram;
+	std::unique_ptr<Shader> depthProgram; // depth texture -> pyramid level 0
+	std::unique_ptr<Shader> reduceProgram; // level n -> n + 1
+
+	GLuint instanceBuffer, commandBuffer, counterBuffer;
+	size_t commandCapacity, counterCapacity;
+
+	GLuint depthTexture, depthFramebuffer;
+	GLuint pyramid;
+	int depthWidth, depthHeight;
+	int pyramidLevels;
+	bool pyramidValid;
+	glm::mat4 pyramidViewProjection; // the camera the pyramid was drawn with
+	glm::mat4 currentViewProjection;
+
+	Readback readbacks[READBACK_FRAMES];
+	unsigned int frame;
+	Stats lastStats;
+
+	void resizeDepth(int width, int height);
+	void buildPyramid();
+	void collectReadbacks();
+};
+
+#endif
@@ -0,0 +1,183 @@
+#include "IndirectRenderer.h"
+#include "GLExtensions.h"
+#include "GeometryArena.h"
+
+bool IndirectRenderer::supported() {
+	return GLExt::multiDrawIndirect;
+}
+
+IndirectRenderer::IndirectRenderer()
+	: shaders("model_indirect.vert", "model_indirect.frag", materialFeatureNames()), uploadedMaterials(0)
+{
+	PipelineDesc opaque;
+	opaquePipeline = PipelineState::get(opaque);
+
+	PipelineDesc translucent;
+	translucent.blend = true;
+	translucent.depthWrite = false;
+	translucentPipeline = PipelineState::get(translucent);
+
+	GLuint buffers[3];
+	glGenBuffers(3, buffers);
+	commandBuffer = buffers[0];
+	recordBuffer = buffers[1];
+	materialBuffer = buffers[2];
+}
+
+IndirectRenderer::~IndirectRenderer() {
+	GLuint buffers[3] = { commandBuffer, recordBuffer, materialBuffer };
+	for (GLuint buffer : buffers)
+		GLState::forgetBuffer(buffer);
+	glDeleteBuffers(3, buffers);
+}
+
+void IndirectRenderer::begin() {
+	commands.clear();
+	records.clear();
+	spheres.clear();
+	batches.clear();
+}
+
+unsigned int IndirectRenderer::materialSlot(const MaterialLibrary& materials, unsigned int material) {
+
+	unsigned int id = materials.id(material);
+	std::unordered_map<unsigned int, unsigned int>::iterator it = materialSlots.find(id);
+	if (it != materialSlots.end()) return it->second;
+
+	unsigned int slot = static_cast<unsigned int>(materialData.size());
+	materialData.push_back(materials.materials[material].data);
+	materialSlots[id] = slot;
+	return slot;
+}
+
+void IndirectRenderer::add(const Mesh& mesh, const MaterialLibrary& materials, unsigned int material,
+	const glm::mat4& model, bool translucent) {
+
+	if (mesh.geometry() == GeometryArena::INVALID || mesh.instanceTransforms.empty()) return;
+	const GeometryArena::Entry& entry = GeometryArena::shared().entry(mesh.geometry());
+
+	DrawElementsIndirectCommand command;
+	command.count = static_cast<GLuint>(entry.indexCount);
+	command.instanceCount = static_cast<GLuint>(mesh.instanceTransforms.size());
+	command.firstIndex = static_cast<GLuint>(entry.indexOffset);
+	command.baseVertex = static_cast<GLint>(entry.vertexOffset);
+	command.baseInstance = static_cast<GLuint>(records.size());
+	commands.push_back(command);
+
+	DrawRecord record;
+	record.material = materialSlot(materials, material);
+	record.padding[0] = record.padding[1] = record.padding[2] = 0;
+	glm::vec3 center = mesh.bounds.center();
+	float radius = 0.5f * glm::length(mesh.bounds.extent());
+	for (const glm::mat4& transform : mesh.instanceTransforms) {
+		record.model = model * transform;
+		records.push_back(record);
+
+		// sphere around the box, scaled by the longest axis of the transform
+		float scale = std::max(glm::length(glm::vec3(record.model[0])),
+			std::max(glm::length(glm::vec3(record.model[1])), glm::length(glm::vec3(record.model[2]))));
+		spheres.push_back(glm::vec4(glm::vec3(record.model * glm::vec4(center, 1.0f)), radius * scale));
+	}
+
+	// a new run only when the program, the textures or the blending change
+	unsigned int features = materials.materials[material].features;
+	const MaterialLibrary* textured = features ? &materials : nullptr;
+	unsigned int texturedMaterial = features ? material : 0;
+	if (!batches.empty()) {
+		Batch& last = batches.back();
+		if (last.translucent == translucent && last.features == features
+			&& last.materials == textured && last.material == texturedMaterial) {
+			last.commandCount++;
+			return;
+		}
+	}
+	Batch batch;
+	batch.firstCommand = commands.size() - 1;
+	batch.commandCount = 1;
+	batch.materials = textured;
+	batch.material = texturedMaterial;
+	batch.features = features;
+	batch.translucent = translucent;
+	batches.push_back(batch);
+}
+
+void IndirectRenderer::execute(GpuCuller* culler) {
+
+	// a culler whose program failed draws the commands unculled
+	if (culler && !culler->valid()) culler = nullptr;
+
+	lastStats = Stats();
+	lastStats.commands = commands.size();
+	lastStats.instances = records.size();
+	if (commands.empty()) return;
+
+	// orphan and refill, the previous frame's draws may still read the old storage
+	GLState::bindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+	glBufferData(GL_DRAW_INDIRECT_BUFFER, commands.size() * sizeof(DrawElementsIndirectCommand), commands.data(), GL_STREAM_DRAW);
+	GLState::bindBuffer(GL_SHADER_STORAGE_BUFFER, recordBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, records.size() * sizeof(DrawRecord), records.data(), GL_STREAM_DRAW);
+	if (uploadedMaterials != materialData.size()) {
+		GLState::bindBuffer(GL_SHADER_STORAGE_BUFFER, materialBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, materialData.size() * sizeof(MaterialData), materialData.data(), GL_STATIC_DRAW);
+		uploadedMaterials = materialData.size();
+	}
+	GLState::bindBufferBase(GL_SHADER_STORAGE_BUFFER, DRAW_RECORD_BINDING, recordBuffer);
+	GLState::bindBufferBase(GL_SHADER_STORAGE_BUFFER, MATERIAL_RECORD_BINDING, materialBuffer);
+
+	// culled: one single-instance command per record, each run gets a range of slots as long as its instance count
+	std::vector<GLuint> runSlots;
+	if (culler) {
+		cullInstances.clear();
+		runSlots.reserve(batches.size() + 1);
+		for (size_t run = 0; run < batches.size(); run++) {
+			runSlots.push_back(static_cast<GLuint>(cullInstances.size()));
+			const Batch& batch = batches[run];
+			for (size_t c = batch.firstCommand; c < batch.firstCommand + batch.commandCount; c++) {
+				const DrawElementsIndirectCommand& command = commands[c];
+				for (GLuint i = 0; i < command.instanceCount; i++) {
+					CullInstance instance;
+					instance.sphere = spheres[command.baseInstance + i];
+					instance.count = command.count;
+					instance.firstIndex = command.firstIndex;
+					instance.baseVertex = command.baseVertex;
+					instance.record = command.baseInstance + i;
+					instance.batch = static_cast<GLuint>(run);
+					instance.slot = runSlots.back();
+					instance.padding[0] = instance.padding[1] = 0;
+					cullInstances.push_back(instance);
+				}
+			}
+		}
+		runSlots.push_back(static_cast<GLuint>(cullInstances.size()));
+		culler->cull(cullInstances, batches.size());
+	}
+
+	GeometryArena::shared().bindIndirect(records.size());
+
+	const Batch* last = nullptr;
+	for (const Batch& batch : batches) {
+		if (!last || last->translucent != batch.translucent)
+			GLState::setPipeline(batch.translucent ? translucentPipeline : opaquePipeline);
+		if (!last || last->features != batch.features)
+			shaders.use(batch.features);
+		if (batch.materials && (!last || last->materials != batch.materials || last->material != batch.material))
+			batch.materials->bind(batch.material);
+
+		size_t run = &batch - batches.data();
+		if (culler) {
+			culler->drawRun(run, runSlots[run], runSlots[run + 1] - runSlots[run]);
+		}
+		else {
+			GLState::bindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+			GLExt::MultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT,
+				(void*)(batch.firstCommand * sizeof(DrawElementsIndirectCommand)), static_cast<GLsizei>(batch.commandCount), 0);
+			GLState::countDraw();
+		}
+		lastStats.multiDraws++;
+		last = &batch;
+	}
+
+	// glClear honours the depth mask, a translucent last batch would leave depth writes off
+	if (last && last->translucent)
+		GLState::setPipeline(opaquePipeline);
+}
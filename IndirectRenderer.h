@@ -0,0 +1,109 @@
+#ifndef INDIRECTRENDERER_H
+#define INDIRECTRENDERER_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+
+#include "Mesh.h"
+#include "Material.h"
+#include "ShaderVariants.h"
+#include "GLState.h"
+#include "GpuCuller.h"
+
+// Shader storage binding points, fixed with layout(binding = N) in model_indirect.vert/.frag
+enum StorageBindingPoint : GLuint {
+	DRAW_RECORD_BINDING = 0,
+	MATERIAL_RECORD_BINDING = 1
+};
+
+// std430 element of DrawRecords: one per drawn instance
+struct DrawRecord {
+	glm::mat4 model;       // model matrix * mesh instance transform
+	unsigned int material; // slot in the renderer's material buffer
+	unsigned int padding[3];
+};
+
+// what glMultiDrawElementsIndirect reads from GL_DRAW_INDIRECT_BUFFER
+struct DrawElementsIndirectCommand {
+	GLuint count;
+	GLuint instanceCount;
+	GLuint firstIndex;
+	GLint baseVertex;
+	GLuint baseInstance; // first DrawRecord of the command
+};
+
+// GL 4.3 submission path: all draws of a frame become indirect commands into the geometry arena,
+// with their transforms and material parameters in shader storage buffers, and each run of draws
+// that needs the same program and textures is one glMultiDrawElementsIndirect. Untextured
+// materials only differ in their parameters, so they all share a run.
+// Mesh::Draw through RenderQueue::execute(UniformBlockBuffer&) remains the GL 3.3 path.
+class IndirectRenderer {
+
+public:
+	struct Stats {
+		size_t commands = 0;
+		size_t instances = 0;
+		unsigned int multiDraws = 0;
+	};
+
+	// GLExt::multiDrawIndirect has to be checked first
+	static bool supported();
+
+	IndirectRenderer();
+	~IndirectRenderer();
+	IndirectRenderer(const IndirectRenderer&) = delete;
+	IndirectRenderer& operator=(const IndirectRenderer&) = delete;
+
+	void begin();
+	// one command for all instance transforms of the mesh, draws keep the order they are added in
+	void add(const Mesh& mesh, const MaterialLibrary& materials, unsigned int material, const glm::mat4& model,
+		bool translucent);
+	// upload and draw everything added since begin(), with a culler every instance is tested on the GPU
+	// first and only the survivors are drawn
+	void execute(GpuCuller* culler = nullptr);
+
+	// compile the variants for these feature masks ahead of time
+	void request(unsigned int features) { shaders.request(features); }
+	// pick up finished compiles, call once per frame
+	void update() { shaders.update(); }
+	size_t pendingCount() const { return shaders.pendingCount(); }
+
+	const Stats& stats() const { return lastStats; }
+
+private:
+	struct Batch {
+		size_t firstCommand;
+		size_t commandCount;
+		const MaterialLibrary* materials; // textures to bind, null for untextured runs
+		unsigned int material;
+		unsigned int features;
+		bool translucent;
+	};
+
+	ShaderVariants shaders;
+	const PipelineState* opaquePipeline;
+	const PipelineState* translucentPipeline;
+
+	GLuint commandBuffer, recordBuffer, materialBuffer;
+
+	std::vector<DrawElementsIndirectCommand> commands;
+	std::vector<DrawRecord> records;
+	std::vector<glm::vec4> spheres; // world space bounds of each record
+	std::vector<CullInstance> cullInstances;
+	std::vector<Batch> batches;
+
+	// MaterialLibrary::id -> slot in materialData, ids are never reused so slots stay valid
+	std::unordered_map<unsigned int, unsigned int> materialSlots;
+	std::vector<MaterialData> materialData;
+	size_t uploadedMaterials;
+
+	Stats lastStats;
+
+	unsigned int materialSlot(const MaterialLibrary& materials, unsigned int material);
+};
+
+#endif
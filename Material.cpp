@@ -0,0 +1,94 @@
+#include "Material.h"
+#include "GLState.h"
+
+#include <atomic>
+#include <cstring>
+#include <iostream>
+
+const char* materialSamplerName(unsigned int unit) {
+	static const char* names[MATERIAL_UNIT_COUNT] = {
+		"texture_diffuse1", "texture_specular1", "texture_roughness1", "texture_ao1"
+	};
+	return unit < MATERIAL_UNIT_COUNT ? names[unit] : "";
+};
+
+std::vector<std::string> materialFeatureNames() {
+	return { "HAS_DIFFUSE_MAP", "HAS_AO_MAP" };
+};
+
+MaterialDescription::MaterialDescription() {
+	// the OBJ defaults
+	data.diffuseColor = glm::vec4(0.8f, 0.8f, 0.8f, 1.0f);
+	data.specularColor = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+	data.shininess = 0.0f;
+	data.roughness = 1.0f;
+	data.padding[0] = data.padding[1] = 0.0f;
+};
+
+void MaterialLibrary::build(const std::vector<MaterialDescription>& descriptions) {
+
+	std::vector<MaterialDescription> all(descriptions);
+	all.push_back(MaterialDescription());
+	all.back().name = "default";
+
+	static std::atomic<unsigned int> nextId(0);
+	firstId = nextId.fetch_add(static_cast<unsigned int>(all.size()));
+
+	materials.clear();
+	materials.reserve(all.size());
+	for (const MaterialDescription& description : all) {
+		Material material;
+		material.name = description.name;
+		material.data = description.data;
+		for (unsigned int unit = 0; unit < MATERIAL_UNIT_COUNT; unit++) {
+			material.maps[unit] = description.maps[unit];
+			material.textures[unit] = 0;
+		}
+		material.features = 0;
+		material.translucent = description.data.diffuseColor.a < 1.0f;
+		material.depthPrepass = description.depthPrepass && !material.translucent;
+		material.texturesLoaded = false;
+		materials.push_back(material);
+	}
+
+	// one block per material, each starting at an offset glBindBufferRange accepts
+	GLint alignment = 256;
+	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+	stride = std140AlignUp(sizeof(MaterialData), static_cast<size_t>(alignment > 0 ? alignment : 256));
+
+	std::vector<unsigned char> blocks(stride * all.size(), 0);
+	for (size_t i = 0; i < all.size(); i++)
+		std::memcpy(&blocks[i * stride], &all[i].data, sizeof(MaterialData));
+
+	uniforms.reset(new UniformBuffer(MATERIAL_DATA_BINDING, blocks.size()));
+	uniforms->update(blocks.data(), blocks.size());
+};
+
+void MaterialLibrary::loadTextures(unsigned int index, TextureCache& cache, const std::string& directory) {
+
+	Material& material = materials[index];
+	if (material.texturesLoaded) return;
+
+	for (unsigned int unit = 0; unit < MATERIAL_UNIT_COUNT; unit++)
+		if (!material.maps[unit].empty())
+			material.textures[unit] = cache.get(directory + '/' + material.maps[unit]);
+
+	// a map that failed to load is left at 0 and its feature off, the variant without it is used
+	material.features = 0;
+	if (material.textures[MATERIAL_UNIT_DIFFUSE]) material.features |= MATERIAL_FEATURE_DIFFUSE_MAP;
+	if (material.textures[MATERIAL_UNIT_AO]) material.features |= MATERIAL_FEATURE_AO_MAP;
+	material.texturesLoaded = true;
+};
+
+unsigned int MaterialLibrary::materialOf(unsigned int fileMaterial) const {
+	return fileMaterial < defaultMaterial() ? fileMaterial : defaultMaterial();
+};
+
+void MaterialLibrary::bind(unsigned int index) const {
+
+	const Material& material = materials[index];
+	for (unsigned int unit = 0; unit < MATERIAL_UNIT_COUNT; unit++)
+		GLState::bindTexture(unit, material.textures[unit]);
+
+	GLState::bindBufferRange(GL_UNIFORM_BUFFER, MATERIAL_DATA_BINDING, uniforms->ID, index * stride, sizeof(MaterialData));
+};
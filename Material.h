@@ -0,0 +1,89 @@
+#ifndef CLASS_MATERIAL_H
+#define CLASS_MATERIAL_H
+
+#include <glad/glad.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "UniformBlocks.h"
+#include "UniformBuffer.h"
+#include "TextureCache.h"
+
+// Every map is read from the same texture unit by every material and every shader.
+// Shader::reflect points the sampler uniforms at these units once per program, never per draw.
+enum MaterialTextureUnit : unsigned int {
+	MATERIAL_UNIT_DIFFUSE = 0,   // map_Kd
+	MATERIAL_UNIT_SPECULAR = 1,  // map_Ks
+	MATERIAL_UNIT_ROUGHNESS = 2, // map_Pr
+	MATERIAL_UNIT_AO = 3,        // map_ao
+	MATERIAL_UNIT_COUNT = 4
+};
+
+// sampler uniform that reads a unit ("texture_diffuse1", ...)
+const char* materialSamplerName(unsigned int unit);
+
+// model.frag features a material needs, bit i is materialFeatureNames()[i] (see ShaderVariants)
+enum MaterialFeature : unsigned int {
+	MATERIAL_FEATURE_DIFFUSE_MAP = 1u << 0,
+	MATERIAL_FEATURE_AO_MAP = 1u << 1
+};
+
+std::vector<std::string> materialFeatureNames();
+
+// what the file says about a material, gathered without any GL call on the loader threads
+struct MaterialDescription {
+	std::string name;
+	std::string maps[MATERIAL_UNIT_COUNT]; // relative to the model directory, empty when absent
+	MaterialData data;
+	bool depthPrepass = true; // laid down by RenderQueue's depth prepass in DepthPrepass::PerMaterial mode
+
+	MaterialDescription();
+};
+
+struct Material {
+	std::string name;
+	std::string maps[MATERIAL_UNIT_COUNT];
+	MaterialData data;                    // also in the library's uniform buffer
+	GLuint textures[MATERIAL_UNIT_COUNT]; // 0 when absent or not loaded yet
+	unsigned int features;                // MaterialFeature bits of the loaded maps
+	bool translucent;                     // opacity below 1, drawn blended after the opaque meshes
+	bool depthPrepass;                    // opaque and opted in, see DepthPrepass
+	bool texturesLoaded;
+};
+
+// Materials of one model, shared by index between its meshes.
+// Their parameters sit side by side in one uniform buffer written at load time,
+// so binding a material is a glBindBufferRange plus its textures.
+class MaterialLibrary {
+
+public:
+	std::vector<Material> materials; // the last entry is the default material
+
+	MaterialLibrary() : firstId(0), stride(0) {}
+	MaterialLibrary(const MaterialLibrary&) = delete;
+	MaterialLibrary& operator=(const MaterialLibrary&) = delete;
+
+	// textures are not loaded here, see loadTextures
+	void build(const std::vector<MaterialDescription>& descriptions);
+
+	// resolve the texture files of a material through the cache, only the first call does any work
+	void loadTextures(unsigned int index, TextureCache& cache, const std::string& directory);
+
+	// used by meshes without a (valid) material and by the lazy loading placeholders
+	unsigned int defaultMaterial() const { return static_cast<unsigned int>(materials.size() - 1); }
+	unsigned int materialOf(unsigned int fileMaterial) const;
+
+	void bind(unsigned int index) const;
+
+	// materials of all libraries get distinct ids, firstId + index (render queue sort keys)
+	unsigned int id(unsigned int index) const { return firstId + index; }
+
+private:
+	unsigned int firstId;
+	std::unique_ptr<UniformBuffer> uniforms;
+	size_t stride; // MaterialData rounded up to GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT
+};
+
+#endif // CLASS_MATERIAL_H
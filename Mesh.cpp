@@ -1,70 +1,218 @@
 #include "Mesh.h"
 #include "Shader.h"
+#include "GLState.h"
+#include "StreamBuffer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+
+namespace {
+
+	// exact bit pattern of a position, vertices only weld when they are at the very same place
+	struct PositionKey {
+		uint32_t bits[3];
+		bool operator==(const PositionKey& other) const {
+			return bits[0] == other.bits[0] && bits[1] == other.bits[1] && bits[2] == other.bits[2];
+		}
+	};
+
+	struct PositionKeyHash {
+		size_t operator()(const PositionKey& key) const {
+			return (key.bits[0] * 73856093u) ^ (key.bits[1] * 19349663u) ^ (key.bits[2] * 83492791u);
+		}
+	};
+
+}
 
 
 
-Mesh::Mesh( std::vector<Vertex> vertices, std::vector<unsigned int> indices, std::vector<Texture> textures)
+Mesh::Mesh( std::vector<Vertex> vertices, std::vector<unsigned int> indices, unsigned int materialIndex,
+	GeometryResidency residency, bool positionStream)
+	: materialIndex(materialIndex), handle(GeometryArena::INVALID), loaded(true)
 {
-	this->vertices = vertices;
-	this->indices = indices;
-	this->textures = textures;
+	this->vertices = std::move(vertices);
+	this->indices = std::move(indices);
+
+	for (const Vertex& v : this->vertices)
+		bounds.expand(v.Position);
+	if (bounds.valid()) {
+		sphere.center = bounds.center();
+		float radius2 = 0.0f;
+		for (const Vertex& v : this->vertices) {
+			glm::vec3 d = v.Position - sphere.center;
+			radius2 = std::max(radius2, glm::dot(d, d));
+		}
+		sphere.radius = std::sqrt(radius2);
+	}
+
+	// now that we have all the required data, copy it into the shared geometry buffers
+	if (!this->vertices.empty())
+		handle = GeometryArena::shared().add(this->vertices.data(), this->vertices.size(), this->indices.data(), this->indices.size());
+	setInstances(std::vector<glm::mat4>(1, glm::mat4(1.0f)));
+	if (positionStream && handle != GeometryArena::INVALID)
+		buildPositionStream();
 
-	// now that we have all the required data, set the vertex buffers and its attribute pointers.
-	setupMesh();
+	// the GPU owns a copy now, drop whatever the residency policy does not need
+	applyResidency(residency);
 }
 
-void Mesh::setupMesh() {
+Mesh::Mesh(const AABB& bounds, unsigned int materialIndex)
+	: bounds(bounds), sphere(BoundingSphere::around(bounds)), materialIndex(materialIndex), handle(GeometryArena::INVALID), loaded(false)
+{
+}
+
+Mesh::~Mesh() {
+	if (handle != GeometryArena::INVALID)
+		GeometryArena::shared().remove(handle);
+}
 
-	if (vertices.empty()) return;
+Mesh::Mesh(Mesh&& other) noexcept
+	: vertices(std::move(other.vertices)), indices(std::move(other.indices)), positions(std::move(other.positions)),
+	instanceTransforms(std::move(other.instanceTransforms)), bounds(other.bounds), sphere(other.sphere), materialIndex(other.materialIndex),
+	handle(other.handle), loaded(other.loaded)
+{
+	other.handle = GeometryArena::INVALID;
+}
 
-	glGenVertexArrays(1, &VAO);
-	glGenBuffers(1, &VBO);
-	glGenBuffers(1, &EBO);
+Mesh& Mesh::operator=(Mesh&& other) noexcept {
+	if (this != &other) {
+		if (handle != GeometryArena::INVALID)
+			GeometryArena::shared().remove(handle);
+		vertices = std::move(other.vertices);
+		indices = std::move(other.indices);
+		positions = std::move(other.positions);
+		instanceTransforms = std::move(other.instanceTransforms);
+		bounds = other.bounds;
+		sphere = other.sphere;
+		materialIndex = other.materialIndex;
+		handle = other.handle;
+		loaded = other.loaded;
+		other.handle = GeometryArena::INVALID;
+	}
+	return *this;
+}
 
-	glBindVertexArray(VAO);
+void Mesh::setInstances(const std::vector<glm::mat4>& transforms) {
 
-	glBindBuffer(GL_ARRAY_BUFFER, VBO);
-	glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
+	instanceTransforms = transforms;
+	if (handle == GeometryArena::INVALID) return;
 
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
+	GeometryArena::shared().setInstances(handle, transforms.data(), transforms.size());
+}
 
-	// vertex positions
-	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
-	// vertex normals
-	glEnableVertexAttribArray(1);
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Normal));
-	// vertex texture coords
-	glEnableVertexAttribArray(2);
-	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
+void Mesh::DrawInstanced(const InstanceStream& stream, size_t first, size_t count) {
 
-	glBindVertexArray(0);
+	if (handle == GeometryArena::INVALID) return;
+	GeometryArena::shared().drawStream(handle, stream, first, count);
 }
 
-void Mesh::Draw(Shader &shader) {
+InstanceStream::~InstanceStream() {
+	for (GLuint buffer : ownBuffers)
+		GLState::forgetBuffer(buffer);
+	if (ownBuffers[0])
+		glDeleteBuffers(3, ownBuffers);
+}
 
-	unsigned int diffuseNr = 1;
-	unsigned int specularNr = 1;
+void InstanceStream::upload() {
+
+	StreamBuffer& ring = StreamBuffer::shared();
+	if (ring.frameOpen()) {
+		StreamBuffer::Allocation t = ring.write(transforms.data(), transforms.size() * sizeof(glm::mat4), sizeof(glm::vec4));
+		StreamBuffer::Allocation c = ring.write(colors.data(), colors.size() * sizeof(glm::vec4), sizeof(glm::vec4));
+		StreamBuffer::Allocation i = ring.write(ids.data(), ids.size() * sizeof(unsigned int), sizeof(unsigned int));
+		ring.flush();
+		if (t.data && c.data && i.data) {
+			transformBuffer = t.buffer;
+			colorBuffer = c.buffer;
+			idBuffer = i.buffer;
+			transformOffset = t.offset;
+			colorOffset = c.offset;
+			idOffset = i.offset;
+			return;
+		}
+	}
 
-	for (unsigned int i = 0; i < textures.size(); i++) {
-		glActiveTexture(GL_TEXTURE0 + i); // activate proper texture unit before binding
-		std::string number;
-		std::string name = textures[i].type;
-		if (name == "texture_diffuse")
-			number = std::to_string(diffuseNr++);
-		else if (name == "texture_specular")
-			number = std::to_string(specularNr++);
+	if (!ownBuffers[0])
+		glGenBuffers(3, ownBuffers);
+	transformBuffer = ownBuffers[0];
+	colorBuffer = ownBuffers[1];
+	idBuffer = ownBuffers[2];
+	transformOffset = colorOffset = idOffset = 0;
+
+	// orphan and refill, draws still reading last call's data keep their copy
+	GLState::bindBuffer(GL_ARRAY_BUFFER, transformBuffer);
+	glBufferData(GL_ARRAY_BUFFER, transforms.size() * sizeof(glm::mat4), transforms.data(), GL_STREAM_DRAW);
+	GLState::bindBuffer(GL_ARRAY_BUFFER, colorBuffer);
+	glBufferData(GL_ARRAY_BUFFER, colors.size() * sizeof(glm::vec4), colors.data(), GL_STREAM_DRAW);
+	GLState::bindBuffer(GL_ARRAY_BUFFER, idBuffer);
+	glBufferData(GL_ARRAY_BUFFER, ids.size() * sizeof(unsigned int), ids.data(), GL_STREAM_DRAW);
+}
 
-		shader.setFloat(("material." + name + number).c_str(), i);
-		glBindTexture(GL_TEXTURE_2D, textures[i].id);
+void Mesh::buildPositionStream() {
+
+	// vertices split only by normal or uv collapse into one position; numbered in the order the
+	// indices first reach them, so a depth pass reads the stream front to back
+	std::unordered_map<PositionKey, unsigned int, PositionKeyHash> welded;
+	welded.reserve(vertices.size());
+	std::vector<unsigned int> remap(vertices.size(), ~0u);
+	std::vector<glm::vec3> stream;
+	std::vector<unsigned int> streamIndices;
+	stream.reserve(vertices.size());
+	streamIndices.reserve(indices.size());
+
+	for (unsigned int index : indices) {
+		if (remap[index] == ~0u) {
+			PositionKey key;
+			std::memcpy(key.bits, &vertices[index].Position, sizeof(key.bits));
+			std::unordered_map<PositionKey, unsigned int, PositionKeyHash>::iterator it = welded.find(key);
+			if (it == welded.end()) {
+				it = welded.insert(std::make_pair(key, static_cast<unsigned int>(stream.size()))).first;
+				stream.push_back(vertices[index].Position);
+			}
+			remap[index] = it->second;
+		}
+		streamIndices.push_back(remap[index]);
 	}
-	glActiveTexture(GL_TEXTURE0);
 
-	//draw mesh
-	glBindVertexArray(VAO);
-	glDrawElements(GL_TRIANGLES, static_cast<unsigned int>(indices.size()), GL_UNSIGNED_INT, 0);
-	glBindVertexArray(0);
-	glActiveTexture(GL_TEXTURE0);
+	GeometryArena::shared().setPositions(handle, stream.data(), stream.size(), streamIndices.data(), streamIndices.size());
+}
+
+void Mesh::applyResidency(GeometryResidency residency) {
+
+	if (residency == GeometryResidency::Full) return;
+
+	if (residency == GeometryResidency::PositionsOnly) {
+		positions.reserve(vertices.size());
+		for (const Vertex& v : vertices)
+			positions.push_back(v.Position);
+	}
+	else {
+		std::vector<unsigned int>().swap(indices);
+	}
+
+	// clear() keeps the capacity, swap with an empty vector to actually hand the memory back
+	std::vector<Vertex>().swap(vertices);
+}
+
+size_t Mesh::residentBytes() const {
+	return vertices.capacity() * sizeof(Vertex)
+		+ indices.capacity() * sizeof(unsigned int)
+		+ positions.capacity() * sizeof(glm::vec3);
+}
+
+void Mesh::DrawPositions() const {
+
+	if (handle == GeometryArena::INVALID) return;
+	GeometryArena::shared().drawPositions(handle);
+}
+
+void Mesh::Draw() const {
+
+	//draw mesh from the arena's VAO, its range of the shared buffers is picked by base vertex and first index
+	if (handle == GeometryArena::INVALID) return;
+	GeometryArena::shared().draw(handle);
 
 }
\ No newline at end of file
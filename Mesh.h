@@ -7,6 +7,8 @@
 #include <glm/gtc/matrix_transform.hpp>
 
 #include "Shader.h"
+#include "Frustum.h"
+#include "GeometryArena.h"
 
 #include <string>
 #include <vector>
@@ -17,10 +19,34 @@ struct Vertex {
 	glm::vec2 TexCoords;
 };
 
-struct Texture {
-	unsigned int id;
-	std::string type;
-	std::string path;
+// How much of a mesh's geometry is kept in system memory after it has been uploaded to the GPU.
+enum class GeometryResidency {
+	Full,          // keep vertices and indices (picking, editing)
+	PositionsOnly, // keep a compact position + index copy
+	GpuOnly        // release everything once the VBO/EBO are filled
+};
+
+// Per-instance attributes supplied at draw time rather than stored with a mesh (Model::DrawInstanced).
+// Filled on the CPU, uploaded in one go, then ranges of it are drawn mesh by mesh.
+struct InstanceStream {
+	std::vector<glm::mat4> transforms;  // attributes 3-6
+	std::vector<glm::vec4> colors;      // attribute 7
+	std::vector<unsigned int> ids;      // attribute 8
+	// where the last upload went: the stream's own buffers, or ranges of StreamBuffer::shared()
+	GLuint transformBuffer = 0;
+	GLuint colorBuffer = 0;
+	GLuint idBuffer = 0;
+	GLintptr transformOffset = 0;
+	GLintptr colorOffset = 0;
+	GLintptr idOffset = 0;
+	GLuint ownBuffers[3] = { 0, 0, 0 }; // only created when no StreamBuffer frame is open
+
+	InstanceStream() {}
+	~InstanceStream();
+	InstanceStream(const InstanceStream&) = delete;
+	InstanceStream& operator=(const InstanceStream&) = delete;
+
+	void upload();
 };
 
 class Mesh {
@@ -28,14 +54,48 @@ class Mesh {
 public:
 	std::vector<Vertex> vertices;
 	std::vector<unsigned int> indices;
-	std::vector<Texture> textures;
+	std::vector<glm::vec3> positions; // only filled for GeometryResidency::PositionsOnly
+	std::vector<glm::mat4> instanceTransforms;
+	AABB bounds; // local space, before the instance transforms
+	BoundingSphere sphere; // local space, centered on the box, radius to the furthest vertex
+	unsigned int materialIndex; // into the owning model's MaterialLibrary
+
+	// positionStream also uploads a welded position-only copy for DrawPositions
+	Mesh(std::vector<Vertex> vertices, std::vector<unsigned int> indices, unsigned int materialIndex,
+		GeometryResidency residency = GeometryResidency::Full, bool positionStream = false);
+	// bounds-only stand-in for a mesh whose geometry has not been loaded yet
+	Mesh(const AABB& bounds, unsigned int materialIndex);
+	// the geometry range goes back to the arena, so a mesh can be moved but not copied
+	~Mesh();
+	Mesh(Mesh&& other) noexcept;
+	Mesh& operator=(Mesh&& other) noexcept;
+	Mesh(const Mesh&) = delete;
+	Mesh& operator=(const Mesh&) = delete;
 
-	Mesh(std::vector<Vertex> vertices, std::vector<unsigned int> indices, std::vector<Texture> textures);
-	void Draw(Shader &shader);
+	// the material (textures, MaterialData range) is bound by the caller
+	void Draw() const;
+	// attribute 0 (and the instance matrices) only, from the position stream when the mesh has one
+	void DrawPositions() const;
+	// instances [first, first + count) of a stream instead of the mesh's own transforms
+	void DrawInstanced(const InstanceStream& stream, size_t first, size_t count);
+
+	// one draw covers every transform given here (vertex attributes 3-6 in model.vert)
+	void setInstances(const std::vector<glm::mat4>& transforms);
+
+	// bytes of geometry still held in system memory
+	size_t residentBytes() const;
+
+	bool isLoaded() const { return loaded; }
+	bool hasPositionStream() const { return handle != GeometryArena::INVALID && GeometryArena::shared().hasPositions(handle); }
+	// where the vertices, indices and instance transforms live in GeometryArena::shared()
+	GeometryArena::Handle geometry() const { return handle; }
 
 private:
-	unsigned int VAO, VBO, EBO;
-	void setupMesh();
+	GeometryArena::Handle handle;
+	bool loaded;
+
+	void applyResidency(GeometryResidency residency);
+	void buildPositionStream();
 
 };
 
@@ -1,50 +1,572 @@
 #include "Model.h"
+#include "StaticBatch.h"
 
 
+Model::~Model() {
+	// conversions still running on the pool write into lazy->data
+	if (lazy) {
+		for (size_t i = 0; i < meshes.size(); i++)
+			while (lazy->state[i].load() == LazyConverting)
+				std::this_thread::yield();
+	}
+};
+
 void Model::Draw(Shader &shader) {
+	shader.use();
+	for (unsigned int i = 0; i < meshes.size(); i++) {
+		if (!meshes[i].isLoaded()) continue;
+		materials.bind(meshes[i].materialIndex);
+		meshes[i].Draw();
+	}
+
+	if (placeholder && !placeholder->instanceTransforms.empty()) {
+		// untextured stand-in boxes
+		materials.bind(placeholder->materialIndex);
+		placeholder->Draw();
+	}
+};
+
+void Model::Draw(ShaderVariants& shaders) {
+	for (unsigned int i = 0; i < meshes.size(); i++) {
+		if (!meshes[i].isLoaded()) continue;
+		unsigned int material = meshes[i].materialIndex;
+		shaders.use(materials.materials[material].features);
+		materials.bind(material);
+		meshes[i].Draw();
+	}
+
+	if (placeholder && !placeholder->instanceTransforms.empty()) {
+		shaders.use(materials.materials[placeholder->materialIndex].features);
+		materials.bind(placeholder->materialIndex);
+		placeholder->Draw();
+	}
+};
+
+void Model::DrawInstanced(ShaderVariants& shaders, const glm::mat4* transforms, size_t count,
+	const glm::vec4* colors, const unsigned int* ids) {
+
+	if (count == 0) return;
+	if (!instanceStream) instanceStream.reset(new InstanceStream());
+	InstanceStream& stream = *instanceStream;
+
+	// every node placement of a mesh is repeated for each copy, mesh after mesh in the stream
+	std::vector<size_t> first(meshes.size() + 1, 0);
+	for (size_t i = 0; i < meshes.size(); i++)
+		first[i + 1] = first[i] + (meshes[i].isLoaded() ? meshes[i].instanceTransforms.size() * count : 0);
+
+	size_t total = first.back();
+	stream.transforms.resize(total);
+	stream.colors.resize(total);
+	stream.ids.resize(total);
+
+	ThreadPool::shared().parallelFor(meshes.size(), [&](size_t i) {
+		if (first[i + 1] == first[i]) return;
+		const std::vector<glm::mat4>& nodes = meshes[i].instanceTransforms;
+		size_t out = first[i];
+		for (size_t copy = 0; copy < count; copy++) {
+			for (const glm::mat4& node : nodes) {
+				stream.transforms[out] = transforms[copy] * node;
+				stream.colors[out] = colors ? colors[copy] : glm::vec4(1.0f);
+				stream.ids[out] = ids ? ids[copy] : static_cast<unsigned int>(copy);
+				out++;
+			}
+		}
+	});
+	stream.upload();
+
+	for (unsigned int i = 0; i < meshes.size(); i++) {
+		if (first[i + 1] == first[i]) continue;
+		unsigned int material = meshes[i].materialIndex;
+		shaders.use(materials.materials[material].features);
+		materials.bind(material);
+		meshes[i].DrawInstanced(stream, first[i], first[i + 1] - first[i]);
+	}
+};
+
+void Model::submit(RenderQueue& queue, ShaderVariants& shaders, const DrawData& draw) {
+	unsigned int drawData = queue.addDrawData(draw);
+
+	// a mesh is drawn with all of its instances in one call, so it goes in if any of them is visible
+	meshVisible.assign(meshes.size(), frustumCulling || occlusionCuller ? 0 : 1);
+	lastCull = FrustumCuller::Stats();
+	if (frustumCulling) {
+		Frustum frustum(draw.modelViewProjection);
+		if (instances.size() >= HIERARCHY_THRESHOLD) {
+			auto start = std::chrono::high_resolution_clock::now();
+			lastCull.visible = instanceBvh.cull(frustum, instanceVisible);
+			lastCull.tested = instances.size();
+			lastCull.blocks = 1;
+			lastCull.ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+		}
+		else {
+			instanceCuller.cull(frustum, instanceVisible);
+			lastCull = instanceCuller.stats();
+		}
+	}
+	if (occlusionCuller) {
+		if (!frustumCulling) instanceVisible.assign(instances.size(), 1);
+		occlusionCuller->cull(instanceBounds.data(), instanceBounds.size(), draw.model, instanceVisible);
+	}
+	if (frustumCulling || occlusionCuller) {
+		for (size_t i = 0; i < instances.size(); i++)
+			meshVisible[instances[i].mesh] |= instanceVisible[i];
+	}
+
 	for (unsigned int i = 0; i < meshes.size(); i++)
-		meshes[i].Draw(shader);
+		if (meshes[i].isLoaded() && meshVisible[i] && !(staticBatch && staticBatch->contains(meshes[i])))
+			queue.submit(meshes[i], materials, meshes[i].materialIndex, shaders, drawData, meshInstanceBounds[i]);
+
+	if (placeholder && !placeholder->instanceTransforms.empty()) {
+		AABB all;
+		for (const AABB& box : instanceBounds)
+			all.expand(box);
+		queue.submit(*placeholder, materials, placeholder->materialIndex, shaders, drawData, all);
+	}
+};
+
+void Model::updateVisibility(const glm::mat4& modelViewProjection) {
+
+	if (!lazy) return;
+
+	Frustum frustum(modelViewProjection);
+	for (size_t i = 0; i < instances.size(); i++) {
+		unsigned int mesh = instances[i].mesh;
+		if (lazy->state[mesh].load() == LazyNotRequested && frustum.intersects(instanceBounds[i]))
+			requestMesh(mesh);
+	}
+
+	// upload a few converted meshes per frame so a burst of requests does not stall a single frame
+	unsigned int uploads = 0;
+	for (unsigned int i = 0; i < meshes.size() && uploads < lazyUploadsPerFrame; i++) {
+		if (lazy->state[i].load(std::memory_order_acquire) != LazyConverted) continue;
+
+		std::vector<glm::mat4> transforms = meshes[i].instanceTransforms;
+		unsigned int material = meshes[i].materialIndex;
+		materials.loadTextures(material, *textureCache, directory);
+		meshes[i] = Mesh(std::move(lazy->data[i].vertices), std::move(lazy->data[i].indices), material, residency, positionStream);
+		meshes[i].setInstances(transforms);
+
+		lazy->state[i].store(LazyUploaded);
+		lazy->remaining--;
+		uploads++;
+	}
+
+	if (uploads > 0)
+		updatePlaceholders();
+
+	if (lazy->remaining == 0) {
+		// everything is on the GPU, the scene and importer are no longer needed
+		lazy.reset();
+		placeholder.reset();
+	}
+};
+
+void Model::requestMesh(unsigned int mesh) {
+
+	lazy->state[mesh].store(LazyConverting);
+
+	// the maps are decoded next to the geometry, updateVisibility() then only uploads them
+	std::vector<std::string> maps;
+	const Material& material = materials.materials[meshes[mesh].materialIndex];
+	if (!material.texturesLoaded)
+		for (unsigned int unit = 0; unit < MATERIAL_UNIT_COUNT; unit++)
+			if (!material.maps[unit].empty())
+				maps.push_back(directory + '/' + material.maps[unit]);
+
+	LazyState* state = lazy.get();
+	TextureCache* textures = textureCache;
+	const aiMesh* source = state->scene->mMeshes[state->sourceOfMesh[mesh]];
+	ThreadPool::shared().submit([state, source, mesh, textures, maps]() {
+		state->data[mesh] = processMesh(source);
+		for (const std::string& file : maps)
+			textures->prefetch(file);
+		state->state[mesh].store(LazyConverted, std::memory_order_release);
+	});
+};
+
+void Model::updatePlaceholders() {
+
+	if (!placeholder) {
+		std::vector<Vertex> vertices(8);
+		for (unsigned int i = 0; i < 8; i++) {
+			vertices[i].Position = glm::vec3(i & 1 ? 0.5f : -0.5f, i & 2 ? 0.5f : -0.5f, i & 4 ? 0.5f : -0.5f);
+			vertices[i].Normal = glm::normalize(vertices[i].Position);
+			vertices[i].TexCoords = glm::vec2(0.0f);
+		}
+		std::vector<unsigned int> indices = {
+			0, 2, 1, 1, 2, 3,  4, 5, 6, 5, 7, 6,  // -z, +z
+			0, 1, 4, 1, 5, 4,  2, 6, 3, 3, 6, 7,  // -y, +y
+			0, 4, 2, 2, 4, 6,  1, 3, 5, 3, 7, 5   // -x, +x
+		};
+		placeholder.reset(new Mesh(std::move(vertices), std::move(indices), materials.defaultMaterial(), GeometryResidency::GpuOnly));
+	}
+
+	std::vector<glm::mat4> boxes;
+	for (size_t i = 0; i < instances.size(); i++) {
+		const Mesh& mesh = meshes[instances[i].mesh];
+		if (mesh.isLoaded() || !mesh.bounds.valid()) continue;
+
+		glm::mat4 box = glm::translate(instances[i].transform, mesh.bounds.center());
+		boxes.push_back(glm::scale(box, glm::max(mesh.bounds.extent(), glm::vec3(1e-4f))));
+	}
+	placeholder->setInstances(boxes);
+};
+
+size_t Model::residentBytes() const {
+	size_t bytes = 0;
+	for (const Mesh& mesh : meshes)
+		bytes += mesh.residentBytes();
+	return bytes;
+};
+
+void Model::printStats() const {
+	std::cout << "Loaded meshes: " << meshes.size() << " unique, " << instances.size() << " instances, "
+		<< instances.size() - meshes.size() << " draw calls saved" << std::endl;
+	if (lazy)
+		std::cout << "Lazy loading: geometry and textures deferred until visible" << std::endl;
+	std::cout << "Resident CPU geometry: " << residentBytes() / 1024 << " KB" << std::endl;
+	GeometryArena::shared().printReport();
 };
 
 void Model::loadModel(std::string path) {
-	Assimp::Importer importer;
-	const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs);
+
+	if (!lazyLoad) {
+		Assimp::Importer importer;
+		ModelImport data;
+		if (importFile(importer, path, dedupGeometry, data))
+			build(data);
+		return;
+	}
+
+	std::unique_ptr<Assimp::Importer> importer(new Assimp::Importer());
+	const aiScene* scene = importer->ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs);
 
 	if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) {
-		std::cout << "ERROR::ASSIMP::" << importer.GetErrorString() << std::endl;
+		std::cout << "ERROR::ASSIMP::" << importer->GetErrorString() << std::endl;
 		return;
 	}
 	directory = path.substr(0, path.find_last_of('/'));
 
-	processNode(scene->mRootNode, scene);
+	std::vector<unsigned int> sourceMeshes;
+	std::vector<std::pair<unsigned int, glm::mat4>> nodeMeshes;
+	collectMeshes(scene, sourceMeshes, nodeMeshes);
+
+	// material parameters go to the GPU now, their textures with the first mesh that uses them
+	std::vector<MaterialDescription> descriptions(scene->mNumMaterials);
+	for (unsigned int i = 0; i < scene->mNumMaterials; i++)
+		descriptions[i] = describeMaterial(scene->mMaterials[i]);
+	materials.build(descriptions);
+
+	// only bounds for now, geometry and textures are requested by updateVisibility()
+	lazy.reset(new LazyState());
+	lazy->scene = scene;
+	lazy->sourceOfMesh = sourceMeshes;
+	lazy->data.resize(sourceMeshes.size());
+	lazy->state.reset(new std::atomic<int>[sourceMeshes.size()]);
+	lazy->remaining = sourceMeshes.size();
+
+	std::vector<AABB> bounds(sourceMeshes.size());
+	ThreadPool::shared().parallelFor(sourceMeshes.size(), [&](size_t i) {
+		bounds[i] = meshBounds(scene->mMeshes[sourceMeshes[i]]);
+	});
+
+	std::vector<unsigned int> meshOfSlot(sourceMeshes.size());
+	meshes.reserve(sourceMeshes.size());
+	for (size_t i = 0; i < sourceMeshes.size(); i++) {
+		lazy->state[i].store(LazyNotRequested);
+		meshOfSlot[i] = static_cast<unsigned int>(i);
+		meshes.push_back(Mesh(bounds[i], materials.materialOf(scene->mMeshes[sourceMeshes[i]]->mMaterialIndex)));
+	}
+
+	buildInstances(nodeMeshes, meshOfSlot);
+
+	// the importer owns the scene, keep it alive for the deferred conversions
+	lazy->importer = std::move(importer);
+	updatePlaceholders();
+};
+
+bool Model::importFile(Assimp::Importer& importer, const std::string& path, bool computeHash, ModelImport& out) {
+
+	auto start = std::chrono::high_resolution_clock::now();
+
+	const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs);
+
+	if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) {
+		std::cout << "ERROR::ASSIMP::" << importer.GetErrorString() << std::endl;
+		return false;
+	}
+	out.directory = path.substr(0, path.find_last_of('/'));
+
+	std::vector<unsigned int> sourceMeshes;
+	collectMeshes(scene, sourceMeshes, out.nodeMeshes);
+
+	// vertex/index conversion has no GL dependency, spread it over the worker threads
+	out.meshes.resize(sourceMeshes.size());
+	ThreadPool::shared().parallelFor(sourceMeshes.size(), [&](size_t i) {
+		out.meshes[i] = processMesh(scene->mMeshes[sourceMeshes[i]], computeHash);
+	});
+
+	out.materialOfMesh.resize(sourceMeshes.size());
+	for (size_t i = 0; i < sourceMeshes.size(); i++)
+		out.materialOfMesh[i] = scene->mMeshes[sourceMeshes[i]]->mMaterialIndex;
+
+	out.materials.resize(scene->mNumMaterials);
+	for (unsigned int i = 0; i < scene->mNumMaterials; i++)
+		out.materials[i] = describeMaterial(scene->mMaterials[i]);
+
+	// everything we need has been copied out, let the importer take the next file
+	importer.FreeScene();
+
+	out.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	return true;
+};
+
+void Model::build(ModelImport& data) {
+
+	directory = data.directory;
+	std::vector<MeshData>& meshData = data.meshes;
+
+	// optionally fold meshes whose geometry and material are identical onto the first copy
+	std::vector<unsigned int> meshOfSlot(meshData.size());
+	std::vector<unsigned int> keptSlots;
+	for (size_t i = 0; i < meshData.size(); i++) {
+		int same = -1;
+		if (dedupGeometry) {
+			for (unsigned int k : keptSlots) {
+				if (meshData[k].hash == meshData[i].hash
+					&& data.materialOfMesh[k] == data.materialOfMesh[i]
+					&& meshData[k].indices == meshData[i].indices
+					&& meshData[k].vertices.size() == meshData[i].vertices.size()
+					&& std::memcmp(meshData[k].vertices.data(), meshData[i].vertices.data(), meshData[i].vertices.size() * sizeof(Vertex)) == 0) {
+					same = static_cast<int>(meshOfSlot[k]);
+					break;
+				}
+			}
+		}
+		if (same >= 0) {
+			meshOfSlot[i] = static_cast<unsigned int>(same);
+		}
+		else {
+			meshOfSlot[i] = static_cast<unsigned int>(keptSlots.size());
+			keptSlots.push_back(static_cast<unsigned int>(i));
+		}
+	}
+
+	// GL objects (material buffer, textures, VAO/VBO/EBO) are created here on the context thread
+	materials.build(data.materials);
+	meshes.reserve(keptSlots.size());
+	for (unsigned int slot : keptSlots) {
+		unsigned int material = materials.materialOf(data.materialOfMesh[slot]);
+		materials.loadTextures(material, *textureCache, directory);
+		meshes.push_back(Mesh(std::move(meshData[slot].vertices), std::move(meshData[slot].indices), material, residency, positionStream));
+	}
+
+	buildInstances(data.nodeMeshes, meshOfSlot);
 };
 
-void Model::processNode(aiNode* node, const aiScene* scene) {
+void Model::buildInstances(const std::vector<std::pair<unsigned int, glm::mat4>>& nodeMeshes, const std::vector<unsigned int>& meshOfSlot) {
+
+	instances.reserve(nodeMeshes.size());
+	for (const auto& ref : nodeMeshes)
+		instances.push_back({ meshOfSlot[ref.first], ref.second });
+
+	std::vector<std::vector<glm::mat4>> transforms(meshes.size());
+	instanceBounds.reserve(instances.size());
+	meshInstanceBounds.assign(meshes.size(), AABB());
+	instanceCuller.clear();
+	instanceCuller.reserve(instances.size());
+	instanceSlot.reserve(instances.size());
+	for (const MeshInstance& instance : instances) {
+		instanceSlot.push_back(static_cast<uint32_t>(transforms[instance.mesh].size()));
+		transforms[instance.mesh].push_back(instance.transform);
+		instanceBounds.push_back(meshes[instance.mesh].bounds.transformed(instance.transform));
+		meshInstanceBounds[instance.mesh].expand(instanceBounds.back());
+		instanceCuller.add(instanceBounds.back(), meshes[instance.mesh].sphere.transformed(instance.transform));
+	}
+	for (size_t i = 0; i < meshes.size(); i++)
+		meshes[i].setInstances(transforms[i]);
+	instanceBvh.build(instanceBounds);
+	rootBounds = instanceBvh.empty() ? AABB() : instanceBvh.nodes()[0].bounds;
+	movedMeshes.assign(meshes.size(), 0);
+};
+
+void Model::setInstanceTransform(size_t instance, const glm::mat4& transform) {
+
+	MeshInstance& moved = instances[instance];
+	moved.transform = transform;
+	instanceBounds[instance] = meshes[moved.mesh].bounds.transformed(transform);
+	instanceCuller.set(instance, instanceBounds[instance], meshes[moved.mesh].sphere.transformed(transform));
+	meshes[moved.mesh].instanceTransforms[instanceSlot[instance]] = transform;
+	movedMeshes[moved.mesh] = 1;
+};
+
+void Model::refitInstances() {
+
+	bool moved = false;
+	for (size_t i = 0; i < meshes.size(); i++) {
+		if (!movedMeshes[i]) continue;
+		meshes[i].setInstances(meshes[i].instanceTransforms);
+		movedMeshes[i] = 0;
+		moved = true;
+	}
+	if (!moved) return;
+
+	meshInstanceBounds.assign(meshes.size(), AABB());
+	for (size_t i = 0; i < instances.size(); i++)
+		meshInstanceBounds[instances[i].mesh].expand(instanceBounds[i]);
+	instanceBvh.refit(instanceBounds);
+	rootBounds = instanceBvh.empty() ? AABB() : instanceBvh.nodes()[0].bounds;
+	occluderOrder.clear();
+	if (lazy) updatePlaceholders();
+};
+
+void Model::addOccluders(OcclusionCuller& culler, const glm::mat4& model, size_t count, size_t maxTriangles) {
+
+	if (occluderOrder.size() != instances.size()) {
+		occluderOrder.resize(instances.size());
+		for (size_t i = 0; i < instances.size(); i++)
+			occluderOrder[i] = static_cast<uint32_t>(i);
+		std::stable_sort(occluderOrder.begin(), occluderOrder.end(), [this](uint32_t a, uint32_t b) {
+			glm::vec3 sizeA = instanceBounds[a].valid() ? instanceBounds[a].extent() : glm::vec3(0.0f);
+			glm::vec3 sizeB = instanceBounds[b].valid() ? instanceBounds[b].extent() : glm::vec3(0.0f);
+			return sizeA.x * sizeA.y + sizeA.y * sizeA.z + sizeA.z * sizeA.x > sizeB.x * sizeB.y + sizeB.y * sizeB.z + sizeB.z * sizeB.x;
+		});
+	}
+
+	size_t added = 0;
+	for (size_t i = 0; i < occluderOrder.size() && added < count; i++) {
+		const MeshInstance& instance = instances[occluderOrder[i]];
+		const Mesh& mesh = meshes[instance.mesh];
+		if (mesh.indices.empty() || mesh.indices.size() / 3 > maxTriangles) continue;
+		// glass and other blended surfaces are seen through, like in the depth prepass
+		if (materials.materials[mesh.materialIndex].translucent) continue;
+		if (!mesh.vertices.empty())
+			culler.addOccluder(&mesh.vertices[0].Position, sizeof(Vertex), mesh.indices.data(), mesh.indices.size(), model * instance.transform);
+		else if (!mesh.positions.empty())
+			culler.addOccluder(mesh.positions.data(), sizeof(glm::vec3), mesh.indices.data(), mesh.indices.size(), model * instance.transform);
+		else
+			continue;
+		added++;
+	}
+};
+
+bool Model::pick(const Ray& ray, PickHit& hit) {
+
+	float tMax = FLT_MAX;
+	bool found = false;
+	instanceBvh.raycast(ray, tMax, [&](uint32_t instance, float& t) {
+		const MeshInstance& candidate = instances[instance];
+		const TriangleBvh* triangles = triangleHierarchy(candidate.mesh);
+		if (!triangles) return false;
+
+		// into mesh space; the transform is affine, so distances along the ray stay the same
+		glm::mat4 inverse = glm::inverse(candidate.transform);
+		Ray local = { glm::vec3(inverse * glm::vec4(ray.origin, 1.0f)), glm::vec3(inverse * glm::vec4(ray.direction, 0.0f)) };
+		TriangleBvh::Hit triangle;
+		triangle.t = t;
+		if (!triangles->raycast(local, triangle)) return false;
+
+		t = triangle.t;
+		hit.instance = instance;
+		hit.mesh = candidate.mesh;
+		hit.triangle = triangle.triangle;
+		hit.barycentric = glm::vec2(triangle.u, triangle.v);
+		hit.t = triangle.t;
+		hit.point = ray.origin + ray.direction * triangle.t;
+		found = true;
+		return true;
+	});
+	return found;
+};
+
+const TriangleBvh* Model::triangleHierarchy(unsigned int mesh) {
+
+	if (!meshes[mesh].isLoaded()) return nullptr;
+	if (triangleHierarchies.size() < meshes.size())
+		triangleHierarchies.resize(meshes.size());
+	if (triangleHierarchies[mesh]) return triangleHierarchies[mesh].get();
+
+	const Mesh& source = meshes[mesh];
+	std::vector<glm::vec3> positions;
+	std::vector<unsigned int> readIndices;
+	const std::vector<unsigned int>* indices = &source.indices;
+	if (!source.vertices.empty()) {
+		positions.reserve(source.vertices.size());
+		for (const Vertex& v : source.vertices)
+			positions.push_back(v.Position);
+	}
+	else if (!source.positions.empty()) {
+		positions = source.positions;
+	}
+	else {
+		std::vector<Vertex> vertices;
+		GeometryArena::shared().read(source.geometry(), vertices, readIndices);
+		positions.reserve(vertices.size());
+		for (const Vertex& v : vertices)
+			positions.push_back(v.Position);
+		indices = &readIndices;
+	}
+
+	triangleHierarchies[mesh].reset(new TriangleBvh());
+	triangleHierarchies[mesh]->build(positions, *indices);
+	const TriangleBvh::Stats& stats = triangleHierarchies[mesh]->stats();
+	std::cout << "Picking hierarchy for mesh " << mesh << ": " << stats.triangles << " triangles, "
+		<< stats.nodes << " nodes, " << stats.buildMs << " ms" << std::endl;
+	return triangleHierarchies[mesh].get();
+};
+
+void Model::collectMeshes(const aiScene* scene, std::vector<unsigned int>& sourceMeshes, std::vector<std::pair<unsigned int, glm::mat4>>& nodeMeshes) {
+
+	// walk the node tree first, every node reference becomes an instance of its aiMesh
+	processNode(scene->mRootNode, glm::mat4(1.0f), nodeMeshes);
+
+	// each referenced aiMesh is converted once, in first-reference order so the output is deterministic
+	std::vector<int> slotOfSource(scene->mNumMeshes, -1);
+	for (auto& ref : nodeMeshes) {
+		if (slotOfSource[ref.first] < 0) {
+			slotOfSource[ref.first] = static_cast<int>(sourceMeshes.size());
+			sourceMeshes.push_back(ref.first);
+		}
+		ref.first = static_cast<unsigned int>(slotOfSource[ref.first]);
+	}
+};
+
+AABB Model::meshBounds(const aiMesh* mesh) {
+	AABB bounds;
+	for (unsigned int i = 0; i < mesh->mNumVertices; i++)
+		bounds.expand(glm::vec3(mesh->mVertices[i].x, mesh->mVertices[i].y, mesh->mVertices[i].z));
+	return bounds;
+};
+
+void Model::processNode(aiNode* node, const glm::mat4& parentTransform, std::vector<std::pair<unsigned int, glm::mat4>>& nodeMeshes) {
+
+	// assimp matrices are row major
+	glm::mat4 transform = parentTransform * glm::transpose(glm::make_mat4(&node->mTransformation.a1));
 
 	for (unsigned int i = 0; i < node->mNumMeshes; i++) {
 
-		aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
-		meshes.push_back(processMesh(mesh, scene));
+		nodeMeshes.push_back(std::make_pair(node->mMeshes[i], transform));
 
 	}
 
 	for (unsigned int i = 0; i < node->mNumChildren; i++) {
 	
-		processNode(node->mChildren[i], scene);
+		processNode(node->mChildren[i], transform, nodeMeshes);
 	
 	}
 
 };
 
-Mesh Model::processMesh(aiMesh* mesh, const aiScene* scene) {
+MeshData Model::processMesh(const aiMesh* mesh, bool computeHash) {
 
-	std::vector<Vertex> vertices;
-	std::vector<unsigned int> indices;
-	std::vector<Texture> textures;
+	MeshData data;
+	std::vector<Vertex>& vertices = data.vertices;
+	std::vector<unsigned int>& indices = data.indices;
 
+	vertices.resize(mesh->mNumVertices);
 	for (unsigned int i = 0; i < mesh->mNumVertices; i++) {
 	
-		Vertex vertex;
+		Vertex& vertex = vertices[i];
 
 		glm::vec3 vector;
 		vector.x = mesh->mVertices[i].x;
@@ -75,105 +597,75 @@ Mesh Model::processMesh(aiMesh* mesh, const aiScene* scene) {
 		}
 		else
 			vertex.TexCoords = glm::vec2(0.0f, 0.0f);
-		vertices.push_back(vertex);
 	}
 
+	// aiProcess_Triangulate leaves (almost) only triangles
+	indices.reserve(static_cast<size_t>(mesh->mNumFaces) * 3);
 	for (unsigned int i = 0; i < mesh->mNumFaces; i++) {
 	
-		aiFace face = mesh->mFaces[i];
+		const aiFace& face = mesh->mFaces[i];
 		for (unsigned int j = 0; j < face.mNumIndices; j++)
 			indices.push_back(face.mIndices[j]);
 
 	}
 
-	if (mesh->mMaterialIndex >= 0) {
-	
-		aiMaterial* material = scene->mMaterials[mesh->mMaterialIndex];
-
-		std::vector<Texture> diffuseMaps = loadMaterialTextures(material, aiTextureType_DIFFUSE, "texture_diffuse");
-		textures.insert(textures.end(), diffuseMaps.begin(), diffuseMaps.end());
-
-		std::vector<Texture> specularMaps = loadMaterialTextures(material, aiTextureType_SPECULAR, "texture_specular");
-		textures.insert(textures.end(), specularMaps.begin(), specularMaps.end());
-
-	}
+	if (!computeHash)
+		return data;
 
+	// FNV-1a, only used to find candidates for geometry sharing
+	unsigned long long hash = 14695981039346656037ull;
+	auto mix = [&hash](const void* bytes, size_t size) {
+		const unsigned char* p = static_cast<const unsigned char*>(bytes);
+		for (size_t i = 0; i < size; i++) {
+			hash ^= p[i];
+			hash *= 1099511628211ull;
+		}
+	};
+	mix(vertices.data(), vertices.size() * sizeof(Vertex));
+	mix(indices.data(), indices.size() * sizeof(unsigned int));
+	mix(&mesh->mMaterialIndex, sizeof(mesh->mMaterialIndex));
+	data.hash = hash;
 
-	return Mesh(vertices, indices, textures);
+	return data;
 
 };
 
-
-std::vector<Texture> Model::loadMaterialTextures(aiMaterial* mat, aiTextureType type,
-	std::string typeName)
-{
-	std::vector<Texture> textures;
-	for (unsigned int i = 0; i < mat->GetTextureCount(type); i++)
-	{
-		aiString str;
-		mat->GetTexture(type, i, &str);
-		bool skip = false;
-
-		for (unsigned int j = 0; j < textures_loaded.size(); j++) {
-
-			if (std::strcmp(textures_loaded[j].path.data(), str.C_Str()) == 0)
-			{
-				textures.push_back(textures_loaded[j]);
-				skip = true;
+MaterialDescription Model::describeMaterial(const aiMaterial* material) {
+
+	MaterialDescription description;
+	aiString str;
+	if (material->Get(AI_MATKEY_NAME, str) == AI_SUCCESS)
+		description.name = str.C_Str();
+
+	// first texture of each kind, OBJ map_Pr and map_ao arrive as DIFFUSE_ROUGHNESS and AMBIENT_OCCLUSION
+	static const aiTextureType types[MATERIAL_UNIT_COUNT][2] = {
+		{ aiTextureType_DIFFUSE, aiTextureType_BASE_COLOR },
+		{ aiTextureType_SPECULAR, aiTextureType_SPECULAR },
+		{ aiTextureType_DIFFUSE_ROUGHNESS, aiTextureType_DIFFUSE_ROUGHNESS },
+		{ aiTextureType_AMBIENT_OCCLUSION, aiTextureType_LIGHTMAP }
+	};
+	for (unsigned int unit = 0; unit < MATERIAL_UNIT_COUNT; unit++) {
+		for (aiTextureType type : types[unit]) {
+			if (material->GetTextureCount(type) > 0 && material->GetTexture(type, 0, &str) == AI_SUCCESS) {
+				description.maps[unit] = str.C_Str();
 				break;
 			}
 		}
-		if (!skip) {
-		
-			Texture texture;
-			texture.id = TextureFromFile(str.C_Str(), directory);
-			texture.type = typeName;
-			texture.path = str.C_Str();
-			textures.push_back(texture);
-			textures_loaded.push_back(texture);
-		
-		}
-	
 	}
-	return textures;
-};
 
-unsigned int Model::TextureFromFile(const char* path, const std::string& directory)
-{
-	std::string filename = std::string(path);
-	filename = directory + '/' + filename;
+	aiColor3D color;
+	float value;
+	if (material->Get(AI_MATKEY_COLOR_DIFFUSE, color) == AI_SUCCESS)
+		description.data.diffuseColor = glm::vec4(color.r, color.g, color.b, description.data.diffuseColor.a);
+	if (material->Get(AI_MATKEY_OPACITY, value) == AI_SUCCESS)
+		description.data.diffuseColor.a = value;
+	if (material->Get(AI_MATKEY_COLOR_SPECULAR, color) == AI_SUCCESS)
+		description.data.specularColor = glm::vec4(color.r, color.g, color.b, 1.0f);
+	if (material->Get(AI_MATKEY_SHININESS, value) == AI_SUCCESS)
+		description.data.shininess = value;
+	if (material->Get(AI_MATKEY_ROUGHNESS_FACTOR, value) == AI_SUCCESS)
+		description.data.roughness = value;
+
+	return description;
 
-	unsigned int textureID;
-	glGenTextures(1, &textureID);
-
-	int width, height, nrComponents;
-	unsigned char* data = stbi_load(filename.c_str(), &width, &height, &nrComponents, 0);
-	if (data)
-	{
-		GLenum format;
-		if (nrComponents == 1)
-			format = GL_RED;
-		else if (nrComponents == 3)
-			format = GL_RGB;
-		else if (nrComponents == 4)
-			format = GL_RGBA;
-
-		glBindTexture(GL_TEXTURE_2D, textureID);
-		glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-		glGenerateMipmap(GL_TEXTURE_2D);
-
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-		stbi_image_free(data);
-	}
-	else
-	{
-		std::cout << "Texture failed to load at path: " << path << std::endl;
-		stbi_image_free(data);
-	}
-
-	return textureID;
-}
\ No newline at end of file
+};
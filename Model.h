@@ -5,43 +5,212 @@
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
 #include <stb/stb_image.h>
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
 
 #include "Mesh.h"
+#include "FrustumCuller.h"
+#include "OcclusionCuller.h"
+#include "Bvh.h"
+#include "TriangleBvh.h"
+#include "Material.h"
 #include "Shader.h"
+#include "ShaderVariants.h"
+#include "RenderQueue.h"
+#include "ThreadPool.h"
+#include "TextureCache.h"
 
 #include <string>
+#include <cstring>
 #include <fstream>
 #include <sstream>
 #include <iostream>
 //#include <map>
 #include <vector>
+#include <memory>
+#include <atomic>
+#include <chrono>
+
+class StaticBatch;
+
+// CPU side result of converting one aiMesh, filled on the worker threads before any GL object exists
+struct MeshData {
+	std::vector<Vertex> vertices;
+	std::vector<unsigned int> indices;
+	unsigned long long hash = 0; // FNV-1a over vertices, indices and material
+};
+
+// one placement of a unique mesh in the node hierarchy
+struct MeshInstance {
+	unsigned int mesh;   // index into Model::meshes
+	glm::mat4 transform; // accumulated aiNode::mTransformation
+};
+
+// nearest triangle under a ray (Model::pick)
+struct PickHit {
+	size_t instance = 0;       // index into Model::instances
+	unsigned int mesh = 0;     // index into Model::meshes
+	uint32_t triangle = 0;     // index / 3 into the mesh's indices
+	glm::vec2 barycentric;     // weights of the triangle's second and third corner
+	glm::vec3 point;           // in model space
+	float t = 0.0f;            // along the ray, in units of its direction
+};
+
+// everything Model needs from a file, gathered without any GL call so it can run on a loader thread
+struct ModelImport {
+	std::string directory;
+	std::vector<MeshData> meshes;          // one per referenced aiMesh, in first-reference order
+	std::vector<unsigned int> materialOfMesh;
+	std::vector<MaterialDescription> materials;
+	std::vector<std::pair<unsigned int, glm::mat4>> nodeMeshes; // (index into meshes, node world transform)
+	double milliseconds = 0.0;             // import + conversion time
+};
+
+struct ModelOptions {
+	GeometryResidency residency = GeometryResidency::Full;
+	bool dedupGeometry = false; // also share meshes whose geometry and material are identical
+	bool lazyLoad = false;      // only load a mesh (and its textures) once its bounds become visible
+	unsigned int lazyUploadsPerFrame = 2;
+	bool positionStream = false; // welded position-only copy of every mesh for depth passes (Mesh::DrawPositions)
+};
 
 class Model {
 
 public: 
 
-	std::vector<Texture> textures_loaded;
-	std::vector<Mesh> meshes;
+	MaterialLibrary materials;         // shared by index between the meshes
+	std::vector<Mesh> meshes;          // unique meshes, each drawn once for all of its instances
+	std::vector<MeshInstance> instances;
 	std::string directory;
-	Model(const char* path)
+	std::vector<AABB> instanceBounds;  // per instance, in model space
+	GeometryResidency residency;
+	bool dedupGeometry;
+	bool lazyLoad;
+	unsigned int lazyUploadsPerFrame;
+	bool positionStream;
+	bool frustumCulling = true;        // submit() skips meshes with no instance inside the frustum
+	OcclusionCuller* occlusionCuller = nullptr; // when set, submit() also skips meshes whose instances are all hidden in it
+	const StaticBatch* staticBatch = nullptr;   // when set, submit() skips the meshes merged into it
+
+	Model(const char* path, GeometryResidency residency = GeometryResidency::Full)
+		: Model(path, ModelOptions{ residency })
+	{
+	};
+	Model(const char* path, const ModelOptions& options)
+		: residency(options.residency), dedupGeometry(options.dedupGeometry && !options.lazyLoad),
+		lazyLoad(options.lazyLoad), lazyUploadsPerFrame(options.lazyUploadsPerFrame), positionStream(options.positionStream),
+		ownTextures(new TextureCache()), textureCache(ownTextures.get())
 	{
 		loadModel(path);
-		std::cout << "Loaded meshes: " << meshes.size() << std::endl;
+		printStats();
 	};
+	// GL side of a load whose CPU work already happened elsewhere (see SceneLoader), lazyLoad is ignored
+	Model(ModelImport& data, const ModelOptions& options, TextureCache& textures)
+		: residency(options.residency), dedupGeometry(options.dedupGeometry),
+		lazyLoad(false), lazyUploadsPerFrame(options.lazyUploadsPerFrame), positionStream(options.positionStream),
+		textureCache(&textures)
+	{
+		build(data);
+		printStats();
+	};
+	~Model();
+	Model(const Model&) = delete;
+	Model& operator=(const Model&) = delete;
+
+	// lazy mode: requests meshes whose bounds pass the frustum of projection * view * model
+	// and uploads the ones that finished converting, call once per frame before Draw
+	void updateVisibility(const glm::mat4& modelViewProjection);
 	void Draw(Shader& shader);
+	// every mesh with the variant matching its material's features (materialFeatureNames())
+	void Draw(ShaderVariants& shaders);
+
+	// count copies of the whole model with one draw per mesh. transforms place each copy in the space of
+	// the bound DrawData (identity model for world space), colors tint and ids tag it (both optional).
+	void DrawInstanced(ShaderVariants& shaders, const glm::mat4* transforms, size_t count,
+		const glm::vec4* colors = nullptr, const unsigned int* ids = nullptr);
+
+	// one packet per loaded mesh with an instance inside the frustum of draw.modelViewProjection
+	// (and the placeholders), drawn with draw's matrices
+	void submit(RenderQueue& queue, ShaderVariants& shaders, const DrawData& draw);
+	// instances tested and visible in the last submit
+	const FrustumCuller::Stats& cullStats() const { return lastCull; }
+
+	// instances from this many on are culled through instanceHierarchy() instead of one by one
+	static const size_t HIERARCHY_THRESHOLD = 4096;
+	// over instanceBounds, in model space
+	const Bvh& instanceHierarchy() const { return instanceBvh; }
+	// around every instance in model space, the root of instanceHierarchy() (SceneHierarchy places it)
+	const AABB& bounds() const { return rootBounds; }
+	// instances whose bounds overlap a model space box
+	void queryInstances(const AABB& range, std::vector<uint32_t>& out) const { instanceBvh.query(range, out); }
+	// moves one instance; bounds, hierarchy and the GPU copy of the transforms follow at refitInstances()
+	void setInstanceTransform(size_t instance, const glm::mat4& transform);
+	void refitInstances();
+
+	// nearest triangle hit by a model space ray, through instanceHierarchy() and a triangle hierarchy
+	// per mesh. Those are built on the first pick that reaches a mesh, GpuOnly meshes read their
+	// geometry back for it; meshes a lazy model has not loaded yet are skipped.
+	bool pick(const Ray& ray, PickHit& hit);
+
+	// queues the count largest instances (by bounds) as occluders, placed by model. Only opaque meshes
+	// with at most maxTriangles triangles and a CPU copy of their positions (not GpuOnly, loaded)
+	// qualify, a translucent one would hide what shows through it.
+	void addOccluders(OcclusionCuller& culler, const glm::mat4& model, size_t count, size_t maxTriangles = 4096);
+
+	// bytes of mesh geometry kept in system memory under the current residency policy
+	size_t residentBytes() const;
+
+	// converts vertices and indices only, safe to call from any thread
+	static MeshData processMesh(const aiMesh* mesh, bool computeHash = false);
+
+	// reads and converts a whole file without touching GL, the importer's scene is freed afterwards
+	static bool importFile(Assimp::Importer& importer, const std::string& path, bool computeHash, ModelImport& out);
 
 private:
 
+	enum LazyMeshState { LazyNotRequested, LazyConverting, LazyConverted, LazyUploaded };
+
+	// lazy mode keeps the imported scene until every mesh has been uploaded
+	struct LazyState {
+		std::unique_ptr<Assimp::Importer> importer;
+		const aiScene* scene = nullptr;
+		std::vector<unsigned int> sourceOfMesh; // aiMesh index for each entry of meshes
+		std::vector<MeshData> data;
+		std::unique_ptr<std::atomic<int>[]> state;
+		size_t remaining = 0;
+	};
+	std::unique_ptr<LazyState> lazy;
+	std::unique_ptr<Mesh> placeholder; // unit cube drawn at the bounds of meshes that are not loaded yet
+	std::vector<AABB> meshInstanceBounds; // per mesh, around all of its instances (sort depth)
+	FrustumCuller instanceCuller;         // instanceBounds and spheres in model space, in instance order
+	Bvh instanceBvh;
+	AABB rootBounds;
+	std::vector<unsigned char> instanceVisible, meshVisible;
+	FrustumCuller::Stats lastCull;
+	std::vector<uint32_t> instanceSlot;   // position of each instance in its mesh's instanceTransforms
+	std::vector<unsigned char> movedMeshes;
+	std::vector<uint32_t> occluderOrder;  // instances by decreasing bounds, built by addOccluders()
+	std::vector<std::unique_ptr<TriangleBvh>> triangleHierarchies; // per mesh, in mesh space, built by pick()
+	std::unique_ptr<InstanceStream> instanceStream; // DrawInstanced's per-copy attributes
+
+	std::unique_ptr<TextureCache> ownTextures; // used when the model is not loaded through a SceneLoader
+	TextureCache* textureCache;
+
+	void requestMesh(unsigned int mesh);
+	void updatePlaceholders();
+	const TriangleBvh* triangleHierarchy(unsigned int mesh);
+	static AABB meshBounds(const aiMesh* mesh);
 
 	void loadModel(std::string path);
-	void processNode(aiNode* node, const aiScene* scene);
-	Mesh processMesh(aiMesh* mesh, const aiScene* scene);
-	std::vector<Texture> loadMaterialTextures(aiMaterial* mat, aiTextureType type, std::string typeName);
-	unsigned int TextureFromFile(const char* path, const std::string& directory);
+	void build(ModelImport& data);
+	void buildInstances(const std::vector<std::pair<unsigned int, glm::mat4>>& nodeMeshes, const std::vector<unsigned int>& meshOfSlot);
+	void printStats() const;
+	static void collectMeshes(const aiScene* scene, std::vector<unsigned int>& sourceMeshes, std::vector<std::pair<unsigned int, glm::mat4>>& nodeMeshes);
+	static void processNode(aiNode* node, const glm::mat4& parentTransform, std::vector<std::pair<unsigned int, glm::mat4>>& nodeMeshes);
+	static MaterialDescription describeMaterial(const aiMaterial* material);
 };
 
 
@@ -0,0 +1,384 @@
+#include "OcclusionCuller.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define OCCLUSIONCULLER_SSE2
+#endif
+
+namespace {
+
+	typedef std::chrono::high_resolution_clock Clock;
+
+	double millisecondsSince(Clock::time_point start) {
+		return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+	}
+
+	const uint32_t FULL_COVERAGE = 0xFFFFFFFFu;
+
+	// triangle depths are pulled back by this factor, so rounding in the depth plane cannot let an
+	// occluder hide the box around itself
+	const float DEPTH_BIAS = 0.9999f;
+
+}
+
+OcclusionCuller::OcclusionCuller(unsigned int width, unsigned int height) {
+	resize(width, height);
+}
+
+void OcclusionCuller::resize(unsigned int width, unsigned int height) {
+	tilesX = std::max(1u, (width + TILE_WIDTH - 1) / TILE_WIDTH);
+	tilesY = std::max(1u, (height + TILE_HEIGHT - 1) / TILE_HEIGHT);
+	backLayer.assign(tilesX * tilesY, 0.0f);
+	workingLayer.assign(tilesX * tilesY, 0.0f);
+	coverage.assign(tilesX * tilesY, 0);
+}
+
+const char* OcclusionCuller::instructionSet() {
+#if defined(OCCLUSIONCULLER_SSE2)
+	return "SSE2";
+#else
+	return "scalar";
+#endif
+}
+
+void OcclusionCuller::begin(const glm::mat4& matrix) {
+	viewProjection = matrix;
+	std::fill(backLayer.begin(), backLayer.end(), 0.0f);
+	std::fill(workingLayer.begin(), workingLayer.end(), 0.0f);
+	std::fill(coverage.begin(), coverage.end(), 0);
+	occluders.clear();
+	lastStats = Stats();
+}
+
+void OcclusionCuller::addOccluder(const glm::vec3* positions, size_t stride, const unsigned int* indices, size_t indexCount,
+	const glm::mat4& transform) {
+	if (indexCount < 3) return;
+	occluders.push_back({ reinterpret_cast<const unsigned char*>(positions), stride, indices, indexCount, transform });
+	lastStats.occluders++;
+	lastStats.triangles += indexCount / 3;
+}
+
+void OcclusionCuller::addOccluder(const std::vector<glm::vec3>& positions, const std::vector<unsigned int>& indices,
+	const glm::mat4& transform) {
+	if (positions.empty()) return;
+	addOccluder(positions.data(), sizeof(glm::vec3), indices.data(), indices.size(), transform);
+}
+
+void OcclusionCuller::rasterize() {
+
+	Clock::time_point start = Clock::now();
+	ThreadPool& pool = ThreadPool::shared();
+
+	// transform, clip and set up each occluder on its own, then keep the submission order
+	std::vector<std::vector<Triangle>> perOccluder(occluders.size());
+	pool.parallelFor(occluders.size(), [&](size_t i) {
+		setup(occluders[i], perOccluder[i]);
+	});
+	triangles.clear();
+	for (const std::vector<Triangle>& list : perOccluder)
+		triangles.insert(triangles.end(), list.begin(), list.end());
+	occluders.clear();
+
+	// bands of tile rows never share a tile, so they are filled side by side without locking
+	unsigned int bands = (tilesY + BAND_ROWS - 1) / BAND_ROWS;
+	pool.parallelFor(bands, [&](size_t band) {
+		unsigned int first = static_cast<unsigned int>(band) * BAND_ROWS;
+		rasterizeBand(first, std::min(tilesY, first + BAND_ROWS));
+	});
+
+	lastStats.rasterized += triangles.size();
+	lastStats.rasterMs += millisecondsSince(start);
+}
+
+void OcclusionCuller::setup(const Occluder& occluder, std::vector<Triangle>& out) const {
+
+	glm::mat4 matrix = viewProjection * occluder.transform;
+	out.reserve(occluder.indexCount / 3);
+	for (size_t i = 0; i + 2 < occluder.indexCount; i += 3) {
+		glm::vec4 clip[3];
+		for (int corner = 0; corner < 3; corner++) {
+			const glm::vec3& position = *reinterpret_cast<const glm::vec3*>(occluder.positions + occluder.indices[i + corner] * occluder.stride);
+			clip[corner] = matrix * glm::vec4(position, 1.0f);
+		}
+
+		// clip against the near plane (z >= -w), which leaves a triangle or a quad
+		glm::vec4 polygon[4];
+		int count = 0;
+		for (int corner = 0; corner < 3; corner++) {
+			const glm::vec4& a = clip[corner];
+			const glm::vec4& b = clip[(corner + 1) % 3];
+			float distanceA = a.z + a.w, distanceB = b.z + b.w;
+			if (distanceA >= 0.0f) polygon[count++] = a;
+			// always from the inside end, so the neighbour across this edge gets the same point
+			if (distanceA >= 0.0f && distanceB < 0.0f)
+				polygon[count++] = a + (b - a) * (distanceA / (distanceA - distanceB));
+			else if (distanceA < 0.0f && distanceB >= 0.0f)
+				polygon[count++] = b + (a - b) * (distanceB / (distanceB - distanceA));
+		}
+		for (int fan = 1; fan + 1 < count; fan++) {
+			glm::vec4 corners[3] = { polygon[0], polygon[fan], polygon[fan + 1] };
+			addTriangle(corners, out);
+		}
+	}
+}
+
+void OcclusionCuller::addTriangle(const glm::vec4* clip, std::vector<Triangle>& out) const {
+
+	float width = static_cast<float>(this->width()), height = static_cast<float>(this->height());
+	float x[3], y[3], depth[3];
+	for (int i = 0; i < 3; i++) {
+		if (clip[i].w <= 0.0f) return;
+		depth[i] = 1.0f / clip[i].w;
+		x[i] = (clip[i].x * depth[i] * 0.5f + 0.5f) * width;
+		y[i] = (clip[i].y * depth[i] * 0.5f + 0.5f) * height;
+	}
+
+	// both windings are occluders, make it counterclockwise
+	float area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+	if (std::abs(area) < 1e-6f) return;
+	if (area < 0.0f) {
+		std::swap(x[1], x[2]);
+		std::swap(y[1], y[2]);
+		std::swap(depth[1], depth[2]);
+		area = -area;
+	}
+
+	Triangle triangle;
+	// pixel centers sit at + 0.5
+	triangle.minX = std::max(0, static_cast<int>(std::ceil(std::min(std::min(x[0], x[1]), x[2]) - 0.5f)));
+	triangle.minY = std::max(0, static_cast<int>(std::ceil(std::min(std::min(y[0], y[1]), y[2]) - 0.5f)));
+	triangle.maxX = std::min(static_cast<int>(width) - 1, static_cast<int>(std::floor(std::max(std::max(x[0], x[1]), x[2]) - 0.5f)));
+	triangle.maxY = std::min(static_cast<int>(height) - 1, static_cast<int>(std::floor(std::max(std::max(y[0], y[1]), y[2]) - 0.5f)));
+	if (triangle.minX > triangle.maxX || triangle.minY > triangle.maxY) return;
+
+	for (int edge = 0; edge < 3; edge++) {
+		int from = edge, to = (edge + 1) % 3;
+		float sign = 1.0f;
+		if (x[to] < x[from] || (x[to] == x[from] && y[to] < y[from])) {
+			std::swap(from, to);
+			sign = -1.0f;
+		}
+		triangle.edgeX[edge] = x[from];
+		triangle.edgeY[edge] = y[from];
+		triangle.edgeDX[edge] = x[to] - x[from];
+		triangle.edgeDY[edge] = y[to] - y[from];
+		triangle.edgeSign[edge] = sign;
+	}
+	triangle.depthA = ((depth[1] - depth[0]) * (y[2] - y[0]) - (depth[2] - depth[0]) * (y[1] - y[0])) / area;
+	triangle.depthB = ((depth[2] - depth[0]) * (x[1] - x[0]) - (depth[1] - depth[0]) * (x[2] - x[0])) / area;
+	triangle.depthC = depth[0] - triangle.depthA * x[0] - triangle.depthB * y[0];
+	triangle.farthest = std::min(std::min(depth[0], depth[1]), depth[2]);
+	out.push_back(triangle);
+}
+
+void OcclusionCuller::rasterizeBand(unsigned int firstRow, unsigned int endRow) {
+
+	int bandMinY = static_cast<int>(firstRow * TILE_HEIGHT);
+	int bandMaxY = static_cast<int>(endRow * TILE_HEIGHT) - 1;
+	for (const Triangle& triangle : triangles) {
+		if (triangle.maxY < bandMinY || triangle.minY > bandMaxY) continue;
+
+		unsigned int tileMinX = triangle.minX / TILE_WIDTH, tileMaxX = triangle.maxX / TILE_WIDTH;
+		unsigned int tileMinY = std::max<unsigned int>(firstRow, triangle.minY / TILE_HEIGHT);
+		unsigned int tileMaxY = std::min<unsigned int>(endRow - 1, triangle.maxY / TILE_HEIGHT);
+
+#ifdef OCCLUSIONCULLER_SSE2
+		const __m128 laneOffset = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+		const __m128 zero = _mm_setzero_ps();
+		__m128 edgeX[3], edgeDY[3], edgeSign[3];
+		for (int edge = 0; edge < 3; edge++) {
+			edgeX[edge] = _mm_set1_ps(triangle.edgeX[edge]);
+			edgeDY[edge] = _mm_set1_ps(triangle.edgeDY[edge]);
+			edgeSign[edge] = _mm_set1_ps(triangle.edgeSign[edge]);
+		}
+#endif
+
+		for (unsigned int tileY = tileMinY; tileY <= tileMaxY; tileY++) {
+			for (unsigned int tileX = tileMinX; tileX <= tileMaxX; tileX++) {
+				int pixelX = static_cast<int>(tileX * TILE_WIDTH), pixelY = static_cast<int>(tileY * TILE_HEIGHT);
+
+				// coverage of the 32 pixel centers, row by row
+				uint32_t mask = 0;
+#ifdef OCCLUSIONCULLER_SSE2
+				// dy * (x - x0) once per tile, dx * (y - y0) once per row, both computed the same way for
+				// every triangle on the edge
+				__m128 left = _mm_add_ps(_mm_set1_ps(static_cast<float>(pixelX)), laneOffset);
+				__m128 right = _mm_add_ps(left, _mm_set1_ps(4.0f));
+				__m128 columnLeft[3], columnRight[3];
+				for (int edge = 0; edge < 3; edge++) {
+					columnLeft[edge] = _mm_mul_ps(edgeDY[edge], _mm_sub_ps(left, edgeX[edge]));
+					columnRight[edge] = _mm_mul_ps(edgeDY[edge], _mm_sub_ps(right, edgeX[edge]));
+				}
+				for (unsigned int row = 0; row < TILE_HEIGHT; row++) {
+					float y = pixelY + row + 0.5f;
+					__m128 insideLeft = _mm_castsi128_ps(_mm_set1_epi32(-1)), insideRight = insideLeft;
+					for (int edge = 0; edge < 3; edge++) {
+						__m128 rowTerm = _mm_set1_ps(triangle.edgeDX[edge] * (y - triangle.edgeY[edge]));
+						insideLeft = _mm_and_ps(insideLeft, _mm_cmpge_ps(_mm_mul_ps(edgeSign[edge], _mm_sub_ps(rowTerm, columnLeft[edge])), zero));
+						insideRight = _mm_and_ps(insideRight, _mm_cmpge_ps(_mm_mul_ps(edgeSign[edge], _mm_sub_ps(rowTerm, columnRight[edge])), zero));
+					}
+					uint32_t bits = static_cast<uint32_t>(_mm_movemask_ps(insideLeft) | (_mm_movemask_ps(insideRight) << 4));
+					mask |= bits << (row * TILE_WIDTH);
+				}
+#else
+				for (unsigned int row = 0; row < TILE_HEIGHT; row++) {
+					float y = pixelY + row + 0.5f;
+					for (unsigned int column = 0; column < TILE_WIDTH; column++) {
+						float x = pixelX + column + 0.5f;
+						bool inside = true;
+						for (int edge = 0; edge < 3; edge++) {
+							float rowTerm = triangle.edgeDX[edge] * (y - triangle.edgeY[edge]);
+							float columnTerm = triangle.edgeDY[edge] * (x - triangle.edgeX[edge]);
+							inside = inside && triangle.edgeSign[edge] * (rowTerm - columnTerm) >= 0.0f;
+						}
+						if (inside) mask |= 1u << (row * TILE_WIDTH + column);
+					}
+				}
+#endif
+				if (mask == 0) continue;
+
+				// farthest point of the depth plane over the covered part of the tile, a plane's
+				// minimum over a rectangle is at one of its corners
+				float x0 = std::max(pixelX, triangle.minX) + 0.5f;
+				float x1 = std::min(pixelX + static_cast<int>(TILE_WIDTH) - 1, triangle.maxX) + 0.5f;
+				float y0 = std::max(pixelY, triangle.minY) + 0.5f;
+				float y1 = std::min(pixelY + static_cast<int>(TILE_HEIGHT) - 1, triangle.maxY) + 0.5f;
+				float planeDepth = triangle.depthC + std::min(triangle.depthA * x0, triangle.depthA * x1)
+					+ std::min(triangle.depthB * y0, triangle.depthB * y1);
+				merge(tileY * tilesX + tileX, mask, std::max(triangle.farthest, planeDepth) * DEPTH_BIAS);
+			}
+		}
+	}
+}
+
+void OcclusionCuller::merge(size_t tile, uint32_t mask, float depth) {
+
+	// behind what already covers the whole tile, nothing to add
+	if (depth <= backLayer[tile]) return;
+
+	// a triangle much nearer than the working layer would only be dragged back by it, it starts the
+	// working layer over instead
+	if (coverage[tile] == 0 || depth - workingLayer[tile] > workingLayer[tile] - backLayer[tile]) {
+		workingLayer[tile] = depth;
+		coverage[tile] = mask;
+	}
+	else {
+		workingLayer[tile] = std::min(workingLayer[tile], depth);
+		coverage[tile] |= mask;
+	}
+
+	if (coverage[tile] == FULL_COVERAGE) {
+		backLayer[tile] = workingLayer[tile];
+		coverage[tile] = 0;
+	}
+}
+
+bool OcclusionCuller::test(const AABB& box, const glm::mat4& modelViewProjection) const {
+
+	if (!box.valid()) return true;
+
+	// screen rectangle and nearest depth of the eight corners, boxes through the near plane are visible.
+	// The corners are the min corner plus any of the three scaled matrix columns.
+	glm::vec3 size = box.max - box.min;
+	glm::vec4 base = modelViewProjection * glm::vec4(box.min, 1.0f);
+	glm::vec4 axes[3] = { modelViewProjection[0] * size.x, modelViewProjection[1] * size.y, modelViewProjection[2] * size.z };
+	float minX = FLT_MAX, minY = FLT_MAX, maxX = -FLT_MAX, maxY = -FLT_MAX, nearest = 0.0f;
+	for (int corner = 0; corner < 8; corner++) {
+		glm::vec4 clip = base;
+		if (corner & 1) clip += axes[0];
+		if (corner & 2) clip += axes[1];
+		if (corner & 4) clip += axes[2];
+		if (clip.z < -clip.w || clip.w <= 0.0f) return true;
+		float depth = 1.0f / clip.w;
+		float x = (clip.x * depth * 0.5f + 0.5f) * width();
+		float y = (clip.y * depth * 0.5f + 0.5f) * height();
+		minX = std::min(minX, x);
+		maxX = std::max(maxX, x);
+		minY = std::min(minY, y);
+		maxY = std::max(maxY, y);
+		nearest = std::max(nearest, depth);
+	}
+
+	// every pixel the rectangle touches, off screen is left to frustum culling
+	int pixelMinX = std::max(0, static_cast<int>(std::floor(minX)));
+	int pixelMinY = std::max(0, static_cast<int>(std::floor(minY)));
+	int pixelMaxX = std::min(static_cast<int>(width()) - 1, static_cast<int>(std::floor(maxX)));
+	int pixelMaxY = std::min(static_cast<int>(height()) - 1, static_cast<int>(std::floor(maxY)));
+	if (pixelMinX > pixelMaxX || pixelMinY > pixelMaxY) return true;
+
+	unsigned int tileMinX = pixelMinX / TILE_WIDTH, tileMaxX = pixelMaxX / TILE_WIDTH;
+	unsigned int tileMinY = pixelMinY / TILE_HEIGHT, tileMaxY = pixelMaxY / TILE_HEIGHT;
+#ifdef OCCLUSIONCULLER_SSE2
+	__m128 nearest4 = _mm_set1_ps(nearest);
+#endif
+	for (unsigned int tileY = tileMinY; tileY <= tileMaxY; tileY++) {
+		const float* row = backLayer.data() + tileY * tilesX;
+		unsigned int tileX = tileMinX;
+#ifdef OCCLUSIONCULLER_SSE2
+		for (; tileX + 4 <= tileMaxX + 1; tileX += 4)
+			if (_mm_movemask_ps(_mm_cmpge_ps(nearest4, _mm_loadu_ps(row + tileX))))
+				return true;
+#endif
+		for (; tileX <= tileMaxX; tileX++)
+			if (nearest >= row[tileX])
+				return true;
+	}
+	return false;
+}
+
+bool OcclusionCuller::visible(const AABB& box, const glm::mat4& model) {
+
+	Clock::time_point start = Clock::now();
+	bool result = test(box, viewProjection * model);
+	lastStats.tested++;
+	lastStats.occluded += result ? 0 : 1;
+	lastStats.testMs += millisecondsSince(start);
+	return result;
+}
+
+size_t OcclusionCuller::cull(const AABB* boxes, size_t count, const glm::mat4& model, std::vector<unsigned char>& visible) {
+
+	Clock::time_point start = Clock::now();
+	glm::mat4 modelViewProjection = viewProjection * model;
+	visible.resize(count, 1);
+
+	auto cullRange = [&](size_t first, size_t end, size_t& tested) {
+		size_t occluded = 0;
+		for (size_t i = first; i < end; i++) {
+			if (!visible[i]) continue;
+			tested++;
+			if (!test(boxes[i], modelViewProjection)) {
+				visible[i] = 0;
+				occluded++;
+			}
+		}
+		return occluded;
+	};
+
+	size_t tested = 0, occluded = 0;
+	size_t blocks = (count + BLOCK_SIZE - 1) / BLOCK_SIZE;
+	if (count < parallelThreshold || blocks < 2) {
+		occluded = cullRange(0, count, tested);
+	}
+	else {
+		std::vector<size_t> blockTested(blocks, 0), blockOccluded(blocks, 0);
+		ThreadPool::shared().parallelFor(blocks, [&](size_t block) {
+			size_t first = block * BLOCK_SIZE;
+			blockOccluded[block] = cullRange(first, std::min(count, first + BLOCK_SIZE), blockTested[block]);
+		});
+		for (size_t block = 0; block < blocks; block++) {
+			tested += blockTested[block];
+			occluded += blockOccluded[block];
+		}
+	}
+
+	lastStats.tested += tested;
+	lastStats.occluded += occluded;
+	lastStats.testMs += millisecondsSince(start);
+	return occluded;
+}
@@ -0,0 +1,113 @@
+#ifndef OCCLUSIONCULLER_H
+#define OCCLUSIONCULLER_H
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "Frustum.h"
+
+// Software occlusion culling against a small masked depth buffer (masked occlusion culling). The
+// screen is split into tiles of 8x4 pixels that keep a 32-bit coverage mask and two conservative
+// depths instead of 32 depth values: every pixel of a tile is at least as near as its back layer,
+// the pixels in the mask also at least as near as its working layer, which becomes the back layer
+// once the mask is full. Occluder triangles are clipped and set up per occluder, then rasterized in
+// bands of tile rows on ThreadPool::shared(), four pixels per instruction with SSE2 (one at a time
+// elsewhere). A box is occluded when its nearest point is behind the back layer of every tile it
+// covers. Depths are 1 / w, larger is nearer. Nothing in here touches OpenGL.
+class OcclusionCuller {
+
+public:
+	static const unsigned int TILE_WIDTH = 8;
+	static const unsigned int TILE_HEIGHT = 4;
+	static const unsigned int BAND_ROWS = 4; // rows of tiles rasterized by one task
+	static const size_t BLOCK_SIZE = 4096;
+
+	struct Stats {
+		size_t occluders = 0;
+		size_t triangles = 0;  // occluder triangles queued
+		size_t rasterized = 0; // left after clipping and dropping the ones off screen or edge on
+		size_t tested = 0;
+		size_t occluded = 0;
+		double rasterMs = 0.0;
+		double testMs = 0.0;
+
+		double occludedPercent() const { return tested > 0 ? 100.0 * occluded / tested : 0.0; }
+	};
+
+	// boxes at or above this count are tested on the pool, 0 forces it, SIZE_MAX turns it off
+	size_t parallelThreshold = 16384;
+
+	// pixels, rounded up to whole tiles
+	OcclusionCuller(unsigned int width = 320, unsigned int height = 180);
+	void resize(unsigned int width, unsigned int height);
+	unsigned int width() const { return tilesX * TILE_WIDTH; }
+	unsigned int height() const { return tilesY * TILE_HEIGHT; }
+
+	// clears the buffer, the queue and the stats; occluders and tests until the next begin() are
+	// projected with viewProjection
+	void begin(const glm::mat4& viewProjection);
+	// queues a triangle list placed by transform. Positions are read stride bytes apart (a Vertex array
+	// works) and have to stay alive until rasterize().
+	void addOccluder(const glm::vec3* positions, size_t stride, const unsigned int* indices, size_t indexCount,
+		const glm::mat4& transform);
+	void addOccluder(const std::vector<glm::vec3>& positions, const std::vector<unsigned int>& indices, const glm::mat4& transform);
+	// draws the queued occluders into the buffer and empties the queue
+	void rasterize();
+
+	// false when the box, placed by model, is hidden behind what has been rasterized
+	bool visible(const AABB& box, const glm::mat4& model = glm::mat4(1.0f));
+	// clears visible[i] for the boxes that are occluded, the ones already at 0 are not tested.
+	// Returns how many were cleared.
+	size_t cull(const AABB* boxes, size_t count, const glm::mat4& model, std::vector<unsigned char>& visible);
+
+	// since begin()
+	const Stats& stats() const { return lastStats; }
+
+	// back layer of a tile, 0 (infinitely far) until it is fully covered
+	float tileDepth(unsigned int tileX, unsigned int tileY) const { return backLayer[tileY * tilesX + tileX]; }
+	unsigned int tileCountX() const { return tilesX; }
+	unsigned int tileCountY() const { return tilesY; }
+
+	// "SSE2" or "scalar", whatever the rasterizer and the tests were compiled with
+	static const char* instructionSet();
+
+private:
+	struct Occluder {
+		const unsigned char* positions;
+		size_t stride;
+		const unsigned int* indices;
+		size_t indexCount;
+		glm::mat4 transform;
+	};
+
+	// screen space, inside where sign * (dx * (y - y0) - dy * (x - x0)) >= 0 for all three edges. An edge
+	// is evaluated from the same end in both triangles that share it, only the sign differs, so the
+	// pixels on it are never missed by both.
+	struct Triangle {
+		float edgeX[3], edgeY[3];   // x0, y0
+		float edgeDX[3], edgeDY[3];
+		float edgeSign[3];
+		float depthA, depthB, depthC; // 1 / w = depthA * x + depthB * y + depthC
+		float farthest;               // smallest 1 / w of the corners
+		int minX, minY, maxX, maxY;   // pixels whose centers can be covered, inside the buffer
+	};
+
+	unsigned int tilesX = 0, tilesY = 0;
+	glm::mat4 viewProjection = glm::mat4(1.0f);
+	std::vector<float> backLayer, workingLayer;
+	std::vector<uint32_t> coverage; // pixels of the working layer, bit x + 8 * y
+	std::vector<Occluder> occluders;
+	std::vector<Triangle> triangles;
+	Stats lastStats;
+
+	void setup(const Occluder& occluder, std::vector<Triangle>& out) const;
+	void addTriangle(const glm::vec4* clip, std::vector<Triangle>& out) const;
+	void rasterizeBand(unsigned int firstRow, unsigned int endRow);
+	void merge(size_t tile, uint32_t mask, float depth);
+	bool test(const AABB& box, const glm::mat4& modelViewProjection) const;
+};
+
+#endif
@@ -0,0 +1,123 @@
+#include "ProgramCache.h"
+#include "GLExtensions.h"
+
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <vector>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+namespace {
+
+	const std::uint32_t CACHE_MAGIC = 0x31434250; // "PBC1"
+
+	struct CacheHeader {
+		std::uint32_t magic;
+		std::uint32_t binaryFormat;
+		std::uint32_t length;
+		std::uint32_t reserved;
+		double compileMs;
+	};
+
+	void mix(unsigned long long& hash, const std::string& text) {
+		for (unsigned char c : text) {
+			hash ^= c;
+			hash *= 1099511628211ull;
+		}
+		hash ^= 0xff; // separator so ("ab", "c") and ("a", "bc") differ
+		hash *= 1099511628211ull;
+	}
+
+	std::string entryPath(unsigned long long key) {
+		std::ostringstream path;
+		path << ProgramCache::directory << '/' << std::hex << std::setw(16) << std::setfill('0') << key << ".bin";
+		return path.str();
+	}
+
+	void makeDirectory(const std::string& path) {
+#ifdef _WIN32
+		_mkdir(path.c_str());
+#else
+		mkdir(path.c_str(), 0755);
+#endif
+	}
+
+}
+
+std::string ProgramCache::directory = "shader_cache";
+
+unsigned long long ProgramCache::key(const std::string& vertexSource, const std::string& fragmentSource, const std::string& defines) {
+
+	unsigned long long hash = 14695981039346656037ull;
+	mix(hash, vertexSource);
+	mix(hash, fragmentSource);
+	mix(hash, defines);
+	mix(hash, reinterpret_cast<const char*>(glGetString(GL_VENDOR)));
+	mix(hash, reinterpret_cast<const char*>(glGetString(GL_RENDERER)));
+	mix(hash, reinterpret_cast<const char*>(glGetString(GL_VERSION)));
+	return hash;
+}
+
+bool ProgramCache::load(unsigned long long key, GLuint program, double& compileMs) {
+
+	if (!GLExt::programBinary) return false;
+
+	std::ifstream file(entryPath(key), std::ios::binary);
+	if (!file) return false;
+
+	CacheHeader header;
+	if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) || header.magic != CACHE_MAGIC)
+		return false;
+
+	std::vector<char> binary(header.length);
+	if (!file.read(binary.data(), binary.size()))
+		return false;
+
+	GLExt::ProgramBinary(program, header.binaryFormat, binary.data(), static_cast<GLsizei>(binary.size()));
+
+	// drivers may reject binaries from another build even when the version string matches
+	GLint success = 0;
+	glGetProgramiv(program, GL_LINK_STATUS, &success);
+	if (!success) return false;
+
+	compileMs = header.compileMs;
+	return true;
+}
+
+void ProgramCache::store(unsigned long long key, GLuint program, double compileMs) {
+
+	if (!GLExt::programBinary) return;
+
+	GLint length = 0;
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0) return;
+
+	CacheHeader header;
+	header.magic = CACHE_MAGIC;
+	header.reserved = 0;
+	header.compileMs = compileMs;
+
+	std::vector<char> binary(length);
+	GLsizei written = 0;
+	GLenum format = 0;
+	GLExt::GetProgramBinary(program, length, &written, &format, binary.data());
+	if (written <= 0) return;
+	header.binaryFormat = format;
+	header.length = static_cast<std::uint32_t>(written);
+
+	makeDirectory(directory);
+	std::ofstream file(entryPath(key), std::ios::binary | std::ios::trunc);
+	if (!file) {
+		std::cout << "ERROR::PROGRAM_CACHE::CANNOT_WRITE " << entryPath(key) << std::endl;
+		return;
+	}
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	file.write(binary.data(), written);
+}
@@ -0,0 +1,25 @@
+#ifndef PROGRAMCACHE_H
+#define PROGRAMCACHE_H
+
+#include <glad/glad.h>
+
+#include <string>
+
+// On-disk cache of linked program binaries (glGetProgramBinary / glProgramBinary).
+// Entries are keyed by the shader sources, defines and the driver vendor/renderer/version string,
+// so a driver update or an edited shader simply misses and the program is compiled from source again.
+namespace ProgramCache {
+
+	extern std::string directory;
+
+	unsigned long long key(const std::string& vertexSource, const std::string& fragmentSource, const std::string& defines);
+
+	// link program from a cached binary, false on a miss or when the driver rejects the binary.
+	// compileMs is the source compile time recorded when the entry was stored.
+	bool load(unsigned long long key, GLuint program, double& compileMs);
+
+	void store(unsigned long long key, GLuint program, double compileMs);
+
+}
+
+#endif
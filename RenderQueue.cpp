@@ -0,0 +1,281 @@
+#include "RenderQueue.h"
+#include "IndirectRenderer.h"
+#include "StreamBuffer.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+
+namespace {
+
+	const unsigned int RADIX_BITS = 8;
+	const unsigned int BUCKETS = 1u << RADIX_BITS;
+	const size_t ITEMS_PER_THREAD = 4096; // below this the histogram setup costs more than it saves
+
+	uint64_t bits(uint64_t value, unsigned int count) {
+		return value & ((uint64_t(1) << count) - 1);
+	}
+
+	// positive floats order like their bit patterns, keep the top bits below the sign
+	uint64_t depthBits(float depth, unsigned int count) {
+		depth = std::max(depth, 0.0f);
+		uint32_t raw;
+		std::memcpy(&raw, &depth, sizeof(raw));
+		return raw >> (31 - count);
+	}
+
+	// translucent keys start with the depth, the state fields only break ties
+	bool isTranslucent(uint64_t key) {
+		return (key >> 61) & 1;
+	}
+
+}
+
+RenderQueue::RenderQueue()
+	: view(1.0f), prepassMode(DepthPrepass::Off)
+{
+	PipelineDesc opaque;
+	opaquePipeline = PipelineState::get(opaque);
+
+	PipelineDesc translucent;
+	translucent.blend = true;
+	translucent.depthWrite = false;
+	translucentPipeline = PipelineState::get(translucent);
+
+	PipelineDesc prepass;
+	prepass.colorWrite = false;
+	prepassPipeline = PipelineState::get(prepass);
+	setDepthPrepass(DepthPrepass::Off);
+}
+
+void RenderQueue::setDepthPrepass(DepthPrepass mode, GLenum colorDepthFunc) {
+
+	prepassMode = mode;
+	PipelineDesc afterPrepass;
+	afterPrepass.depthFunc = colorDepthFunc;
+	afterPrepass.depthWrite = false;
+	afterPrepassPipeline = PipelineState::get(afterPrepass);
+	if (mode != DepthPrepass::Off && !depthShader)
+		depthShader.reset(new Shader("depth.vert", "depth.frag"));
+}
+
+bool RenderQueue::usesPrepass(const RenderPacket& packet, uint64_t key) const {
+	if (prepassMode == DepthPrepass::Off || isTranslucent(key)) return false;
+	return prepassMode == DepthPrepass::All || packet.materials->materials[packet.material].depthPrepass;
+}
+
+uint64_t RenderQueue::makeKey(RenderPass pass, bool translucent, GLuint program, unsigned int materialId,
+	unsigned int mesh, float viewDepth) {
+
+	uint64_t key = bits(pass, 2) << 62 | uint64_t(translucent ? 1 : 0) << 61;
+	if (!translucent) {
+		key |= bits(program, 8) << 53;
+		key |= bits(materialId, 16) << 37;
+		key |= bits(mesh, 16) << 21;
+		key |= bits(depthBits(viewDepth, 21), 21);
+	}
+	else {
+		key |= bits(~depthBits(viewDepth, 24), 24) << 37;
+		key |= bits(program, 8) << 29;
+		key |= bits(materialId, 16) << 13;
+		key |= bits(mesh, 13);
+	}
+	return key;
+}
+
+void RenderQueue::begin(const glm::mat4& view) {
+	this->view = view;
+	packets.clear();
+	drawData.clear();
+	items.clear();
+}
+
+unsigned int RenderQueue::addDrawData(const DrawData& data) {
+	drawData.push_back(data);
+	return static_cast<unsigned int>(drawData.size() - 1);
+}
+
+void RenderQueue::submit(const Mesh& mesh, const MaterialLibrary& materials, unsigned int material,
+	ShaderVariants& shaders, unsigned int drawDataIndex, const AABB& box, RenderPass pass) {
+
+	const Material& m = materials.materials[material];
+
+	RenderPacket packet;
+	packet.mesh = &mesh;
+	packet.materials = &materials;
+	packet.material = material;
+	packet.shaders = &shaders;
+	packet.features = m.features;
+	packet.drawData = drawDataIndex;
+	packet.program = shaders.select(m.features).ID;
+	packet.materialId = materials.id(material);
+
+	glm::vec4 center = view * (drawData[drawDataIndex].model * glm::vec4(box.center(), 1.0f));
+	packet.key = makeKey(pass, m.translucent, packet.program, packet.materialId, mesh.geometry(), -center.z);
+	submit(packet);
+}
+
+void RenderQueue::submit(const RenderPacket& packet) {
+	items.push_back({ packet.key, static_cast<uint32_t>(packets.size()) });
+	packets.push_back(packet);
+}
+
+void RenderQueue::sort() {
+
+	auto start = std::chrono::high_resolution_clock::now();
+	size_t n = items.size();
+	scratch.resize(n);
+
+	// digits every key agrees on need no pass
+	uint64_t differing = 0;
+	for (size_t i = 1; i < n; i++)
+		differing |= items[i].key ^ items[0].key;
+
+	ThreadPool& pool = ThreadPool::shared();
+	size_t chunks = std::max<size_t>(1, std::min<size_t>(pool.size() + 1, n / ITEMS_PER_THREAD));
+	size_t chunkSize = (n + chunks - 1) / std::max<size_t>(1, chunks);
+	std::vector<size_t> offsets(chunks * BUCKETS);
+
+	for (unsigned int shift = 0; shift < 64; shift += RADIX_BITS) {
+		if (((differing >> shift) & (BUCKETS - 1)) == 0) continue;
+
+		// per chunk histograms, then exclusive offsets ordered by digit and chunk keep the sort stable
+		pool.parallelFor(chunks, [&](size_t c) {
+			size_t* counts = &offsets[c * BUCKETS];
+			std::fill(counts, counts + BUCKETS, 0);
+			size_t end = std::min(n, (c + 1) * chunkSize);
+			for (size_t i = c * chunkSize; i < end; i++)
+				counts[(items[i].key >> shift) & (BUCKETS - 1)]++;
+		});
+
+		size_t total = 0;
+		for (unsigned int digit = 0; digit < BUCKETS; digit++) {
+			for (size_t c = 0; c < chunks; c++) {
+				size_t count = offsets[c * BUCKETS + digit];
+				offsets[c * BUCKETS + digit] = total;
+				total += count;
+			}
+		}
+
+		pool.parallelFor(chunks, [&](size_t c) {
+			size_t* next = &offsets[c * BUCKETS];
+			size_t end = std::min(n, (c + 1) * chunkSize);
+			for (size_t i = c * chunkSize; i < end; i++)
+				scratch[next[(items[i].key >> shift) & (BUCKETS - 1)]++] = items[i];
+		});
+
+		items.swap(scratch);
+	}
+
+	lastStats.sortMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+RenderQueue::Stats RenderQueue::countStateChanges() const {
+
+	Stats stats;
+	stats.draws = items.size();
+	const RenderPacket* last = nullptr;
+	for (const SortItem& item : items) {
+		const RenderPacket& packet = packets[item.packet];
+		if (!last || last->program != packet.program || last->features != packet.features) stats.programChanges++;
+		if (!last || last->materialId != packet.materialId) stats.materialChanges++;
+		if (!last || last->mesh != packet.mesh) stats.meshChanges++;
+		if (!last || last->drawData != packet.drawData) stats.drawDataUploads++;
+		last = &packet;
+	}
+	return stats;
+}
+
+template<typename BindDrawData>
+void RenderQueue::drawPackets(BindDrawData bindDrawData) {
+
+	double sortMs = lastStats.sortMs;
+	lastStats = countStateChanges();
+	lastStats.sortMs = sortMs;
+
+	// depth of every prepass packet first, in the same order so meshes and draw data still repeat
+	const RenderPacket* last = nullptr;
+	if (prepassMode != DepthPrepass::Off) {
+		GLState::setPipeline(prepassPipeline);
+		depthShader->use();
+		for (const SortItem& item : items) {
+			const RenderPacket& packet = packets[item.packet];
+			if (!usesPrepass(packet, item.key)) continue;
+			if (!last || last->drawData != packet.drawData)
+				bindDrawData(packet.drawData);
+			packet.mesh->DrawPositions();
+			lastStats.prepassDraws++;
+			last = &packet;
+		}
+		last = nullptr;
+	}
+
+	const PipelineState* lastPipeline = nullptr;
+	for (const SortItem& item : items) {
+		const RenderPacket& packet = packets[item.packet];
+
+		const PipelineState* pipeline = isTranslucent(item.key) ? translucentPipeline
+			: usesPrepass(packet, item.key) ? afterPrepassPipeline : opaquePipeline;
+		if (pipeline != lastPipeline)
+			GLState::setPipeline(pipeline);
+		lastPipeline = pipeline;
+		if (!last || last->shaders != packet.shaders || last->features != packet.features)
+			packet.shaders->use(packet.features);
+		if (!last || last->materials != packet.materials || last->material != packet.material)
+			packet.materials->bind(packet.material);
+		if (!last || last->drawData != packet.drawData)
+			bindDrawData(packet.drawData);
+
+		packet.mesh->Draw();
+		last = &packet;
+	}
+
+	// glClear honours the depth mask, the last pipeline may have left depth writes off
+	if (lastPipeline != opaquePipeline)
+		GLState::setPipeline(opaquePipeline);
+}
+
+void RenderQueue::execute(UniformBlockBuffer<DrawData>& drawUniforms) {
+
+	drawPackets([&](unsigned int index) {
+		drawUniforms.update(drawData[index]);
+	});
+}
+
+void RenderQueue::execute(StreamBuffer& stream) {
+
+	if (items.empty()) return;
+
+	size_t stride = std140AlignUp(sizeof(DrawData), StreamBuffer::uniformAlignment());
+	StreamBuffer::Allocation allocation = stream.allocate(stride * drawData.size(), StreamBuffer::uniformAlignment());
+	if (!allocation.data) {
+		std::cout << "ERROR::RENDERQUEUE::STREAM_NOT_OPEN" << std::endl;
+		return;
+	}
+	unsigned char* out = static_cast<unsigned char*>(allocation.data);
+	for (size_t i = 0; i < drawData.size(); i++)
+		std::memcpy(out + i * stride, &drawData[i], sizeof(DrawData));
+	stream.flush();
+
+	drawPackets([&](unsigned int index) {
+		GLState::bindBufferRange(GL_UNIFORM_BUFFER, DRAW_DATA_BINDING, allocation.buffer,
+			allocation.offset + index * stride, sizeof(DrawData));
+	});
+}
+
+void RenderQueue::execute(IndirectRenderer& indirect, GpuCuller* culler) {
+
+	double sortMs = lastStats.sortMs;
+	lastStats = countStateChanges();
+	lastStats.sortMs = sortMs;
+
+	indirect.begin();
+	for (const SortItem& item : items) {
+		const RenderPacket& packet = packets[item.packet];
+		indirect.add(*packet.mesh, *packet.materials, packet.material, drawData[packet.drawData].model,
+			isTranslucent(item.key));
+	}
+	indirect.execute(culler);
+}
\ No newline at end of file
@@ -0,0 +1,129 @@
+#ifndef RENDERQUEUE_H
+#define RENDERQUEUE_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "Mesh.h"
+#include "Material.h"
+#include "ShaderVariants.h"
+#include "UniformBuffer.h"
+#include "GLState.h"
+
+class IndirectRenderer;
+class GpuCuller;
+class StreamBuffer;
+
+// passes run in this order, every packet belongs to one
+enum RenderPass : unsigned int {
+	RENDER_PASS_MAIN = 0
+};
+
+// Opaque packets can be drawn twice: depth only with a trivial shader (Mesh::DrawPositions), then
+// shaded with depth writes off and an equal-or-closer test, so the fragment shader runs once per pixel.
+enum class DepthPrepass {
+	Off,
+	PerMaterial, // materials with Material::depthPrepass
+	All          // every opaque material
+};
+
+// One draw: everything needed to bind its state, plus the key it is sorted by.
+struct RenderPacket {
+	uint64_t key;
+	const Mesh* mesh;
+	const MaterialLibrary* materials;
+	unsigned int material;
+	ShaderVariants* shaders;
+	unsigned int features;   // variant mask handed to shaders->use()
+	unsigned int drawData;   // index returned by RenderQueue::addDrawData
+	GLuint program;          // program the variant resolved to when the packet was made
+	unsigned int materialId; // MaterialLibrary::id(material)
+};
+
+// Per frame list of draws, sorted by key before submission so draws that share a program,
+// material and mesh end up next to each other.
+//
+// Key layout, most significant bits first:
+//   opaque:      pass 2 | translucent 1 (0) | program 8 | material 16 | mesh 16 | depth 21 (front to back)
+//   translucent: pass 2 | translucent 1 (1) | depth 24 (back to front) | program 8 | material 16 | mesh 13
+class RenderQueue {
+
+public:
+
+	struct Stats {
+		size_t draws = 0;
+		unsigned int programChanges = 0;
+		unsigned int materialChanges = 0;
+		unsigned int meshChanges = 0;
+		unsigned int drawDataUploads = 0;
+		unsigned int prepassDraws = 0;
+		double sortMs = 0.0;
+	};
+
+	RenderQueue();
+
+	// clear the queue, view is used to compute packet depths
+	void begin(const glm::mat4& view);
+
+	unsigned int addDrawData(const DrawData& data);
+
+	// box is in the space of drawData's model matrix
+	void submit(const Mesh& mesh, const MaterialLibrary& materials, unsigned int material,
+		ShaderVariants& shaders, unsigned int drawData, const AABB& box, RenderPass pass = RENDER_PASS_MAIN);
+	void submit(const RenderPacket& packet);
+
+	// multi-threaded LSD radix sort on the keys
+	void sort();
+
+	// applies to the direct executes, colorDepthFunc is GL_LEQUAL or GL_EQUAL (exact with invariant gl_Position)
+	void setDepthPrepass(DepthPrepass mode, GLenum colorDepthFunc = GL_LEQUAL);
+	DepthPrepass depthPrepass() const { return prepassMode; }
+
+	// bind and draw in the current order
+	void execute(UniformBlockBuffer<DrawData>& drawUniforms);
+	// every DrawData written to the ring once, draws bind their range; the stream's frame must be open
+	void execute(StreamBuffer& stream);
+	// the same order as multi-draw indirect commands, the packets' shaders are replaced by the renderer's
+	void execute(IndirectRenderer& indirect, GpuCuller* culler = nullptr);
+
+	// state changes a submission in the current order would make
+	Stats countStateChanges() const;
+
+	const Stats& stats() const { return lastStats; }
+	size_t size() const { return items.size(); }
+
+	static uint64_t makeKey(RenderPass pass, bool translucent, GLuint program, unsigned int materialId,
+		unsigned int mesh, float viewDepth);
+
+private:
+
+	struct SortItem {
+		uint64_t key;
+		uint32_t packet;
+	};
+
+	glm::mat4 view;
+	std::vector<RenderPacket> packets;
+	std::vector<DrawData> drawData;
+	std::vector<SortItem> items;
+	std::vector<SortItem> scratch;
+	Stats lastStats;
+
+	const PipelineState* opaquePipeline;
+	const PipelineState* translucentPipeline;
+	const PipelineState* prepassPipeline;      // depth writes, no color
+	const PipelineState* afterPrepassPipeline; // color, depth test only
+	DepthPrepass prepassMode;
+	std::unique_ptr<Shader> depthShader;       // depth.vert/depth.frag, loaded when a prepass is first enabled
+
+	bool usesPrepass(const RenderPacket& packet, uint64_t key) const;
+
+	// the shared part of both direct executes, bindDrawData(index) when the packet's draw data differs
+	template<typename BindDrawData> void drawPackets(BindDrawData bindDrawData);
+};
+
+#endif
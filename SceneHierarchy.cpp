@@ -0,0 +1,68 @@
+#include "SceneHierarchy.h"
+
+#include <cfloat>
+
+namespace {
+	bool sameBox(const AABB& a, const AABB& b) {
+		return a.min == b.min && a.max == b.max;
+	}
+}
+
+void SceneHierarchy::update(const std::vector<std::unique_ptr<Model>>& scene, const glm::mat4& model) {
+
+	bool rebuild = scene.size() != models.size();
+	for (size_t i = 0; !rebuild && i < scene.size(); i++)
+		rebuild = scene[i].get() != models[i];
+
+	bool moved = rebuild || model != placement;
+	for (size_t i = 0; !moved && i < scene.size(); i++)
+		moved = scene[i] && !sameBox(scene[i]->bounds(), modelBounds[i]);
+	if (!moved) return;
+
+	models.resize(scene.size());
+	modelBounds.resize(scene.size());
+	placedBounds.resize(scene.size());
+	placement = model;
+	for (size_t i = 0; i < scene.size(); i++) {
+		models[i] = scene[i].get();
+		modelBounds[i] = models[i] ? models[i]->bounds() : AABB();
+		placedBounds[i] = modelBounds[i].transformed(placement);
+	}
+	if (rebuild)
+		bvh.build(placedBounds);
+	else
+		bvh.refit(placedBounds);
+}
+
+size_t SceneHierarchy::cull(const glm::mat4& viewProjection, std::vector<unsigned char>& visible) const {
+
+	size_t count = bvh.cull(Frustum(viewProjection), visible);
+	visible.resize(models.size(), 0);
+	// subtrees inside the frustum are taken whole, models without bounds come along with them
+	for (size_t i = 0; i < models.size(); i++) {
+		if (visible[i] && !placedBounds[i].valid()) {
+			visible[i] = 0;
+			count--;
+		}
+	}
+	return count;
+}
+
+bool SceneHierarchy::pick(const Ray& ray, PickHit& hit, size_t& model) const {
+
+	// into each model's space; the placement is affine, so distances along the ray stay the same
+	glm::mat4 inverse = glm::inverse(placement);
+	Ray local = { glm::vec3(inverse * glm::vec4(ray.origin, 1.0f)), glm::vec3(inverse * glm::vec4(ray.direction, 0.0f)) };
+
+	float tMax = FLT_MAX;
+	int64_t nearest = bvh.raycast(ray, tMax, [&](uint32_t candidate, float& t) {
+		PickHit modelHit;
+		if (!models[candidate] || !models[candidate]->pick(local, modelHit) || modelHit.t >= t) return false;
+		t = modelHit.t;
+		hit = modelHit;
+		return true;
+	});
+	if (nearest < 0) return false;
+	model = static_cast<size_t>(nearest);
+	return true;
+}
@@ -0,0 +1,40 @@
+#ifndef SCENEHIERARCHY_H
+#define SCENEHIERARCHY_H
+
+#include <glm/glm.hpp>
+
+#include <memory>
+#include <vector>
+
+#include "Bvh.h"
+#include "Model.h"
+
+// Top level over every model of a scene: one Bvh over each model's bounds() placed by its model
+// matrix (DrawData::model). Culling and picking only reach a model's instance hierarchy when its
+// root passes, instead of walking every model. update() rebuilds when the models change and refits
+// when a root moved, through refitInstances() or a new placement.
+class SceneHierarchy {
+
+public:
+	// every model placed by the same matrix, the way the viewer draws them; nullptr entries (files that
+	// failed to load) are never visible or hit
+	void update(const std::vector<std::unique_ptr<Model>>& scene, const glm::mat4& model);
+
+	// visible[i] becomes 1 for the models whose placed bounds pass the frustum of viewProjection
+	size_t cull(const glm::mat4& viewProjection, std::vector<unsigned char>& visible) const;
+
+	// nearest triangle along a ray in the space the models are placed into; model is the index of the
+	// one it belongs to and hit.point is in that model's space
+	bool pick(const Ray& ray, PickHit& hit, size_t& model) const;
+
+	const Bvh& hierarchy() const { return bvh; }
+
+private:
+	std::vector<Model*> models;
+	std::vector<AABB> modelBounds; // bounds() of each model, as of the last update
+	std::vector<AABB> placedBounds;
+	glm::mat4 placement;
+	Bvh bvh;
+};
+
+#endif
@@ -0,0 +1,112 @@
+#include "SceneLoader.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+std::vector<std::unique_ptr<Model>> SceneLoader::load(const std::vector<std::string>& paths, const ModelOptions& options) {
+
+	typedef std::chrono::high_resolution_clock Clock;
+	Clock::time_point start = Clock::now();
+
+	std::vector<std::unique_ptr<Model>> models(paths.size());
+	if (paths.empty()) return models;
+
+	// per file result, handed from a worker to this thread
+	std::vector<std::unique_ptr<ModelImport>> imports(paths.size());
+	std::vector<char> finished(paths.size(), 0);
+	std::vector<double> fileMs(paths.size(), 0.0);
+
+	std::mutex mutex;
+	std::condition_variable changed;
+	size_t inFlight = 0;      // imported (or importing) but not uploaded yet
+	size_t nextFile = 0;
+
+	unsigned int decodesBefore = textures.decodes;
+	unsigned int hitsBefore = textures.hits;
+
+	auto worker = [&]() {
+		Assimp::Importer importer;
+		for (;;) {
+			size_t file;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				changed.wait(lock, [&]() { return inFlight < maxConcurrentFiles || nextFile >= paths.size(); });
+				if (nextFile >= paths.size()) return;
+				file = nextFile++;
+				inFlight++;
+			}
+
+			Clock::time_point fileStart = Clock::now();
+			std::unique_ptr<ModelImport> data(new ModelImport());
+			if (Model::importFile(importer, paths[file], options.dedupGeometry, *data)) {
+				// decode here so the context thread only has to upload
+				for (const MaterialDescription& material : data->materials)
+					for (const std::string& map : material.maps)
+						if (!map.empty())
+							textures.prefetch(data->directory + '/' + map);
+			}
+			else {
+				data.reset();
+			}
+			double ms = std::chrono::duration<double, std::milli>(Clock::now() - fileStart).count();
+
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				imports[file] = std::move(data);
+				fileMs[file] = ms;
+				finished[file] = 1;
+			}
+			changed.notify_all();
+		}
+	};
+
+	unsigned int workerCount = static_cast<unsigned int>(std::min<size_t>(maxConcurrentFiles, paths.size()));
+	std::vector<std::thread> workers;
+	for (unsigned int i = 0; i < workerCount; i++)
+		workers.emplace_back(worker);
+
+	// upload files in whatever order they finish, freeing their CPU copy straight away
+	for (size_t uploaded = 0; uploaded < paths.size(); uploaded++) {
+		size_t file = 0;
+		std::unique_ptr<ModelImport> data;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			changed.wait(lock, [&]() {
+				for (size_t i = 0; i < paths.size(); i++)
+					if (finished[i] == 1) { file = i; return true; }
+				return false;
+			});
+			finished[file] = 2;
+			data = std::move(imports[file]);
+		}
+
+		if (data) {
+			std::cout << "Scene: " << paths[file] << std::endl;
+			models[file].reset(new Model(*data, options, textures));
+		}
+		data.reset();
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			inFlight--;
+		}
+		changed.notify_all();
+	}
+
+	for (std::thread& thread : workers)
+		thread.join();
+
+	double wallMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+	double sumMs = 0.0;
+	for (double ms : fileMs) sumMs += ms;
+
+	std::cout << "Scene loaded: " << paths.size() << " files in " << wallMs << " ms (sum of per-file import "
+		<< sumMs << " ms, " << maxConcurrentFiles << " concurrent), textures decoded "
+		<< textures.decodes - decodesBefore << ", shared " << textures.hits - hitsBefore << std::endl;
+
+	return models;
+}
@@ -0,0 +1,31 @@
+#ifndef CLASS_SCENELOADER_H
+#define CLASS_SCENELOADER_H
+
+#include "Model.h"
+#include "TextureCache.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+// Loads many model files at once. Each worker thread owns one Assimp::Importer and does the
+// import, mesh conversion and texture decoding; the calling (context) thread only creates GL objects.
+// Textures are shared across every model loaded through the same SceneLoader.
+class SceneLoader {
+
+public:
+
+	// at most this many files are imported but not yet uploaded at any time, which bounds peak memory
+	unsigned int maxConcurrentFiles;
+	TextureCache textures;
+
+	explicit SceneLoader(unsigned int maxConcurrentFiles = 4)
+		: maxConcurrentFiles(maxConcurrentFiles > 0 ? maxConcurrentFiles : 1)
+	{
+	}
+
+	// models come back in the same order as paths, a file that failed to import gives a nullptr
+	std::vector<std::unique_ptr<Model>> load(const std::vector<std::string>& paths, const ModelOptions& options = ModelOptions());
+};
+
+#endif // CLASS_SCENELOADER_H
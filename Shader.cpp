@@ -1,92 +1,302 @@
 #include "Shader.h"
+#include "GLExtensions.h"
+#include "ProgramCache.h"
+#include "ShaderPreprocessor.h"
+#include "Material.h"
 
-Shader::Shader(const char* vertexPath, const char* fragmentPath) {
+#include <chrono>
 
+Shader::Shader(const char* vertexPath, const char* fragmentPath, const std::string& defines, bool deferLink)
+	: ID(0), ready(false), linked(false), label(std::string(vertexPath) + " + " + fragmentPath), cacheKey(0),
+	pendingVertex(0), pendingFragment(0), pendingCompute(0) {
 
-	//1. retrieve the vertex/fragment source code from filePath
+
+	//1. retrieve the vertex/fragment source code from filePath, includes expanded
 
 	std::string vertexCode;
 	std::string fragmentCode;
-	std::ifstream vShaderFile;
-	std::ifstream fShaderFile;
-
-	vShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-	fShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
+	ShaderPreprocessor::load(vertexPath, defines, vertexCode);
+	ShaderPreprocessor::load(fragmentPath, defines, fragmentCode);
+	const char* vShaderCode = vertexCode.c_str();
+	const char* fShaderCode = fragmentCode.c_str();
 
-	try {
-		vShaderFile.open(vertexPath);
-		fShaderFile.open(fragmentPath);
-		std::stringstream vShaderStream, fShaderStream;
+	compileStart = Clock::now();
+	ID = glCreateProgram();
 
-		vShaderStream << vShaderFile.rdbuf();
-		fShaderStream << fShaderFile.rdbuf();
 
-		vShaderFile.close();
-		fShaderFile.close();
+	//2. reuse a binary of the same sources from an earlier run
 
-		vertexCode = vShaderStream.str();
-		fragmentCode = fShaderStream.str();
+	cacheKey = ProgramCache::key(vertexCode, fragmentCode, defines);
+	double cachedCompileMs = 0.0;
+	if (ProgramCache::load(cacheKey, ID, cachedCompileMs)) {
+		double ms = std::chrono::duration<double, std::milli>(Clock::now() - compileStart).count();
+		std::cout << "Shader " << label << ": cache hit, " << ms << " ms (saved "
+			<< cachedCompileMs - ms << " ms)" << std::endl;
+		ready = true;
+		linked = true;
+		reflect();
+		return;
 	}
-	catch (std::ifstream::failure& e) {
-		std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
-	}
-	const char* vShaderCode = vertexCode.c_str();
-	const char* fShaderCode = fragmentCode.c_str();
-
 
-	//2. compile shaders
 
-	unsigned int vertex, fragment;
+	//3. compile shaders, errors are checked once the link has finished
 
 	//vertex shader
-	vertex = glCreateShader(GL_VERTEX_SHADER);
-	glShaderSource(vertex, 1, &vShaderCode, NULL);
-	glCompileShader(vertex);
-	checkCompileErrors(vertex, "VERTEX");
+	pendingVertex = glCreateShader(GL_VERTEX_SHADER);
+	glShaderSource(pendingVertex, 1, &vShaderCode, NULL);
+	glCompileShader(pendingVertex);
 
 	//fragment shader
-	fragment = glCreateShader(GL_FRAGMENT_SHADER);
-	glShaderSource(fragment, 1, &fShaderCode, NULL);
-	glCompileShader(fragment);
-	checkCompileErrors(fragment, "FRAGMENT");
+	pendingFragment = glCreateShader(GL_FRAGMENT_SHADER);
+	glShaderSource(pendingFragment, 1, &fShaderCode, NULL);
+	glCompileShader(pendingFragment);
 
 	//shader program
-	ID = glCreateProgram();
-	glAttachShader(ID, vertex);
-	glAttachShader(ID, fragment);
+	if (GLExt::programBinary)
+		GLExt::ProgramParameteri(ID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	glAttachShader(ID, pendingVertex);
+	glAttachShader(ID, pendingFragment);
 	glLinkProgram(ID);
+
+	if (!deferLink)
+		finishLink();
+
+};
+
+Shader::Shader(const std::string& label)
+	: ID(0), ready(false), linked(false), label(label), cacheKey(0), pendingVertex(0), pendingFragment(0), pendingCompute(0) {
+};
+
+std::unique_ptr<Shader> Shader::compute(const char* computePath, const std::string& defines) {
+
+	std::unique_ptr<Shader> shader(new Shader(computePath));
+
+	std::string computeCode;
+	ShaderPreprocessor::load(computePath, defines, computeCode);
+	const char* cShaderCode = computeCode.c_str();
+
+	shader->compileStart = Clock::now();
+	shader->ID = glCreateProgram();
+
+	shader->cacheKey = ProgramCache::key(computeCode, std::string(), defines);
+	double cachedCompileMs = 0.0;
+	if (ProgramCache::load(shader->cacheKey, shader->ID, cachedCompileMs)) {
+		double ms = std::chrono::duration<double, std::milli>(Clock::now() - shader->compileStart).count();
+		std::cout << "Shader " << shader->label << ": cache hit, " << ms << " ms (saved "
+			<< cachedCompileMs - ms << " ms)" << std::endl;
+		shader->ready = true;
+		shader->linked = true;
+		shader->reflect();
+		return shader;
+	}
+
+	shader->pendingCompute = glCreateShader(GL_COMPUTE_SHADER);
+	glShaderSource(shader->pendingCompute, 1, &cShaderCode, NULL);
+	glCompileShader(shader->pendingCompute);
+
+	if (GLExt::programBinary)
+		GLExt::ProgramParameteri(shader->ID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	glAttachShader(shader->ID, shader->pendingCompute);
+	glLinkProgram(shader->ID);
+
+	shader->finishLink();
+	return shader;
+};
+
+bool Shader::poll() {
+	if (ready) return true;
+
+	// without GL_KHR_parallel_shader_compile the status query below waits for the link
+	if (GLExt::parallelShaderCompile) {
+		GLint complete = GL_FALSE;
+		glGetProgramiv(ID, GL_COMPLETION_STATUS_KHR, &complete);
+		if (!complete) return false;
+	}
+	finishLink();
+	return true;
+};
+
+void Shader::finishLink() {
+
+	if (pendingVertex)
+		checkCompileErrors(pendingVertex, "VERTEX");
+	if (pendingFragment)
+		checkCompileErrors(pendingFragment, "FRAGMENT");
+	if (pendingCompute)
+		checkCompileErrors(pendingCompute, "COMPUTE");
 	checkCompileErrors(ID, "PROGRAM");
 
 	//delete the shaders as they're linked into our program now and no longer necessary
-	glDeleteShader(vertex);
-	glDeleteShader(fragment);
+	deletePendingShaders();
 
+	double ms = std::chrono::duration<double, std::milli>(Clock::now() - compileStart).count();
+	GLint status = 0;
+	glGetProgramiv(ID, GL_LINK_STATUS, &status);
+	linked = status != 0;
+	if (linked)
+		ProgramCache::store(cacheKey, ID, ms);
+	std::cout << "Shader " << label << ": compiled in " << ms << " ms" << std::endl;
+
+	ready = true;
+	if (linked)
+		reflect();
 };
 
+void Shader::deletePendingShaders() {
+	if (pendingVertex) {
+		glDetachShader(ID, pendingVertex);
+		glDeleteShader(pendingVertex);
+		pendingVertex = 0;
+	}
+	if (pendingFragment) {
+		glDetachShader(ID, pendingFragment);
+		glDeleteShader(pendingFragment);
+		pendingFragment = 0;
+	}
+	if (pendingCompute) {
+		glDetachShader(ID, pendingCompute);
+		glDeleteShader(pendingCompute);
+		pendingCompute = 0;
+	}
+};
+
+void Shader::reflect() {
+
+	uniforms.clear();
+	uniformHandles.clear();
+	uniformBlocks.clear();
+
+	GLint count = 0, maxLength = 0;
+	glGetProgramiv(ID, GL_ACTIVE_UNIFORMS, &count);
+	glGetProgramiv(ID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+	std::vector<char> nameBuffer(maxLength > 0 ? maxLength : 1);
+
+	for (GLint i = 0; i < count; i++) {
+		GLint size = 0;
+		GLenum type = 0;
+		glGetActiveUniform(ID, i, static_cast<GLsizei>(nameBuffer.size()), NULL, &size, &type, nameBuffer.data());
+		std::string name(nameBuffer.data());
+
+		// arrays are reported once as "name[0]", register every element and the bare name
+		bool isArray = name.size() > 3 && name.compare(name.size() - 3, 3, "[0]") == 0;
+		std::string base = isArray ? name.substr(0, name.size() - 3) : name;
+
+		for (GLint element = 0; element < size; element++) {
+			std::string elementName = isArray ? base + "[" + std::to_string(element) + "]" : base;
+			GLint location = glGetUniformLocation(ID, elementName.c_str());
+			if (location < 0) continue; // members of uniform blocks have no location
+
+			Uniform uniform;
+			uniform.location = location;
+			uniform.type = type;
+			uniform.hasValue = false;
+			uniformHandles[elementName] = static_cast<int>(uniforms.size());
+			if (isArray && element == 0)
+				uniformHandles[base] = static_cast<int>(uniforms.size());
+			uniforms.push_back(uniform);
+		}
+	}
+
+	GLint blocks = 0;
+	glGetProgramiv(ID, GL_ACTIVE_UNIFORM_BLOCKS, &blocks);
+	for (GLint i = 0; i < blocks; i++) {
+		GLint length = 0;
+		glGetActiveUniformBlockiv(ID, i, GL_UNIFORM_BLOCK_NAME_LENGTH, &length);
+		std::vector<char> blockName(length > 0 ? length : 1);
+		glGetActiveUniformBlockName(ID, i, static_cast<GLsizei>(blockName.size()), NULL, blockName.data());
+		uniformBlocks[std::string(blockName.data())] = static_cast<unsigned int>(i);
+
+		// shared blocks (FrameData, DrawData, MaterialData) always live at the same binding point
+		bindUniformBlock(ID, blockName.data(), i);
+	}
+
+	// material maps always come from the same texture units, point their samplers there once
+	GLuint previous = GLState::program();
+	GLState::useProgram(ID);
+	for (unsigned int unit = 0; unit < MATERIAL_UNIT_COUNT; unit++)
+		setInt(uniform(materialSamplerName(unit)), static_cast<int>(unit));
+	GLState::useProgram(previous);
+}
+
+int Shader::uniform(const std::string& name) const {
+	auto it = uniformHandles.find(name);
+	return it != uniformHandles.end() ? it->second : -1;
+}
+
+unsigned int Shader::uniformBlock(const std::string& name) const {
+	auto it = uniformBlocks.find(name);
+	return it != uniformBlocks.end() ? it->second : GL_INVALID_INDEX;
+}
+
+bool Shader::store(int handle, const void* value, size_t bytes) const {
+	if (handle < 0 || handle >= static_cast<int>(uniforms.size())) return false;
+
+	Uniform& uniform = uniforms[handle];
+	if (uniform.hasValue && std::memcmp(uniform.value, value, bytes) == 0)
+		return false;
+
+	std::memcpy(uniform.value, value, bytes);
+	uniform.hasValue = true;
+	return true;
+}
+
 
 void Shader::use() {
-	glUseProgram(ID);
+	GLState::useProgram(ID);
 };
 
 void Shader::setBool(const std::string& name, bool value) const {
-	glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value);
+	setBool(uniform(name), value);
 };
 
 void Shader::setInt(const std::string& name, int value) const {
-	glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
+	setInt(uniform(name), value);
 };
 
 void Shader::setFloat(const std::string& name, float value) const {
-	glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
+	setFloat(uniform(name), value);
 };
 
 
-void Shader::setMat4(const std::string& name, glm::mat4& value) const {
-	glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, glm::value_ptr(value));
+void Shader::setMat4(const std::string& name, const glm::mat4& value) const {
+	setMat4(uniform(name), value);
 };
 
 void Shader::setVec3(const std::string& name,const glm::vec3& value) const {
-	glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, glm::value_ptr(value));
+	setVec3(uniform(name), value);
+};
+
+void Shader::setVec4(const std::string& name, const glm::vec4& value) const {
+	setVec4(uniform(name), value);
+};
+
+void Shader::setBool(int handle, bool value) const {
+	setInt(handle, (int)value);
+};
+
+void Shader::setInt(int handle, int value) const {
+	if (store(handle, &value, sizeof(value)))
+		glUniform1i(uniforms[handle].location, value);
+};
+
+void Shader::setFloat(int handle, float value) const {
+	if (store(handle, &value, sizeof(value)))
+		glUniform1f(uniforms[handle].location, value);
+};
+
+void Shader::setVec3(int handle, const glm::vec3& value) const {
+	if (store(handle, glm::value_ptr(value), sizeof(value)))
+		glUniform3fv(uniforms[handle].location, 1, glm::value_ptr(value));
+};
+
+void Shader::setVec4(int handle, const glm::vec4& value) const {
+	if (store(handle, glm::value_ptr(value), sizeof(value)))
+		glUniform4fv(uniforms[handle].location, 1, glm::value_ptr(value));
+};
+
+void Shader::setMat4(int handle, const glm::mat4& value) const {
+	if (store(handle, glm::value_ptr(value), sizeof(value)))
+		glUniformMatrix4fv(uniforms[handle].location, 1, GL_FALSE, glm::value_ptr(value));
 };
 
 // utility function for checking shader compilation/linking errors.
@@ -7,31 +7,103 @@
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <vector>
+#include <unordered_map>
+#include <cstring>
+#include <chrono>
+#include <memory>
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
+#include "UniformBlocks.h"
+#include "GLState.h"
+
 
 class Shader
 {
 public:
 	unsigned int ID;
 
-	Shader(const char* vertexPath, const char* fragmentPath);
+	// defines ("#define NAME value" lines) are inserted after #version, see ShaderPreprocessor.h.
+	// With deferLink the compile and link are only issued: call poll() until it returns true
+	// before using the program, it does not block when the driver compiles in the background.
+	Shader(const char* vertexPath, const char* fragmentPath, const std::string& defines = "", bool deferLink = false);
+
+	// single compute stage (GL 4.3, GLExt::computeShader), linked before returning
+	static std::unique_ptr<Shader> compute(const char* computePath, const std::string& defines = "");
 
 	void use();
 
+	bool isReady() const { return ready; }
+	// false when a source failed to compile or the program failed to link
+	bool isValid() const { return ready && linked; }
+	bool poll();
+
+	// Handle of an active uniform (or array element), -1 if the linker removed it.
+	// Resolve once and keep it, setting through a handle skips the name lookup entirely.
+	int uniform(const std::string& name) const;
+	// index of an active uniform block, GL_INVALID_INDEX if there is none with that name
+	unsigned int uniformBlock(const std::string& name) const;
+
+	// Setters only reach the driver when the value differs from the last one uploaded,
+	// the program has to be bound (use()) like for plain glUniform* calls.
 	void setBool(const std::string &name, bool value) const;
 	void setInt(const std::string& name, int value) const;
 	void setFloat(const std::string& name, float value) const;
 
 	void setVec3(const std::string& name,const glm::vec3& value) const;
-	void setMat4(const std::string& name, glm::mat4& value) const;
+	void setVec4(const std::string& name, const glm::vec4& value) const;
+	void setMat4(const std::string& name, const glm::mat4& value) const;
+
+	void setBool(int handle, bool value) const;
+	void setInt(int handle, int value) const;
+	void setFloat(int handle, float value) const;
+	void setVec3(int handle, const glm::vec3& value) const;
+	void setVec4(int handle, const glm::vec4& value) const;
+	void setMat4(int handle, const glm::mat4& value) const;
+
 	void checkCompileErrors(unsigned int shader, std::string type);
 	~Shader() {
+		deletePendingShaders();
+		GLState::forgetProgram(ID);
 		glDeleteProgram(ID);
 	};
+
+private:
+
+	typedef std::chrono::high_resolution_clock Clock;
+
+	bool ready;
+	bool linked;
+	std::string label;
+	unsigned long long cacheKey;
+	Clock::time_point compileStart;
+	// shader objects of a link still in flight
+	unsigned int pendingVertex;
+	unsigned int pendingFragment;
+	unsigned int pendingCompute;
+
+	explicit Shader(const std::string& label);
+
+	// one entry per active uniform location, filled from glGetActiveUniform after linking
+	struct Uniform {
+		GLint location;
+		GLenum type;
+		bool hasValue;
+		float value[16]; // last uploaded value (ints stored bitwise)
+	};
+
+	mutable std::vector<Uniform> uniforms;
+	std::unordered_map<std::string, int> uniformHandles;
+	std::unordered_map<std::string, unsigned int> uniformBlocks;
+
+	void finishLink();
+	void deletePendingShaders();
+	void reflect();
+	// true when the value changed and has to be uploaded
+	bool store(int handle, const void* value, size_t bytes) const;
 };
 
 #endif
\ No newline at end of file
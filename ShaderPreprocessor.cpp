@@ -0,0 +1,87 @@
+#include "ShaderPreprocessor.h"
+#include "UniformBlocks.h"
+
+#include <fstream>
+#include <iostream>
+#include <set>
+#include <sstream>
+#include <vector>
+
+namespace {
+
+	struct Context {
+		std::set<std::string> included;
+		std::vector<std::string> files; // index is the source string number used in #line
+	};
+
+	std::string directoryOf(const std::string& path) {
+		size_t slash = path.find_last_of("/\\");
+		return slash == std::string::npos ? std::string() : path.substr(0, slash + 1);
+	}
+
+	bool expand(const std::string& path, const std::string& defines, Context& context, std::string& out) {
+
+		std::ifstream file(path);
+		if (!file) {
+			std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ " << path << std::endl;
+			return false;
+		}
+		context.included.insert(path);
+		int fileIndex = static_cast<int>(context.files.size());
+		context.files.push_back(path);
+
+		std::string line;
+		int lineNumber = 0;
+		while (std::getline(file, line)) {
+			lineNumber++;
+
+			size_t start = line.find_first_not_of(" \t");
+			if (start != std::string::npos && line.compare(start, 8, "#include") == 0) {
+				size_t open = line.find_first_of("\"<", start + 8);
+				size_t close = open == std::string::npos ? open : line.find_first_of("\">", open + 1);
+				if (close == std::string::npos) {
+					std::cout << "ERROR::SHADER::BAD_INCLUDE " << path << "(" << lineNumber << ")" << std::endl;
+					return false;
+				}
+				std::string name = line.substr(open + 1, close - open - 1);
+
+				if (line[open] == '<') {
+					std::string block = uniformBlockSource(name);
+					if (block.empty()) {
+						std::cout << "ERROR::SHADER::UNKNOWN_BLOCK " << name << " in " << path << std::endl;
+						return false;
+					}
+					if (context.included.insert("<" + name + ">").second)
+						out += block;
+				}
+				else {
+					std::string includePath = directoryOf(path) + name;
+					if (!context.included.count(includePath)) {
+						if (!expand(includePath, "", context, out))
+							return false;
+					}
+				}
+				out += "#line " + std::to_string(lineNumber + 1) + " " + std::to_string(fileIndex) + "\n";
+				continue;
+			}
+
+			out += line;
+			out += '\n';
+
+			// defines go right after #version, which has to stay the first statement
+			if (start != std::string::npos && line.compare(start, 8, "#version") == 0 && !defines.empty()) {
+				out += defines;
+				if (defines.back() != '\n') out += '\n';
+				out += "#line " + std::to_string(lineNumber + 1) + " " + std::to_string(fileIndex) + "\n";
+			}
+		}
+		return true;
+	}
+
+}
+
+bool ShaderPreprocessor::load(const std::string& path, const std::string& defines, std::string& out) {
+	Context context;
+	out.clear();
+	return expand(path, defines, context, out);
+}
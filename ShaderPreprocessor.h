@@ -0,0 +1,18 @@
+#ifndef SHADERPREPROCESSOR_H
+#define SHADERPREPROCESSOR_H
+
+#include <string>
+
+// Expands a GLSL file before it is handed to the driver:
+//  - #include "file" is replaced by that file (relative to the including one, each file once)
+//  - #include <Block> is replaced by the generated declaration of a shared uniform block
+//  - defines are inserted right after the #version line
+// #line directives keep compiler messages pointing at the original files.
+namespace ShaderPreprocessor {
+
+	// false when the file (or one of its includes) cannot be read
+	bool load(const std::string& path, const std::string& defines, std::string& out);
+
+}
+
+#endif
@@ -0,0 +1,72 @@
+#include "ShaderVariants.h"
+#include "GLExtensions.h"
+
+ShaderVariants::ShaderVariants(const char* vertexPath, const char* fragmentPath, const std::vector<std::string>& features)
+	: vertexPath(vertexPath), fragmentPath(fragmentPath), features(features) {
+
+	if (features.size() > MAX_FEATURES)
+		std::cout << "ERROR::SHADER_VARIANTS::TOO_MANY_FEATURES " << features.size() << std::endl;
+
+	std::string genericDefines = "uniform int shaderFeatures;\n";
+	for (size_t i = 0; i < features.size(); i++)
+		genericDefines += "#define " + features[i] + " ((shaderFeatures & " + std::to_string(1u << i) + ") != 0)\n";
+
+	generic.reset(new Shader(vertexPath, fragmentPath, genericDefines));
+	genericFeatures = generic->uniform("shaderFeatures");
+};
+
+std::string ShaderVariants::defines(unsigned int mask) const {
+	std::string out;
+	for (size_t i = 0; i < features.size(); i++)
+		out += "#define " + features[i] + ((mask & (1u << i)) ? " true\n" : " false\n");
+	return out;
+};
+
+void ShaderVariants::request(unsigned int mask) {
+	std::unique_ptr<Shader>& variant = variants[mask];
+	if (!variant)
+		variant.reset(new Shader(vertexPath.c_str(), fragmentPath.c_str(), defines(mask), true));
+};
+
+Shader& ShaderVariants::select(unsigned int mask) {
+
+	auto it = variants.find(mask);
+	if (it == variants.end()) {
+		request(mask);
+		it = variants.find(mask);
+	}
+
+	// still compiling (or broken): the generic program branches on the mask at runtime
+	return it->second->isValid() ? *it->second : *generic;
+};
+
+Shader& ShaderVariants::use(unsigned int mask) {
+
+	Shader& shader = select(mask);
+	shader.use();
+	if (&shader == generic.get())
+		generic->setInt(genericFeatures, static_cast<int>(mask));
+	return shader;
+};
+
+void ShaderVariants::update() {
+	for (auto& variant : variants) {
+		if (variant.second->isReady()) continue;
+
+		// without background compilation poll() waits for the link, finish one program per frame
+		variant.second->poll();
+		if (!GLExt::parallelShaderCompile) break;
+	}
+};
+
+bool ShaderVariants::isReady(unsigned int mask) const {
+	auto it = variants.find(mask);
+	return it != variants.end() && it->second->isReady();
+};
+
+size_t ShaderVariants::pendingCount() const {
+	size_t pending = 0;
+	for (const auto& variant : variants)
+		if (!variant.second->isReady()) pending++;
+	return pending;
+};
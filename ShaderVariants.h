@@ -0,0 +1,53 @@
+#ifndef SHADERVARIANTS_H
+#define SHADERVARIANTS_H
+
+#include "Shader.h"
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Permutations of one vertex/fragment pair, selected by a bitmask of features.
+//
+// Feature i (features[i]) is defined as true or false in a specialized variant, so the shader
+// tests it with a plain if (HAS_DIFFUSE_MAP) and the compiler drops the dead branch. The generic
+// variant defines every feature as a test on "uniform int shaderFeatures" instead: it is compiled
+// up front and draws whatever mask is asked for until the specialized program has linked, so a
+// new permutation never stalls a frame.
+class ShaderVariants
+{
+public:
+	static const unsigned int MAX_FEATURES = 16;
+
+	ShaderVariants(const char* vertexPath, const char* fragmentPath, const std::vector<std::string>& features);
+
+	// start compiling a permutation in the background, does nothing if it exists already
+	void request(unsigned int mask);
+
+	// the program use(mask) would bind right now, without binding it
+	Shader& select(unsigned int mask);
+
+	// bind the program for mask and return it for further uniforms
+	Shader& use(unsigned int mask);
+
+	// pick up finished compiles, call once per frame
+	void update();
+
+	bool isReady(unsigned int mask) const;
+	size_t pendingCount() const;
+
+	// "#define NAME true|false" lines for a specialized variant
+	std::string defines(unsigned int mask) const;
+
+private:
+	std::string vertexPath;
+	std::string fragmentPath;
+	std::vector<std::string> features;
+
+	std::unique_ptr<Shader> generic;
+	int genericFeatures; // handle of shaderFeatures in the generic program
+	std::unordered_map<unsigned int, std::unique_ptr<Shader>> variants;
+};
+
+#endif
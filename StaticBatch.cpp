@@ -0,0 +1,166 @@
+#include "StaticBatch.h"
+#include "Model.h"
+#include "ThreadPool.h"
+
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <map>
+#include <tuple>
+#include <unordered_map>
+
+void StaticBatch::add(const Mesh& mesh, const MaterialLibrary& materials, unsigned int material, const glm::mat4& world) {
+
+	if (!mesh.isLoaded() || mesh.geometry() == GeometryArena::INVALID) return;
+	merged.insert(&mesh);
+	for (const glm::mat4& transform : mesh.instanceTransforms) {
+		Source source;
+		source.mesh = &mesh;
+		source.materials = &materials;
+		source.material = material;
+		source.transform = world * transform;
+		sources.push_back(source);
+	}
+}
+
+void StaticBatch::add(const Model& model, const glm::mat4& world) {
+	for (const Mesh& mesh : model.meshes)
+		add(mesh, model.materials, mesh.materialIndex, world);
+}
+
+void StaticBatch::clear() {
+	sources.clear();
+	merged.clear();
+	built.clear();
+	lastStats = Stats();
+}
+
+void StaticBatch::build() {
+
+	auto start = std::chrono::high_resolution_clock::now();
+	built.clear();
+	lastStats = Stats();
+	lastStats.sourceInstances = sources.size();
+
+	// meshes that kept no CPU copy are read back once, on the context thread
+	std::unordered_map<const Mesh*, size_t> readIndex;
+	std::vector<std::vector<Vertex>> readVertices;
+	std::vector<std::vector<unsigned int>> readIndices;
+	for (const Source& source : sources) {
+		const Mesh& mesh = *source.mesh;
+		if ((!mesh.vertices.empty() && !mesh.indices.empty()) || readIndex.count(&mesh)) continue;
+		readIndex[&mesh] = readVertices.size();
+		readVertices.emplace_back();
+		readIndices.emplace_back();
+		GeometryArena::shared().read(mesh.geometry(), readVertices.back(), readIndices.back());
+	}
+	auto verticesOf = [&](const Mesh& mesh) -> const std::vector<Vertex>& {
+		return !mesh.vertices.empty() && !mesh.indices.empty() ? mesh.vertices : readVertices[readIndex.at(&mesh)];
+	};
+	auto indicesOf = [&](const Mesh& mesh) -> const std::vector<unsigned int>& {
+		return !mesh.vertices.empty() && !mesh.indices.empty() ? mesh.indices : readIndices[readIndex.at(&mesh)];
+	};
+
+	// one group per material and cell, cells picked by the center of each instance's world box
+	struct Group {
+		const MaterialLibrary* materials;
+		unsigned int material;
+		std::vector<size_t> sources;
+	};
+	std::vector<Group> groups;
+	std::map<std::tuple<const MaterialLibrary*, unsigned int, int, int, int>, size_t> groupOf;
+	for (size_t i = 0; i < sources.size(); i++) {
+		const Source& source = sources[i];
+		glm::vec3 center = source.mesh->bounds.transformed(source.transform).center();
+		glm::ivec3 cell(glm::floor(center / cellSize));
+		std::tuple<const MaterialLibrary*, unsigned int, int, int, int> key(source.materials, source.material, cell.x, cell.y, cell.z);
+		std::map<std::tuple<const MaterialLibrary*, unsigned int, int, int, int>, size_t>::iterator it = groupOf.find(key);
+		if (it == groupOf.end()) {
+			it = groupOf.insert(std::make_pair(key, groups.size())).first;
+			Group group;
+			group.materials = source.materials;
+			group.material = source.material;
+			groups.push_back(group);
+		}
+		groups[it->second].sources.push_back(i);
+	}
+
+	// pre-transform on the workers
+	struct Merged {
+		std::vector<Vertex> vertices;
+		std::vector<unsigned int> indices;
+		AABB bounds;
+	};
+	std::vector<Merged> merged(groups.size());
+	ThreadPool::shared().parallelFor(groups.size(), [&](size_t g) {
+		Merged& out = merged[g];
+		size_t vertexCount = 0, indexCount = 0;
+		for (size_t i : groups[g].sources) {
+			vertexCount += verticesOf(*sources[i].mesh).size();
+			indexCount += indicesOf(*sources[i].mesh).size();
+		}
+		out.vertices.reserve(vertexCount);
+		out.indices.reserve(indexCount);
+
+		for (size_t i : groups[g].sources) {
+			const Source& source = sources[i];
+			const std::vector<Vertex>& vertices = verticesOf(*source.mesh);
+			const std::vector<unsigned int>& indices = indicesOf(*source.mesh);
+			glm::mat3 linear(source.transform);
+			glm::mat3 normalMatrix = glm::transpose(glm::inverse(linear));
+			// a mirroring transform turns the triangles around, swap two corners to keep them front facing
+			bool mirrored = glm::determinant(linear) < 0.0f;
+
+			unsigned int base = static_cast<unsigned int>(out.vertices.size());
+			for (const Vertex& v : vertices) {
+				Vertex world;
+				world.Position = glm::vec3(source.transform * glm::vec4(v.Position, 1.0f));
+				glm::vec3 normal = normalMatrix * v.Normal;
+				world.Normal = glm::dot(normal, normal) > 0.0f ? glm::normalize(normal) : normal;
+				world.TexCoords = v.TexCoords;
+				out.vertices.push_back(world);
+				out.bounds.expand(world.Position);
+			}
+			for (size_t t = 0; t + 2 < indices.size(); t += 3) {
+				out.indices.push_back(base + indices[t]);
+				out.indices.push_back(base + indices[mirrored ? t + 2 : t + 1]);
+				out.indices.push_back(base + indices[mirrored ? t + 1 : t + 2]);
+			}
+		}
+	});
+
+	built.reserve(groups.size());
+	for (size_t g = 0; g < groups.size(); g++) {
+		lastStats.vertices += merged[g].vertices.size();
+		lastStats.triangles += merged[g].indices.size() / 3;
+		AABB bounds = merged[g].bounds;
+		built.emplace_back(Mesh(std::move(merged[g].vertices), std::move(merged[g].indices), groups[g].material, GeometryResidency::GpuOnly),
+			groups[g].materials, groups[g].material, bounds, groups[g].sources.size());
+	}
+	lastStats.chunks = built.size();
+	lastStats.buildMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+	std::cout << "Static batch: " << lastStats.sourceInstances << " mesh instances merged into " << lastStats.chunks
+		<< " chunks (" << lastStats.vertices << " vertices, " << lastStats.triangles << " triangles) in "
+		<< lastStats.buildMs << " ms" << std::endl;
+}
+
+void StaticBatch::submit(RenderQueue& queue, ShaderVariants& shaders, const glm::mat4& viewProjection) {
+
+	lastStats.submitted = 0;
+	if (built.empty()) return;
+
+	// the vertices are already in world space
+	DrawData draw;
+	draw.model = glm::mat4(1.0f);
+	draw.modelViewProjection = viewProjection;
+	draw.normalMatrix = glm::mat4(1.0f);
+	unsigned int drawData = queue.addDrawData(draw);
+
+	Frustum frustum(viewProjection);
+	for (const Chunk& chunk : built) {
+		if (!frustum.intersects(chunk.bounds)) continue;
+		queue.submit(chunk.mesh, *chunk.materials, chunk.material, shaders, drawData, chunk.bounds);
+		lastStats.submitted++;
+	}
+}
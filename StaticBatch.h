@@ -0,0 +1,81 @@
+#ifndef STATICBATCH_H
+#define STATICBATCH_H
+
+#include <glm/glm.hpp>
+
+#include <unordered_set>
+#include <vector>
+
+#include "Mesh.h"
+#include "Material.h"
+#include "RenderQueue.h"
+#include "ShaderVariants.h"
+
+class Model;
+
+// Geometry that never moves, baked into world space. Every mesh instance added is transformed on the
+// CPU and appended to the chunk of its material and grid cell; build() turns each chunk into one
+// arena Mesh drawn with a single call and an identity model matrix. Cells keep chunks small enough
+// that frustum culling per chunk still rejects most of an off-screen scene.
+// Materials are referenced, not copied, so the models must outlive the batch.
+class StaticBatch {
+
+public:
+
+	struct Chunk {
+		Mesh mesh;
+		const MaterialLibrary* materials;
+		unsigned int material;
+		AABB bounds; // world space
+		size_t sourceInstances;
+
+		Chunk(Mesh&& mesh, const MaterialLibrary* materials, unsigned int material, const AABB& bounds, size_t sourceInstances)
+			: mesh(std::move(mesh)), materials(materials), material(material), bounds(bounds), sourceInstances(sourceInstances) {}
+	};
+
+	struct Stats {
+		size_t sourceInstances = 0; // mesh instances that went in, one draw each without the batch
+		size_t chunks = 0;
+		size_t vertices = 0;
+		size_t triangles = 0;
+		double buildMs = 0.0;
+		size_t submitted = 0;       // chunks that passed the frustum in the last submit
+	};
+
+	// edge of the cubic cells chunks are split by, in world units
+	explicit StaticBatch(float cellSize = 32.0f) : cellSize(cellSize) {}
+
+	// every instance transform of the mesh, placed by world; a mesh without a CPU copy is read back from the arena
+	void add(const Mesh& mesh, const MaterialLibrary& materials, unsigned int material, const glm::mat4& world);
+	// every loaded mesh of the model
+	void add(const Model& model, const glm::mat4& world);
+	// true once the mesh has been added, the ones left out (not loaded yet) are still drawn by their model
+	bool contains(const Mesh& mesh) const { return merged.count(&mesh) > 0; }
+
+	// merge everything added so far, replacing the chunks of an earlier build
+	void build();
+	void clear();
+
+	// one packet per chunk whose bounds pass the frustum
+	void submit(RenderQueue& queue, ShaderVariants& shaders, const glm::mat4& viewProjection);
+
+	const std::vector<Chunk>& chunks() const { return built; }
+	const Stats& stats() const { return lastStats; }
+
+private:
+
+	struct Source {
+		const Mesh* mesh;
+		const MaterialLibrary* materials;
+		unsigned int material;
+		glm::mat4 transform;
+	};
+
+	float cellSize;
+	std::vector<Source> sources;
+	std::unordered_set<const Mesh*> merged;
+	std::vector<Chunk> built;
+	Stats lastStats;
+};
+
+#endif
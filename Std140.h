@@ -0,0 +1,162 @@
+#ifndef STD140_H
+#define STD140_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <iostream>
+#include <string>
+
+// Compile-time description of a std140 uniform block.
+//
+// A C++ struct is mirrored by a UniformBlockLayout specialization that lists its members in order:
+//
+//     template<> struct UniformBlockLayout<FrameData> {
+//         static const char* name() { return "FrameData"; }
+//         static const GLuint binding = FRAME_DATA_BINDING;
+//         STD140_MEMBER(FrameData, view);
+//         STD140_MEMBER(FrameData, time);
+//         typedef Std140Members<view_member, time_member> members;
+//     };
+//     STD140_VALIDATE(FrameData);
+//
+// STD140_VALIDATE fails to compile when a member's offset or size differs from what std140 gives
+// the GLSL declaration, uniformBlockGLSL<T>() prints that declaration, and checkUniformBlockLayout<T>()
+// compares it with the offsets the driver reports for a linked program.
+// Members not listed (trailing padding) are not part of the GLSL block.
+
+constexpr size_t std140AlignUp(size_t value, size_t alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+// alignment/size rules of std140 (GLSL spec 4.6, section 7.6.2.2)
+template<typename T> struct Std140Type; // no definition: the type has no matching std140 layout
+
+#define STD140_TYPE(CppType, Alignment, Size, Glsl)                                   \
+    template<> struct Std140Type<CppType> {                                           \
+        static constexpr size_t alignment = Alignment;                                \
+        static constexpr size_t size = Size;                                          \
+        static std::string declare(const char* name) { return std::string(Glsl " ") + name; } \
+    }
+
+STD140_TYPE(float, 4, 4, "float");
+STD140_TYPE(int, 4, 4, "int");
+STD140_TYPE(unsigned int, 4, 4, "uint");
+STD140_TYPE(glm::vec2, 8, 8, "vec2");
+STD140_TYPE(glm::vec3, 16, 12, "vec3");
+STD140_TYPE(glm::vec4, 16, 16, "vec4");
+STD140_TYPE(glm::ivec4, 16, 16, "ivec4");
+STD140_TYPE(glm::uvec4, 16, 16, "uvec4");
+STD140_TYPE(glm::mat4, 16, 64, "mat4");
+// glm::mat3 is deliberately missing: it is 36 bytes in C++ but three 16 byte columns in std140
+
+#undef STD140_TYPE
+
+// arrays: every element is rounded up to a vec4
+template<typename T, size_t N> struct Std140Type<T[N]> {
+    static constexpr size_t stride = std140AlignUp(Std140Type<T>::size, 16);
+    static constexpr size_t alignment = std140AlignUp(Std140Type<T>::alignment, 16);
+    static constexpr size_t size = stride * N;
+    static std::string declare(const char* name) { return Std140Type<T>::declare(name) + "[" + std::to_string(N) + "]"; }
+};
+
+template<typename Block> struct UniformBlockLayout; // specialized for every block
+
+#define STD140_MEMBER(Block, member)                                          \
+    struct member##_member {                                                  \
+        typedef decltype(Block::member) type;                                 \
+        static constexpr size_t offset = offsetof(Block, member);             \
+        static constexpr size_t cppSize = sizeof(Block::member);              \
+        static const char* name() { return #member; }                         \
+    }
+
+template<typename... Members> struct Std140Members {};
+
+// walks the member list keeping the std140 cursor, valid only when every C++ offset and size matches
+template<size_t Cursor, typename List> struct Std140Walk;
+
+template<size_t Cursor> struct Std140Walk<Cursor, Std140Members<>> {
+    static constexpr bool valid = true;
+    static constexpr size_t end = Cursor;
+    static void declare(std::string&) {}
+    static bool check(GLuint, const std::string&) { return true; }
+};
+
+template<size_t Cursor, typename M, typename... Rest> struct Std140Walk<Cursor, Std140Members<M, Rest...>> {
+    typedef Std140Type<typename M::type> Type;
+    static constexpr size_t offset = std140AlignUp(Cursor, Type::alignment);
+    typedef Std140Walk<offset + Type::size, Std140Members<Rest...>> Next;
+
+    static constexpr bool valid = offset == M::offset && Type::size == M::cppSize && Next::valid;
+    static constexpr size_t end = Next::end;
+
+    static void declare(std::string& out)
+    {
+        out += "    " + Type::declare(M::name()) + ";\n";
+        Next::declare(out);
+    }
+
+    static bool check(GLuint program, const std::string& block)
+    {
+        // members of a named block without an instance name are queried by their plain name
+        const char* name = M::name();
+        GLuint index = GL_INVALID_INDEX;
+        glGetUniformIndices(program, 1, &name, &index);
+
+        bool ok = true;
+        if (index != GL_INVALID_INDEX) { // inactive members are fine, the linker may drop them
+            GLint driverOffset = -1;
+            glGetActiveUniformsiv(program, 1, &index, GL_UNIFORM_OFFSET, &driverOffset);
+            if (driverOffset != static_cast<GLint>(offset)) {
+                std::cout << "ERROR::UNIFORM_BLOCK::" << block << "." << name << " is at offset " << driverOffset
+                    << " in GLSL but " << offset << " in C++" << std::endl;
+                ok = false;
+            }
+        }
+        return Next::check(program, block) && ok;
+    }
+};
+
+template<typename Block>
+struct Std140Check {
+    typedef Std140Walk<0, typename UniformBlockLayout<Block>::members> Walk;
+    static constexpr bool membersMatch = Walk::valid;
+    static constexpr size_t size = std140AlignUp(Walk::end, 16);
+};
+
+#define STD140_VALIDATE(Block)                                                              \
+    static_assert(Std140Check<Block>::membersMatch, #Block " does not follow std140 layout"); \
+    static_assert(Std140Check<Block>::size == sizeof(Block), #Block " size does not match its std140 size")
+
+// "layout (std140) uniform Block { ... };" matching the C++ struct
+template<typename Block>
+std::string uniformBlockGLSL()
+{
+    std::string out = "layout (std140) uniform ";
+    out += UniformBlockLayout<Block>::name();
+    out += "\n{\n";
+    Std140Check<Block>::Walk::declare(out);
+    out += "};\n";
+    return out;
+}
+
+// compare the linked program's block with the C++ description, prints every mismatch
+template<typename Block>
+bool checkUniformBlockLayout(GLuint program, GLuint blockIndex)
+{
+    const char* name = UniformBlockLayout<Block>::name();
+
+    GLint dataSize = 0;
+    glGetActiveUniformBlockiv(program, blockIndex, GL_UNIFORM_BLOCK_DATA_SIZE, &dataSize);
+    bool ok = Std140Check<Block>::Walk::check(program, name);
+    if (dataSize > static_cast<GLint>(sizeof(Block))) {
+        std::cout << "ERROR::UNIFORM_BLOCK::" << name << " is " << dataSize << " bytes in GLSL but "
+            << sizeof(Block) << " in C++" << std::endl;
+        ok = false;
+    }
+    return ok;
+}
+
+#endif
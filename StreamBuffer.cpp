@@ -0,0 +1,237 @@
+#include "StreamBuffer.h"
+#include "GLExtensions.h"
+#include "GLState.h"
+
+#include <chrono>
+#include <cstring>
+#include <iostream>
+
+namespace {
+
+	const size_t SHARED_REGION_BYTES = 4 << 20;
+
+	typedef std::chrono::high_resolution_clock Clock;
+
+	double millisecondsSince(Clock::time_point start) {
+		return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+	}
+
+	size_t alignUp(size_t value, size_t alignment) {
+		return (value + alignment - 1) / alignment * alignment;
+	}
+
+	bool signalled(GLenum status) {
+		return status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED;
+	}
+
+}
+
+StreamBuffer& StreamBuffer::shared() {
+	static StreamBuffer* ring = new StreamBuffer(SHARED_REGION_BYTES);
+	return *ring;
+}
+
+StreamBuffer::StreamBuffer(size_t regionSize, bool allowPersistent)
+	: allowPersistent(allowPersistent), persistentMap(false), buffer(0), region(0), current(0),
+	cursor(0), regionEnd(0), inFrame(false), mapped(nullptr), mapStart(0)
+{
+	create(regionSize);
+}
+
+StreamBuffer::~StreamBuffer() {
+	flush();
+	for (unsigned int i = 0; i < REGION_COUNT; i++)
+		if (fences[i]) glDeleteSync(fences[i]);
+	for (const Retired& old : retired) {
+		glDeleteSync(old.fence);
+		GLState::forgetBuffer(old.buffer);
+		glDeleteBuffers(1, &old.buffer);
+	}
+	// deleting a buffer unmaps it
+	GLState::forgetBuffer(buffer);
+	glDeleteBuffers(1, &buffer);
+}
+
+void StreamBuffer::create(size_t regionBytes) {
+
+	region = alignUp(regionBytes, 256);
+	for (unsigned int i = 0; i < REGION_COUNT; i++)
+		fences[i] = 0;
+	current = 0;
+	cursor = 0;
+	regionEnd = region;
+	mapped = nullptr;
+	mapStart = 0;
+
+	glGenBuffers(1, &buffer);
+	GLState::bindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+	size_t total = region * REGION_COUNT;
+	persistentMap = allowPersistent && GLExt::bufferStorage;
+	if (persistentMap) {
+		GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		GLExt::BufferStorage(GL_COPY_WRITE_BUFFER, total, NULL, flags);
+		mapped = static_cast<unsigned char*>(glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, total, flags));
+		if (!mapped) {
+			std::cout << "ERROR::STREAMBUFFER::PERSISTENT_MAP_FAILED" << std::endl;
+			// immutable storage cannot be respecified, start over with a mutable buffer
+			GLState::forgetBuffer(buffer);
+			glDeleteBuffers(1, &buffer);
+			glGenBuffers(1, &buffer);
+			GLState::bindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+			persistentMap = false;
+			allowPersistent = false;
+		}
+	}
+	if (!persistentMap)
+		glBufferData(GL_COPY_WRITE_BUFFER, total, NULL, GL_STREAM_DRAW);
+}
+
+void StreamBuffer::beginFrame() {
+
+	if (inFrame) endFrame();
+	releaseRetired();
+
+	current = (current + 1) % REGION_COUNT;
+	GLsync& fence = fences[current];
+	if (fence) {
+		GLenum status = glClientWaitSync(fence, 0, 0);
+		if (!signalled(status)) {
+			// the GPU is REGION_COUNT frames behind, nothing to do but wait
+			Clock::time_point start = Clock::now();
+			do {
+				status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+			} while (status == GL_TIMEOUT_EXPIRED);
+			stats.stallMs += millisecondsSince(start);
+			stats.stalls++;
+		}
+		glDeleteSync(fence);
+		fence = 0;
+	}
+
+	cursor = current * region;
+	regionEnd = cursor + region;
+	inFrame = true;
+}
+
+void StreamBuffer::endFrame() {
+
+	if (!inFrame) return;
+	flush();
+	if (fences[current]) glDeleteSync(fences[current]);
+	fences[current] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	inFrame = false;
+}
+
+StreamBuffer::Allocation StreamBuffer::allocate(size_t bytes, size_t alignment) {
+
+	Allocation allocation;
+	if (!inFrame || bytes == 0) return allocation;
+
+	size_t offset = alignUp(cursor, alignment);
+	if (offset + bytes > regionEnd) {
+		grow(bytes + alignment);
+		offset = alignUp(cursor, alignment);
+	}
+
+	if (!persistentMap && !mapped) {
+		// the fences already keep the GPU out of this range, so skip the driver's own synchronization
+		GLState::bindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+		mapped = static_cast<unsigned char*>(glMapBufferRange(GL_COPY_WRITE_BUFFER, offset, regionEnd - offset,
+			GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_FLUSH_EXPLICIT_BIT));
+		if (!mapped) {
+			std::cout << "ERROR::STREAMBUFFER::MAP_FAILED" << std::endl;
+			return allocation;
+		}
+		mapStart = offset;
+	}
+
+	allocation.data = persistentMap ? mapped + offset : mapped + (offset - mapStart);
+	allocation.buffer = buffer;
+	allocation.offset = static_cast<GLintptr>(offset);
+	allocation.size = static_cast<GLsizeiptr>(bytes);
+	cursor = offset + bytes;
+	stats.bytes += bytes;
+	stats.allocations++;
+	return allocation;
+}
+
+StreamBuffer::Allocation StreamBuffer::write(const void* data, size_t bytes, size_t alignment) {
+
+	Allocation allocation = allocate(bytes, alignment);
+	if (allocation.data) {
+		Clock::time_point start = Clock::now();
+		std::memcpy(allocation.data, data, bytes);
+		stats.copyMs += millisecondsSince(start);
+	}
+	return allocation;
+}
+
+void StreamBuffer::flush() {
+
+	// coherent persistent writes are visible to every command issued after them
+	if (persistentMap || !mapped) return;
+
+	GLState::bindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+	if (cursor > mapStart)
+		glFlushMappedBufferRange(GL_COPY_WRITE_BUFFER, 0, cursor - mapStart);
+	glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+	mapped = nullptr;
+}
+
+void StreamBuffer::grow(size_t bytes) {
+
+	flush();
+
+	// draws already issued from the old buffer keep it alive, it goes once the current frame is done
+	Retired old;
+	old.buffer = buffer;
+	old.fence = 0;
+	retired.push_back(old);
+	for (unsigned int i = 0; i < REGION_COUNT; i++)
+		if (fences[i]) glDeleteSync(fences[i]);
+
+	size_t regionBytes = region * 2;
+	while (regionBytes < bytes) regionBytes *= 2;
+	create(regionBytes);
+	cursor = current * region;
+	regionEnd = cursor + region;
+	stats.grows++;
+	std::cout << "StreamBuffer grew to " << REGION_COUNT << " x " << region / 1024 << " KB regions" << std::endl;
+}
+
+void StreamBuffer::releaseRetired() {
+
+	for (size_t i = 0; i < retired.size();) {
+		Retired& old = retired[i];
+		if (!old.fence) {
+			// fenced after the frame that outgrew it
+			old.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+			i++;
+			continue;
+		}
+		if (!signalled(glClientWaitSync(old.fence, 0, 0))) {
+			i++;
+			continue;
+		}
+		glDeleteSync(old.fence);
+		GLState::forgetBuffer(old.buffer);
+		glDeleteBuffers(1, &old.buffer);
+		retired[i] = retired.back();
+		retired.pop_back();
+	}
+}
+
+StreamBuffer::Stats StreamBuffer::frameStats() {
+	Stats result = stats;
+	stats = Stats();
+	return result;
+}
+
+size_t StreamBuffer::uniformAlignment() {
+	static GLint alignment = 0;
+	if (alignment == 0) {
+		glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+		if (alignment <= 0) alignment = 256;
+	}
+	return static_cast<size_t>(alignment);
+}
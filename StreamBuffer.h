@@ -0,0 +1,90 @@
+#ifndef STREAMBUFFER_H
+#define STREAMBUFFER_H
+
+#include <glad/glad.h>
+
+#include <cstddef>
+#include <vector>
+
+// Ring of per-frame regions in one buffer for data written every frame (draw data, instance streams).
+// A frame sub-allocates from its region and fences it at endFrame(); beginFrame() waits for the fence of
+// the region it is about to reuse, which is REGION_COUNT frames old and normally long signalled.
+//
+// With GL 4.4 buffer storage the whole buffer stays persistently and coherently mapped. On 3.3 the
+// rest of the region is mapped unsynchronized on the next allocation and unmapped by flush(), the
+// fences give the same guarantee the driver would otherwise get by stalling or copying.
+class StreamBuffer {
+
+public:
+	static const unsigned int REGION_COUNT = 3;
+
+	struct Allocation {
+		void* data = nullptr;   // write only, valid until flush(); null outside beginFrame/endFrame
+		GLuint buffer = 0;      // the buffer changes when the ring grows, bind this one
+		GLintptr offset = 0;
+		GLsizeiptr size = 0;
+	};
+
+	struct Stats {
+		size_t bytes = 0;        // handed out
+		size_t allocations = 0;
+		double copyMs = 0.0;     // memcpy time inside write()
+		double stallMs = 0.0;    // waiting in beginFrame for the GPU to release a region
+		unsigned int stalls = 0; // beginFrames that had to wait at all
+		unsigned int grows = 0;
+	};
+
+	// lives as long as the GL context, never destroyed
+	static StreamBuffer& shared();
+
+	explicit StreamBuffer(size_t regionSize, bool allowPersistent = true);
+	~StreamBuffer();
+	StreamBuffer(const StreamBuffer&) = delete;
+	StreamBuffer& operator=(const StreamBuffer&) = delete;
+
+	void beginFrame();
+	// flush and fence the frame's region
+	void endFrame();
+	bool frameOpen() const { return inFrame; }
+
+	// a region too small for the request is replaced by a larger buffer, earlier allocations stay valid
+	Allocation allocate(size_t bytes, size_t alignment);
+	// allocate and copy
+	Allocation write(const void* data, size_t bytes, size_t alignment);
+	// make everything written so far visible to GL commands issued after this call
+	void flush();
+
+	bool persistent() const { return persistentMap; }
+	size_t regionSize() const { return region; }
+
+	// counters since the last call
+	Stats frameStats();
+
+	// GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, for glBindBufferRange on allocations
+	static size_t uniformAlignment();
+
+private:
+	struct Retired {
+		GLuint buffer;
+		GLsync fence;
+	};
+
+	bool allowPersistent;
+	bool persistentMap;
+	GLuint buffer;
+	size_t region;           // bytes per region
+	unsigned int current;    // region of the open frame
+	size_t cursor, regionEnd;
+	bool inFrame;
+	GLsync fences[REGION_COUNT];
+	unsigned char* mapped;   // whole buffer when persistent, [mapStart, regionEnd) otherwise
+	size_t mapStart;
+	std::vector<Retired> retired; // outgrown buffers, deleted once their last frame is done
+	Stats stats;
+
+	void create(size_t regionBytes);
+	void grow(size_t bytes);
+	void releaseRetired();
+};
+
+#endif
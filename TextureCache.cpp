@@ -0,0 +1,104 @@
+#include "TextureCache.h"
+
+#include <stb/stb_image.h>
+
+#include "GLState.h"
+
+#include <iostream>
+
+TextureCache::~TextureCache() {
+	for (auto& entry : entries)
+		if (entry.second.pixels)
+			stbi_image_free(entry.second.pixels);
+}
+
+size_t TextureCache::size() const {
+	std::lock_guard<std::mutex> lock(mutex);
+	return entries.size();
+}
+
+void TextureCache::decode(const std::string& file, Entry& result) {
+	result.pixels = stbi_load(file.c_str(), &result.width, &result.height, &result.components, 0);
+	if (!result.pixels)
+		std::cout << "Texture failed to load at path: " << file << std::endl;
+}
+
+void TextureCache::prefetch(const std::string& file) {
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (entries.count(file)) return; // decoded, being decoded or already on the GPU
+		entries[file].decoding = true;
+	}
+
+	Entry result;
+	decode(file, result);
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		Entry& entry = entries[file];
+		entry.pixels = result.pixels;
+		entry.width = result.width;
+		entry.height = result.height;
+		entry.components = result.components;
+		entry.decoding = false;
+		decodes++;
+	}
+	decoded.notify_all();
+}
+
+unsigned int TextureCache::get(const std::string& file) {
+
+	std::unique_lock<std::mutex> lock(mutex);
+
+	auto it = entries.find(file);
+	if (it == entries.end()) {
+		lock.unlock();
+		prefetch(file);
+		lock.lock();
+		it = entries.find(file);
+	}
+	else if (it->second.id != 0 || (!it->second.decoding && !it->second.pixels)) {
+		hits++; // uploaded, or decoded without pixels and 0 for good
+		return it->second.id;
+	}
+
+	// rehashing invalidates iterators but not references, and prefetch() may insert while we wait
+	Entry& entry = it->second;
+	decoded.wait(lock, [&]() { return !entry.decoding; });
+
+	if (entry.id == 0 && entry.pixels) {
+		entry.id = upload(entry);
+		stbi_image_free(entry.pixels);
+		entry.pixels = nullptr;
+		uploads++;
+	}
+	return entry.id;
+}
+
+unsigned int TextureCache::upload(const Entry& entry) {
+
+	// a file that failed to decode gets no texture, so callers can tell it from a loaded one
+	if (!entry.pixels) return 0;
+
+	GLenum format = GL_RGB;
+	if (entry.components == 1)
+		format = GL_RED;
+	else if (entry.components == 3)
+		format = GL_RGB;
+	else if (entry.components == 4)
+		format = GL_RGBA;
+
+	unsigned int textureID;
+	glGenTextures(1, &textureID);
+	GLState::bindTexture(0, textureID);
+	glTexImage2D(GL_TEXTURE_2D, 0, format, entry.width, entry.height, 0, format, GL_UNSIGNED_BYTE, entry.pixels);
+	glGenerateMipmap(GL_TEXTURE_2D);
+
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+	return textureID;
+}
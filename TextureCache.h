@@ -0,0 +1,53 @@
+#ifndef CLASS_TEXTURECACHE_H
+#define CLASS_TEXTURECACHE_H
+
+#include <glad/glad.h>
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// Texture files keyed by their full path, shared by every Model that loads through the same cache.
+// Decoding may happen on any thread (prefetch), the GL upload always happens on the context thread (get).
+class TextureCache {
+
+public:
+
+	TextureCache() : decodes(0), uploads(0), hits(0) {}
+	~TextureCache();
+	TextureCache(const TextureCache&) = delete;
+	TextureCache& operator=(const TextureCache&) = delete;
+
+	// decode the image on the calling thread and hold the pixels until get() uploads them
+	void prefetch(const std::string& file);
+
+	// GL texture for the file, decoding it now if nobody prefetched it (context thread only).
+	// 0 when the file could not be decoded.
+	unsigned int get(const std::string& file);
+
+	// files the cache has seen, prefetch() on other threads may still be adding to it
+	size_t size() const;
+
+	unsigned int decodes;
+	unsigned int uploads;
+	unsigned int hits;
+
+private:
+
+	struct Entry {
+		unsigned int id = 0;
+		unsigned char* pixels = nullptr;
+		int width = 0, height = 0, components = 0;
+		bool decoding = false;
+	};
+
+	mutable std::mutex mutex;
+	std::condition_variable decoded;
+	std::unordered_map<std::string, Entry> entries;
+
+	void decode(const std::string& file, Entry& result);
+	static unsigned int upload(const Entry& entry);
+};
+
+#endif // CLASS_TEXTURECACHE_H
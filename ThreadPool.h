@@ -0,0 +1,133 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Small fixed-size worker pool for CPU side work (mesh conversion, sorting, culling).
+// Nothing in here touches OpenGL, GL calls must stay on the thread that owns the context.
+class ThreadPool
+{
+public:
+    explicit ThreadPool(unsigned int threadCount = defaultThreadCount())
+        : stopping(false)
+    {
+        threadCount = std::max(1u, threadCount);
+        for (unsigned int i = 0; i < threadCount; i++)
+            workers.emplace_back([this]() { workerLoop(); });
+    }
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            stopping = true;
+        }
+        queueCondition.notify_all();
+        for (std::thread& worker : workers)
+            worker.join();
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    unsigned int size() const { return static_cast<unsigned int>(workers.size()); }
+
+    // Queue a fire-and-forget task
+    void submit(std::function<void()> task)
+    {
+        {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            tasks.push_back(std::move(task));
+        }
+        queueCondition.notify_one();
+    }
+
+    // Run fn(i) for every i in [0, count) and return once all of them are done.
+    // The calling thread takes part, so nesting a parallelFor inside a task cannot deadlock.
+    void parallelFor(size_t count, const std::function<void(size_t)>& fn, size_t grain = 1)
+    {
+        if (count == 0) return;
+        grain = std::max<size_t>(1, grain);
+
+        size_t chunks = (count + grain - 1) / grain;
+        if (chunks == 1 || workers.empty()) {
+            for (size_t i = 0; i < count; i++) fn(i);
+            return;
+        }
+
+        struct Job {
+            std::atomic<size_t> next{ 0 };
+            std::atomic<size_t> done{ 0 };
+            std::mutex mutex;
+            std::condition_variable finished;
+        };
+        std::shared_ptr<Job> job = std::make_shared<Job>();
+
+        // helpers only look at the job while chunks are left, so the caller's stack outlives every use of fn
+        auto run = [job, &fn, count, grain, chunks]() {
+            size_t chunk;
+            while ((chunk = job->next.fetch_add(1)) < chunks) {
+                size_t end = std::min(count, (chunk + 1) * grain);
+                for (size_t i = chunk * grain; i < end; i++) fn(i);
+
+                if (job->done.fetch_add(1) + 1 == chunks) {
+                    std::lock_guard<std::mutex> lock(job->mutex);
+                    job->finished.notify_all();
+                }
+            }
+        };
+
+        size_t helpers = std::min<size_t>(workers.size(), chunks - 1);
+        for (size_t i = 0; i < helpers; i++)
+            submit(run);
+        run();
+
+        std::unique_lock<std::mutex> lock(job->mutex);
+        job->finished.wait(lock, [&]() { return job->done.load() == chunks; });
+    }
+
+    static unsigned int defaultThreadCount()
+    {
+        unsigned int n = std::thread::hardware_concurrency();
+        return n > 1 ? n - 1 : 1; // leave a core for the render thread
+    }
+
+    // Pool shared by the loaders and per-frame systems
+    static ThreadPool& shared()
+    {
+        static ThreadPool pool;
+        return pool;
+    }
+
+private:
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> tasks;
+    std::mutex queueMutex;
+    std::condition_variable queueCondition;
+    bool stopping;
+
+    void workerLoop()
+    {
+        for (;;) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(queueMutex);
+                queueCondition.wait(lock, [this]() { return stopping || !tasks.empty(); });
+                if (stopping && tasks.empty()) return;
+                task = std::move(tasks.front());
+                tasks.pop_front();
+            }
+            task();
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,277 @@
+#include "TriangleBvh.h"
+
+#include <algorithm>
+#include <chrono>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TRIANGLEBVH_SSE2
+#endif
+
+namespace {
+
+	typedef std::chrono::high_resolution_clock Clock;
+
+	double millisecondsSince(Clock::time_point start) {
+		return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+	}
+
+	// deep enough for a 4-wide tree over any 32-bit triangle count, three siblings pushed per level
+	const int STACK_SIZE = 128;
+
+	float halfArea(const AABB& box) {
+		glm::vec3 size = box.max - box.min;
+		return size.x * size.y + size.y * size.z + size.z * size.x;
+	}
+
+}
+
+void TriangleBvh::clear() {
+	nodes.clear();
+	packets.clear();
+	lastStats = Stats();
+}
+
+void TriangleBvh::build(const std::vector<glm::vec3>& positions, const std::vector<unsigned int>& indices) {
+
+	Clock::time_point start = Clock::now();
+	clear();
+	size_t triangleCount = indices.size() / 3;
+	if (triangleCount == 0) return;
+
+	std::vector<AABB> bounds(triangleCount);
+	for (size_t i = 0; i < triangleCount; i++) {
+		AABB box;
+		for (int corner = 0; corner < 3; corner++)
+			box.expand(positions[indices[i * 3 + corner]]);
+		bounds[i] = box;
+	}
+
+	Bvh binary;
+	binary.maxLeafSize = 4;
+	binary.build(bounds);
+	nodes.reserve(binary.nodes().size() / 3 + 1);
+	packets.reserve(binary.stats().leaves);
+
+	uint32_t root = collapse(binary, 0, positions, indices);
+	if (root & LEAF) {
+		// a single leaf, wrap it so traversal always starts at a node
+		Node node;
+		std::fill(node.minX, node.minX + 4, FLT_MAX);
+		std::fill(node.minY, node.minY + 4, FLT_MAX);
+		std::fill(node.minZ, node.minZ + 4, FLT_MAX);
+		std::fill(node.maxX, node.maxX + 4, -FLT_MAX);
+		std::fill(node.maxY, node.maxY + 4, -FLT_MAX);
+		std::fill(node.maxZ, node.maxZ + 4, -FLT_MAX);
+		const AABB& box = binary.nodes()[0].bounds;
+		node.minX[0] = box.min.x; node.minY[0] = box.min.y; node.minZ[0] = box.min.z;
+		node.maxX[0] = box.max.x; node.maxY[0] = box.max.y; node.maxZ[0] = box.max.z;
+		node.child[0] = root;
+		node.count = 1;
+		nodes.push_back(node);
+	}
+
+	lastStats.triangles = triangleCount;
+	lastStats.nodes = nodes.size();
+	lastStats.packets = packets.size();
+	lastStats.buildMs = millisecondsSince(start);
+}
+
+uint32_t TriangleBvh::collapse(const Bvh& binary, uint32_t binaryNode, const std::vector<glm::vec3>& positions,
+	const std::vector<unsigned int>& indices) {
+
+	const std::vector<Bvh::Node>& binaryNodes = binary.nodes();
+	if (binaryNodes[binaryNode].leaf())
+		return addPacket(binary, binaryNodes[binaryNode], positions, indices) | LEAF;
+
+	// pull grandchildren up until there are four children, always opening the largest inner one
+	uint32_t children[4] = { binaryNodes[binaryNode].first, binaryNodes[binaryNode].first + 1, 0, 0 };
+	uint32_t count = 2;
+	while (count < 4) {
+		int largest = -1;
+		float largestArea = -1.0f;
+		for (uint32_t i = 0; i < count; i++) {
+			const Bvh::Node& child = binaryNodes[children[i]];
+			if (!child.leaf() && halfArea(child.bounds) > largestArea) {
+				largest = (int)i;
+				largestArea = halfArea(child.bounds);
+			}
+		}
+		if (largest < 0) break;
+		uint32_t first = binaryNodes[children[largest]].first;
+		children[largest] = first;
+		children[count++] = first + 1;
+	}
+
+	uint32_t index = (uint32_t)nodes.size();
+	nodes.emplace_back();
+	Node node;
+	for (uint32_t i = 0; i < 4; i++) {
+		AABB box;
+		if (i < count) box = binaryNodes[children[i]].bounds;
+		bool valid = i < count && box.valid();
+		node.minX[i] = valid ? box.min.x : FLT_MAX;
+		node.minY[i] = valid ? box.min.y : FLT_MAX;
+		node.minZ[i] = valid ? box.min.z : FLT_MAX;
+		node.maxX[i] = valid ? box.max.x : -FLT_MAX;
+		node.maxY[i] = valid ? box.max.y : -FLT_MAX;
+		node.maxZ[i] = valid ? box.max.z : -FLT_MAX;
+		node.child[i] = i < count ? collapse(binary, children[i], positions, indices) : 0;
+	}
+	node.count = count;
+	nodes[index] = node;
+	return index;
+}
+
+uint32_t TriangleBvh::addPacket(const Bvh& binary, const Bvh::Node& leaf, const std::vector<glm::vec3>& positions,
+	const std::vector<unsigned int>& indices) {
+
+	Packet packet;
+	for (uint32_t lane = 0; lane < 4; lane++) {
+		glm::vec3 v0(0.0f), e1(0.0f), e2(0.0f);
+		uint32_t triangle = UINT32_MAX;
+		if (lane < leaf.count) {
+			triangle = binary.primitiveIndices()[leaf.first + lane];
+			v0 = positions[indices[triangle * 3]];
+			e1 = positions[indices[triangle * 3 + 1]] - v0;
+			e2 = positions[indices[triangle * 3 + 2]] - v0;
+		}
+		packet.v0x[lane] = v0.x; packet.v0y[lane] = v0.y; packet.v0z[lane] = v0.z;
+		packet.e1x[lane] = e1.x; packet.e1y[lane] = e1.y; packet.e1z[lane] = e1.z;
+		packet.e2x[lane] = e2.x; packet.e2y[lane] = e2.y; packet.e2z[lane] = e2.z;
+		packet.triangle[lane] = triangle;
+	}
+	packets.push_back(packet);
+	return (uint32_t)packets.size() - 1;
+}
+
+bool TriangleBvh::raycast(const Ray& ray, Hit& hit) const {
+
+	if (nodes.empty()) return false;
+
+	glm::vec3 inverseDirection = 1.0f / ray.direction;
+	float tMax = hit.t;
+	bool found = false;
+
+	struct Entry {
+		uint32_t child;
+		float t;
+	};
+	Entry stack[STACK_SIZE];
+	int top = 0;
+	stack[top++] = { 0, 0.0f };
+
+#ifdef TRIANGLEBVH_SSE2
+	const __m128 originX = _mm_set1_ps(ray.origin.x), originY = _mm_set1_ps(ray.origin.y), originZ = _mm_set1_ps(ray.origin.z);
+	const __m128 directionX = _mm_set1_ps(ray.direction.x), directionY = _mm_set1_ps(ray.direction.y),
+		directionZ = _mm_set1_ps(ray.direction.z);
+	const __m128 inverseX = _mm_set1_ps(inverseDirection.x), inverseY = _mm_set1_ps(inverseDirection.y),
+		inverseZ = _mm_set1_ps(inverseDirection.z);
+	const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f), epsilon = _mm_set1_ps(1e-12f);
+#endif
+
+	while (top > 0) {
+		Entry entry = stack[--top];
+		if (entry.t > tMax) continue;
+
+		if (entry.child & LEAF) {
+			const Packet& p = packets[entry.child & ~LEAF];
+			float t[4], u[4], v[4];
+			int mask = 0;
+#ifdef TRIANGLEBVH_SSE2
+			// Moller-Trumbore on four triangles: p = d x e2, det = e1 . p
+			__m128 e1x = _mm_loadu_ps(p.e1x), e1y = _mm_loadu_ps(p.e1y), e1z = _mm_loadu_ps(p.e1z);
+			__m128 e2x = _mm_loadu_ps(p.e2x), e2y = _mm_loadu_ps(p.e2y), e2z = _mm_loadu_ps(p.e2z);
+			__m128 px = _mm_sub_ps(_mm_mul_ps(directionY, e2z), _mm_mul_ps(directionZ, e2y));
+			__m128 py = _mm_sub_ps(_mm_mul_ps(directionZ, e2x), _mm_mul_ps(directionX, e2z));
+			__m128 pz = _mm_sub_ps(_mm_mul_ps(directionX, e2y), _mm_mul_ps(directionY, e2x));
+			__m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+			__m128 absDet = _mm_max_ps(det, _mm_sub_ps(zero, det));
+			__m128 valid = _mm_cmpgt_ps(absDet, epsilon);
+			__m128 inverseDet = _mm_div_ps(one, det);
+			__m128 sx = _mm_sub_ps(originX, _mm_loadu_ps(p.v0x));
+			__m128 sy = _mm_sub_ps(originY, _mm_loadu_ps(p.v0y));
+			__m128 sz = _mm_sub_ps(originZ, _mm_loadu_ps(p.v0z));
+			__m128 uu = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, px), _mm_mul_ps(sy, py)), _mm_mul_ps(sz, pz)), inverseDet);
+			__m128 qx = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(sz, e1y));
+			__m128 qy = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(sx, e1z));
+			__m128 qz = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(sy, e1x));
+			__m128 vv = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(directionX, qx), _mm_mul_ps(directionY, qy)),
+				_mm_mul_ps(directionZ, qz)), inverseDet);
+			__m128 tt = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), inverseDet);
+			valid = _mm_and_ps(valid, _mm_cmpge_ps(uu, zero));
+			valid = _mm_and_ps(valid, _mm_cmpge_ps(vv, zero));
+			valid = _mm_and_ps(valid, _mm_cmple_ps(_mm_add_ps(uu, vv), one));
+			valid = _mm_and_ps(valid, _mm_cmpge_ps(tt, zero));
+			valid = _mm_and_ps(valid, _mm_cmplt_ps(tt, _mm_set1_ps(tMax)));
+			mask = _mm_movemask_ps(valid);
+			_mm_storeu_ps(t, tt);
+			_mm_storeu_ps(u, uu);
+			_mm_storeu_ps(v, vv);
+#else
+			for (int lane = 0; lane < 4; lane++) {
+				glm::vec3 e1(p.e1x[lane], p.e1y[lane], p.e1z[lane]);
+				glm::vec3 e2(p.e2x[lane], p.e2y[lane], p.e2z[lane]);
+				glm::vec3 pv = glm::cross(ray.direction, e2);
+				float det = glm::dot(e1, pv);
+				if (std::abs(det) <= 1e-12f) continue;
+				float inverseDet = 1.0f / det;
+				glm::vec3 s = ray.origin - glm::vec3(p.v0x[lane], p.v0y[lane], p.v0z[lane]);
+				glm::vec3 q = glm::cross(s, e1);
+				u[lane] = glm::dot(s, pv) * inverseDet;
+				v[lane] = glm::dot(ray.direction, q) * inverseDet;
+				t[lane] = glm::dot(e2, q) * inverseDet;
+				if (u[lane] >= 0.0f && v[lane] >= 0.0f && u[lane] + v[lane] <= 1.0f && t[lane] >= 0.0f && t[lane] < tMax)
+					mask |= 1 << lane;
+			}
+#endif
+			for (int lane = 0; lane < 4; lane++) {
+				if (!(mask & (1 << lane)) || t[lane] >= tMax) continue;
+				tMax = t[lane];
+				hit.t = t[lane];
+				hit.u = u[lane];
+				hit.v = v[lane];
+				hit.triangle = p.triangle[lane];
+				found = true;
+			}
+			continue;
+		}
+
+		const Node& node = nodes[entry.child];
+		float tEnter[4];
+		int mask = 0;
+#ifdef TRIANGLEBVH_SSE2
+		// slab test on the four child boxes
+		__m128 t0x = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.minX), originX), inverseX);
+		__m128 t1x = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.maxX), originX), inverseX);
+		__m128 t0y = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.minY), originY), inverseY);
+		__m128 t1y = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.maxY), originY), inverseY);
+		__m128 t0z = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.minZ), originZ), inverseZ);
+		__m128 t1z = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.maxZ), originZ), inverseZ);
+		__m128 entryT = _mm_max_ps(_mm_max_ps(_mm_min_ps(t0x, t1x), _mm_min_ps(t0y, t1y)),
+			_mm_max_ps(_mm_min_ps(t0z, t1z), zero));
+		__m128 exitT = _mm_min_ps(_mm_min_ps(_mm_max_ps(t0x, t1x), _mm_max_ps(t0y, t1y)),
+			_mm_min_ps(_mm_max_ps(t0z, t1z), _mm_set1_ps(tMax)));
+		mask = _mm_movemask_ps(_mm_cmple_ps(entryT, exitT)) & ((1 << node.count) - 1);
+		_mm_storeu_ps(tEnter, entryT);
+#else
+		for (uint32_t i = 0; i < node.count; i++) {
+			AABB box;
+			box.min = glm::vec3(node.minX[i], node.minY[i], node.minZ[i]);
+			box.max = glm::vec3(node.maxX[i], node.maxY[i], node.maxZ[i]);
+			if (Bvh::intersects(ray, inverseDirection, box, tMax, tEnter[i]))
+				mask |= 1 << i;
+		}
+#endif
+		// push far to near so the nearest child is popped first
+		Entry hits[4];
+		int hitCount = 0;
+		for (int i = 0; i < 4; i++)
+			if (mask & (1 << i))
+				hits[hitCount++] = { node.child[i], tEnter[i] };
+		std::sort(hits, hits + hitCount, [](const Entry& a, const Entry& b) { return a.t > b.t; });
+		for (int i = 0; i < hitCount; i++)
+			stack[top++] = hits[i];
+	}
+	return found;
+}
@@ -0,0 +1,74 @@
+#ifndef TRIANGLEBVH_H
+#define TRIANGLEBVH_H
+
+#include <glm/glm.hpp>
+
+#include <cfloat>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "Bvh.h"
+
+// Ray queries against the triangles of one mesh. The binary Bvh built over the triangle boxes is
+// collapsed into a 4-wide tree whose child boxes sit side by side, so a node is one SSE slab test
+// for all four children, and leaves become packets of four triangles intersected together
+// (Moller-Trumbore). Builds without SSE2 run the same code one lane at a time.
+class TriangleBvh {
+
+public:
+	struct Hit {
+		float t = FLT_MAX;     // along the ray, in units of its direction
+		float u = 0.0f;        // barycentrics of the second and third corner
+		float v = 0.0f;
+		uint32_t triangle = UINT32_MAX; // index / 3 into the indices given to build()
+
+		bool valid() const { return triangle != UINT32_MAX; }
+	};
+
+	struct Stats {
+		size_t triangles = 0;
+		size_t nodes = 0;
+		size_t packets = 0;
+		double buildMs = 0.0;
+	};
+
+	void build(const std::vector<glm::vec3>& positions, const std::vector<unsigned int>& indices);
+	void clear();
+	bool empty() const { return nodes.empty(); }
+
+	// nearest triangle closer than hit.t, either side faces; hit is only written on a hit
+	bool raycast(const Ray& ray, Hit& hit) const;
+
+	const Stats& stats() const { return lastStats; }
+
+private:
+	static const uint32_t LEAF = 0x80000000u; // child refers to a packet
+
+	// boxes of up to four children, structure of arrays
+	struct Node {
+		float minX[4], minY[4], minZ[4];
+		float maxX[4], maxY[4], maxZ[4];
+		uint32_t child[4];
+		uint32_t count;
+	};
+
+	// four triangles as corner and two edges, unused lanes have zero edges and never hit
+	struct Packet {
+		float v0x[4], v0y[4], v0z[4];
+		float e1x[4], e1y[4], e1z[4];
+		float e2x[4], e2y[4], e2z[4];
+		uint32_t triangle[4];
+	};
+
+	std::vector<Node> nodes;
+	std::vector<Packet> packets;
+	Stats lastStats;
+
+	uint32_t collapse(const Bvh& binary, uint32_t binaryNode, const std::vector<glm::vec3>& positions,
+		const std::vector<unsigned int>& indices);
+	uint32_t addPacket(const Bvh& binary, const Bvh::Node& leaf, const std::vector<glm::vec3>& positions,
+		const std::vector<unsigned int>& indices);
+};
+
+#endif
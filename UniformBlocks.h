@@ -0,0 +1,115 @@
+#ifndef UNIFORMBLOCKS_H
+#define UNIFORMBLOCKS_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <string>
+
+#include "Std140.h"
+
+// Uniform blocks shared by all shader programs. GLSL 330 has no layout(binding = N),
+// so Shader::reflect() assigns these binding points by block name after linking.
+// Shaders get the GLSL side of a block with #include <FrameData> (see ShaderPreprocessor.h),
+// generated from the same description that Std140.h checks at compile time.
+
+enum UniformBindingPoint : GLuint {
+    FRAME_DATA_BINDING = 0,
+    DRAW_DATA_BINDING = 1,
+    MATERIAL_DATA_BINDING = 2
+};
+
+// layout(std140) uniform FrameData, updated once per frame
+struct FrameData
+{
+    glm::mat4 view;
+    glm::mat4 projection;
+    glm::mat4 viewProjection;
+    glm::vec4 cameraPosition; // w unused
+    float time;
+    float padding[3];
+};
+
+// layout(std140) uniform DrawData, updated before each draw
+struct DrawData
+{
+    glm::mat4 model;
+    glm::mat4 modelViewProjection;
+    glm::mat4 normalMatrix; // std140 pads a mat3 to three vec4 columns, a mat4 keeps it simple
+};
+
+// layout(std140) uniform MaterialData, one range of a model's material buffer (see Material.h)
+struct MaterialData
+{
+    glm::vec4 diffuseColor;  // Kd, w = opacity (d)
+    glm::vec4 specularColor; // Ks, w unused
+    float shininess;         // Ns
+    float roughness;         // Pr
+    float padding[2];
+};
+
+template<> struct UniformBlockLayout<FrameData>
+{
+    static const char* name() { return "FrameData"; }
+    static const GLuint binding = FRAME_DATA_BINDING;
+    STD140_MEMBER(FrameData, view);
+    STD140_MEMBER(FrameData, projection);
+    STD140_MEMBER(FrameData, viewProjection);
+    STD140_MEMBER(FrameData, cameraPosition);
+    STD140_MEMBER(FrameData, time);
+    typedef Std140Members<view_member, projection_member, viewProjection_member, cameraPosition_member, time_member> members;
+};
+STD140_VALIDATE(FrameData);
+
+template<> struct UniformBlockLayout<DrawData>
+{
+    static const char* name() { return "DrawData"; }
+    static const GLuint binding = DRAW_DATA_BINDING;
+    STD140_MEMBER(DrawData, model);
+    STD140_MEMBER(DrawData, modelViewProjection);
+    STD140_MEMBER(DrawData, normalMatrix);
+    typedef Std140Members<model_member, modelViewProjection_member, normalMatrix_member> members;
+};
+STD140_VALIDATE(DrawData);
+
+template<> struct UniformBlockLayout<MaterialData>
+{
+    static const char* name() { return "MaterialData"; }
+    static const GLuint binding = MATERIAL_DATA_BINDING;
+    STD140_MEMBER(MaterialData, diffuseColor);
+    STD140_MEMBER(MaterialData, specularColor);
+    STD140_MEMBER(MaterialData, shininess);
+    STD140_MEMBER(MaterialData, roughness);
+    typedef Std140Members<diffuseColor_member, specularColor_member, shininess_member, roughness_member> members;
+};
+STD140_VALIDATE(MaterialData);
+
+// GLSL declaration for "#include <Name>" in shader sources, empty for unknown names
+inline std::string uniformBlockSource(const std::string& name)
+{
+    if (name == UniformBlockLayout<FrameData>::name()) return uniformBlockGLSL<FrameData>();
+    if (name == UniformBlockLayout<DrawData>::name()) return uniformBlockGLSL<DrawData>();
+    if (name == UniformBlockLayout<MaterialData>::name()) return uniformBlockGLSL<MaterialData>();
+    return std::string();
+}
+
+// Attach a linked program's block to its shared binding point and make sure the GLSL
+// declaration agrees with the C++ struct. Unknown blocks are left alone.
+inline void bindUniformBlock(GLuint program, const std::string& name, GLuint blockIndex)
+{
+    if (name == UniformBlockLayout<FrameData>::name()) {
+        checkUniformBlockLayout<FrameData>(program, blockIndex);
+        glUniformBlockBinding(program, blockIndex, UniformBlockLayout<FrameData>::binding);
+    }
+    else if (name == UniformBlockLayout<DrawData>::name()) {
+        checkUniformBlockLayout<DrawData>(program, blockIndex);
+        glUniformBlockBinding(program, blockIndex, UniformBlockLayout<DrawData>::binding);
+    }
+    else if (name == UniformBlockLayout<MaterialData>::name()) {
+        checkUniformBlockLayout<MaterialData>(program, blockIndex);
+        glUniformBlockBinding(program, blockIndex, UniformBlockLayout<MaterialData>::binding);
+    }
+}
+
+#endif
@@ -0,0 +1,39 @@
+#include "UniformBuffer.h"
+#include "GLState.h"
+
+#include <cstring>
+
+UniformBuffer::UniformBuffer(GLuint binding, size_t size)
+	: ID(0), binding(binding), size(size)
+{
+	glGenBuffers(1, &ID);
+	GLState::bindBuffer(GL_UNIFORM_BUFFER, ID);
+	glBufferData(GL_UNIFORM_BUFFER, size, NULL, GL_DYNAMIC_DRAW);
+	GLState::bindBufferBase(GL_UNIFORM_BUFFER, binding, ID);
+}
+
+UniformBuffer::~UniformBuffer() {
+	GLState::forgetBuffer(ID);
+	glDeleteBuffers(1, &ID);
+}
+
+void UniformBuffer::update(const void* data, size_t bytes, size_t offset) {
+	// a StreamBuffer range may have taken the binding point since, dropped by GLState when it has not
+	GLState::bindBufferBase(GL_UNIFORM_BUFFER, binding, ID);
+	GLState::bindBuffer(GL_UNIFORM_BUFFER, ID);
+	glBufferSubData(GL_UNIFORM_BUFFER, offset, bytes, data);
+}
+
+void UniformBuffer::write(const void* data, size_t bytes) {
+	GLState::bindBufferBase(GL_UNIFORM_BUFFER, binding, ID);
+	GLState::bindBuffer(GL_UNIFORM_BUFFER, ID);
+	// invalidating lets the driver hand out fresh storage instead of waiting on draws still reading the old one
+	void* mapped = glMapBufferRange(GL_UNIFORM_BUFFER, 0, bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+	if (mapped) {
+		std::memcpy(mapped, data, bytes);
+		glUnmapBuffer(GL_UNIFORM_BUFFER);
+	}
+	else {
+		glBufferSubData(GL_UNIFORM_BUFFER, 0, bytes, data);
+	}
+}
@@ -0,0 +1,39 @@
+#ifndef CLASS_UNIFORMBUFFER_H
+#define CLASS_UNIFORMBUFFER_H
+
+#include <glad/glad.h>
+
+#include <cstddef>
+
+#include "UniformBlocks.h"
+
+// GL_UNIFORM_BUFFER attached to a fixed binding point for its whole lifetime
+class UniformBuffer
+{
+public:
+	unsigned int ID;
+	GLuint binding;
+	size_t size;
+
+	UniformBuffer(GLuint binding, size_t size);
+	~UniformBuffer();
+	UniformBuffer(const UniformBuffer&) = delete;
+	UniformBuffer& operator=(const UniformBuffer&) = delete;
+
+	void update(const void* data, size_t bytes, size_t offset = 0);
+
+	// replace the whole buffer with one memcpy into an orphaned mapping
+	void write(const void* data, size_t bytes);
+};
+
+// Buffer holding one block described by UniformBlockLayout<Block>, bound at that block's binding point
+template<typename Block>
+class UniformBlockBuffer : public UniformBuffer
+{
+public:
+	UniformBlockBuffer() : UniformBuffer(UniformBlockLayout<Block>::binding, sizeof(Block)) {}
+
+	void update(const Block& block) { write(&block, sizeof(Block)); }
+};
+
+#endif
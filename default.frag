@@ -31,31 +31,40 @@ in vec2 TexCoord;
 uniform vec3 objectColor;
 uniform vec3 lightColor;
 uniform vec3 lightPos;
-uniform vec3 viewPos;
-uniform Material material;
-uniform Light light;
 
+#include <FrameData>
 
+uniform Material material;
+uniform Light light;
 
-uniform bool useTexture;
+// USE_TEXTURE is defined by the application (true/false), the untextured path samples nothing
 
 void main()
 {
+  vec3 albedo = vec3(1.0);
+  float occlusion = 1.0;
+  float specularMask = 1.0;
+  if (USE_TEXTURE) {
+    albedo = vec3(texture(material.diffuse, TexCoord));
+    occlusion = texture(material.ambient, TexCoord).r;
+    specularMask = 1 - texture(material.specular, TexCoord).r;
+  }
+
 	// ambient
-  vec3 ambient = light.ambient * vec3(texture(material.ambient, TexCoord)).r;
+  vec3 ambient = light.ambient * occlusion;
 
 
   // diffuse
   vec3 norm = normalize(Normal);
   vec3 lightDir = normalize(lightPos - FragPos);
   float diff = max(dot(norm, lightDir), 0.0);
-  vec3 diffuse = light.diffuse * diff *  vec3(texture(material.diffuse, TexCoord));
+  vec3 diffuse = light.diffuse * diff * albedo;
 
   //specular
-  vec3 viewDir = normalize(viewPos - FragPos);
+  vec3 viewDir = normalize(cameraPosition.xyz - FragPos);
   vec3 reflectDir = reflect(-lightDir, norm);
   float spec = pow(max(dot(viewDir, reflectDir), 0.0), 36);
-  vec3 specular = light.specular * spec *  (1-vec3(texture(material.specular, TexCoord).r));
+  vec3 specular = light.specular * spec * specularMask;
   
 
   vec3 result = (ambient + diffuse + specular) * objectColor;
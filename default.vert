@@ -11,9 +11,7 @@ out vec2 TexCoord;
 out vec3 Normal;
 out vec3 FragPos;
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+#include <DrawData>
 
 uniform mat4 transform;
 
@@ -22,9 +20,9 @@ void main()
 {
 
    FragPos =vec3(model * vec4(aPos, 1.0f));
-   Normal = aNormal;
+   Normal = mat3(normalMatrix) * aNormal;
    TexCoord = aTexCoord;
 
-   gl_Position = projection * view * vec4(FragPos, 1.0f);
+   gl_Position = modelViewProjection * vec4(aPos, 1.0f);
 
 };
@@ -0,0 +1,13 @@
+#version 330 core
+// depth-only passes: position and instance matrix, nothing else is fetched
+layout (location = 0) in vec3 aPos;
+layout (location = 3) in mat4 aInstanceMatrix;
+
+invariant gl_Position;
+
+#include <DrawData>
+
+void main()
+{
+    gl_Position = modelViewProjection * (aInstanceMatrix * vec4(aPos, 1.0));
+}
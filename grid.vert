@@ -1,11 +1,10 @@
 #version 330 core
 layout (location = 0) in vec3 aPos;
 
-uniform mat4 view;
-uniform mat4 model;
-uniform mat4 projection;
+// the grid is drawn in world space, the per-frame block is all it needs
+#include <FrameData>
 
 void main()
 {
-    gl_Position = projection * view * model * vec4(aPos, 1.0);
+    gl_Position = viewProjection * vec4(aPos, 1.0);
 }
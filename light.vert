@@ -3,13 +3,11 @@
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aNormal;
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+#include <DrawData>
 
 void main()
 {
 
-	  gl_Position = projection * view * model * vec4(aPos, 1.0);
+	  gl_Position = modelViewProjection * vec4(aPos, 1.0);
 
 }
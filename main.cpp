@@ -17,6 +17,19 @@
 #include "Camera.h"
 #include "OrbitCamera.h"
 #include "Model.h"
+#include "SceneLoader.h"
+#include "Benchmark.h"
+#include "SceneHierarchy.h"
+#include "UniformBuffer.h"
+#include "GLExtensions.h"
+#include "ShaderVariants.h"
+#include "GLState.h"
+#include "RenderQueue.h"
+#include "IndirectRenderer.h"
+#include "GpuCuller.h"
+#include "StreamBuffer.h"
+#include "StaticBatch.h"
+#include "OcclusionCuller.h"
 
 
 
@@ -64,13 +77,37 @@ float lastFrame = 0.0f;
 //grid visibility
 bool gridVisible = false;
 
+//multi-draw indirect submission (GL 4.3) instead of one draw per mesh
+bool useIndirect = false;
+
+//compute shader frustum + occlusion culling of the indirect draws
+bool useGpuCulling = true;
+
+//static scene merged into world-space chunks per material, one draw per visible chunk
+bool useStaticBatch = false;
+
+//depth-only pass before the shaded one, so every pixel is shaded once
+bool useDepthPrepass = false;
+
+//CPU frustum culling of the mesh instances before they are submitted
+bool useFrustumCulling = true;
+
+//CPU occlusion culling of the mesh instances against the largest meshes, after frustum culling
+bool useOcclusionCulling = false;
+
+//left click: pick the triangle under the cursor and orbit about it
+bool pickRequested = false;
+
 
 
 
 
 //main function
-int main() {
+int main(int argc, char** argv) {
 
+	// the CPU occlusion culler's checks, headless: no window or GL context is created
+	if (argc > 1 && std::string(argv[1]) == "--test-occlusion")
+		return Benchmark::occlusionCulling() ? 0 : 1;
 
 	glfwInit();
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
@@ -93,6 +130,13 @@ int main() {
 		std::cout << "Failed to initialize GLAD" << std::endl;
 		return -1;
 	}
+	GLExt::load((GLADloadproc)glfwGetProcAddress);
+
+	if (argc > 1 && std::string(argv[1]) == "--bench") {
+		Benchmark::runAll("assets/models/sample_model_obj/24_12_2024.obj");
+		glfwTerminate();
+		return 0;
+	}
 
 
 	glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
@@ -108,9 +152,9 @@ int main() {
 	glGenVertexArrays(1, &gridVAO);
 	glGenBuffers(1, &gridVBO);
 
-	glBindVertexArray(gridVAO);
+	GLState::bindVertexArray(gridVAO);
 
-	glBindBuffer(GL_ARRAY_BUFFER, gridVBO);
+	GLState::bindBuffer(GL_ARRAY_BUFFER, gridVBO);
 	glBufferData(GL_ARRAY_BUFFER,
 		gridVertices.size() * sizeof(float),
 		gridVertices.data(),
@@ -119,19 +163,29 @@ int main() {
 	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
 	glEnableVertexAttribArray(0);
 
-	glBindVertexArray(0);
+	GLState::bindVertexArray(0);
 
 
 
 	// load models______________________________________________________________________________________
 
-	Model ourModel("assets/models/sample_model_obj/24_12_2024.obj");
+	std::vector<std::string> scenePaths = {
+		"assets/models/sample_model_obj/24_12_2024.obj"
+	};
+	SceneLoader sceneLoader;
+	ModelOptions sceneOptions;
+	sceneOptions.positionStream = true; // the depth prepass only fetches positions
+	std::vector<std::unique_ptr<Model>> sceneModels = sceneLoader.load(scenePaths, sceneOptions);
+
+	// one Bvh over the placed bounds of the models, whole models are culled and picked through it
+	SceneHierarchy sceneHierarchy;
+	std::vector<unsigned char> modelVisible;
 
 	//______________________________________________________________________________________________
 
 
-	//shader
-	Shader ourShader("model.vert", "model.frag");
+	//shader, one variant per combination of material features
+	ShaderVariants modelShaders("model.vert", "model.frag", materialFeatureNames());
 
 
 	//grid shader
@@ -139,12 +193,56 @@ int main() {
 
 
 
-	glEnable(GL_DEPTH_TEST);
+	// per-frame camera data, shared by every program through a fixed binding point; per-draw matrices
+	// are streamed through StreamBuffer::shared() and bound as ranges of it
+	UniformBlockBuffer<FrameData> frameUniforms;
+
+
+	// fixed-function state of the grid, the render queue has its own for the models
+	PipelineDesc linesDesc;
+	linesDesc.cullFace = false;
+	const PipelineState* linesPipeline = PipelineState::get(linesDesc);
+
+	RenderQueue renderQueue;
+
+	// same queue submitted as multi-draw indirect commands, toggled with I where GL 4.3 is available
+	std::unique_ptr<IndirectRenderer> indirectRenderer;
+	if (IndirectRenderer::supported())
+		indirectRenderer.reset(new IndirectRenderer());
+	// and culled on the GPU before drawing, toggled with C
+	std::unique_ptr<GpuCuller> gpuCuller;
+	if (indirectRenderer && GpuCuller::supported())
+		gpuCuller.reset(new GpuCuller());
+
+	// built from the loaded models the first time B turns it on, dropped when it is turned off; meshes
+	// that finish loading later are still submitted by their model
+	StaticBatch staticBatch;
+	bool staticBatchBuilt = false;
+
+	// low resolution masked depth buffer the largest meshes are rasterized into every frame, toggled with O
+	OcclusionCuller occlusionCuller;
+
+	// fragment shader invocations (GL 4.6) or samples passed, measured on the frame the stats are printed
+	// and read once the GPU has the result, so printing never waits for a frame to finish
+	GLuint fragmentQuery;
+	glGenQueries(1, &fragmentQuery);
+	GLenum fragmentQueryTarget = GLExt::pipelineStatistics ? GL_FRAGMENT_SHADER_INVOCATIONS : GL_SAMPLES_PASSED;
+	bool fragmentQueryPending = false;
+	bool fragmentQueryPrepass = false;
+	GLuint fragments = 0;
+	bool fragmentsWithPrepass = false;
+
+	// redundant state calls dropped by GLState, reported once per second
+	GLState::Stats callTotals;
+	StreamBuffer::Stats streamTotals;
+	unsigned int statFrames = 0;
+	float statStart = static_cast<float>(glfwGetTime());
 
 
 	//_____________________________________________________________________________________________
 
-	glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+	// the cursor is only captured while orbiting or panning, picking needs to see where it is
+	glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_NORMAL);
 	glfwSetMouseButtonCallback(window, mouse_button_callback);
 	glfwSetCursorPosCallback(window, mouse_callback);
 	glfwSetScrollCallback(window, scroll_callback);
@@ -162,47 +260,231 @@ int main() {
 
 
 		processInput(window);
-		
+
+		StreamBuffer& stream = StreamBuffer::shared();
+		stream.beginFrame();
 
 
 
 		glm::mat4 model = glm::mat4(1.0f);
-		glm::mat4 view = glm::mat4(1.0f);
-		view = camera.GetViewMatrix();
-		glm::mat4 projection;
+		glm::mat4 view = camera.GetViewMatrix();
+		glm::mat4 projection = glm::perspective(glm::radians(camera.Distance), 1920.0f/1080, 0.1f, 100.0f);
+
+		FrameData frame;
+		frame.view = view;
+		frame.projection = projection;
+		frame.viewProjection = projection * view;
+		frame.cameraPosition = glm::vec4(camera.GetPosition(), 1.0f);
+		frame.time = currentFrame;
+		frameUniforms.update(frame);
 
 		//_______________________________draw grid___________________________________________
 		if (gridVisible) {
+			GLState::setPipeline(linesPipeline);
 			gridShader.use();
 
-			gridShader.setMat4("view", view);
-			gridShader.setMat4("model", model);
-			gridShader.setMat4("projection", projection);
-
 			gridShader.setVec3("gridColor", glm::vec3(0.6f));
 
 
-			glBindVertexArray(gridVAO);
+			GLState::bindVertexArray(gridVAO);
 			glDrawArrays(GL_LINES, 0, gridVertices.size() / 3);
-			glBindVertexArray(0);
+			GLState::countDraw();
 		}
 
 
 		// _________________________Loaded model__________________________________________
 
-		ourShader.use();
+		modelShaders.update();
+		if (indirectRenderer)
+			indirectRenderer->update();
 
-		view = camera.GetViewMatrix();
-		model = glm::mat4(1.0f);
 		model = glm::translate(model, glm::vec3(0.0f, -0.85f, 0.0f));
 		model = glm::scale(model, glm::vec3(5.0f));
-		projection = glm::perspective(glm::radians(camera.Distance), 1920.0f/1080, 0.1f, 100.0f);
+		sceneHierarchy.update(sceneModels, model);
+
+		// cursor ray through the same projection, in the world space the models are placed into
+		if (pickRequested) {
+			pickRequested = false;
+			double cursorX, cursorY;
+			int windowWidth, windowHeight;
+			glfwGetCursorPos(window, &cursorX, &cursorY);
+			glfwGetWindowSize(window, &windowWidth, &windowHeight);
+			glm::vec2 ndc(2.0f * (float)cursorX / windowWidth - 1.0f, 1.0f - 2.0f * (float)cursorY / windowHeight);
+			glm::mat4 toWorld = glm::inverse(frame.viewProjection);
+			glm::vec4 nearPoint = toWorld * glm::vec4(ndc, -1.0f, 1.0f);
+			glm::vec4 farPoint = toWorld * glm::vec4(ndc, 1.0f, 1.0f);
+			Ray ray;
+			ray.origin = glm::vec3(nearPoint) / nearPoint.w;
+			ray.direction = glm::vec3(farPoint) / farPoint.w - ray.origin;
+
+			auto pickStart = std::chrono::high_resolution_clock::now();
+			PickHit nearest;
+			size_t nearestModel = 0;
+			bool picked = sceneHierarchy.pick(ray, nearest, nearestModel);
+			double pickMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - pickStart).count();
+
+			if (picked) {
+				glm::vec3 point = glm::vec3(model * glm::vec4(nearest.point, 1.0f));
+				camera.SetTarget(point);
+				std::cout << "Picked model " << nearestModel << " mesh " << nearest.mesh << " (instance " << nearest.instance
+					<< ") triangle " << nearest.triangle << " at (" << point.x << ", " << point.y << ", " << point.z
+					<< "), barycentrics (" << nearest.barycentric.x << ", " << nearest.barycentric.y << ") in " << pickMs
+					<< " ms" << std::endl;
+			}
+			else {
+				std::cout << "Picked nothing in " << pickMs << " ms" << std::endl;
+			}
+		}
+
+		DrawData draw;
+		draw.model = model;
+		draw.modelViewProjection = frame.viewProjection * model;
+		draw.normalMatrix = glm::mat4(glm::transpose(glm::inverse(glm::mat3(model))));
+
+		// every visible mesh becomes a packet, sorted by program, material and mesh before drawing
+		if (useStaticBatch && !staticBatchBuilt) {
+			for (auto& ourModel : sceneModels)
+				if (ourModel) staticBatch.add(*ourModel, model);
+			staticBatch.build();
+			staticBatchBuilt = true;
+		}
+		else if (!useStaticBatch && staticBatchBuilt) {
+			staticBatch.clear();
+			staticBatchBuilt = false;
+		}
+
+		// models whose placed bounds are outside the frustum are not visited at all
+		if (useFrustumCulling)
+			sceneHierarchy.cull(frame.viewProjection, modelVisible);
+		else
+			modelVisible.assign(sceneModels.size(), 1);
+
+		OcclusionCuller* occlusion = useOcclusionCulling && !useStaticBatch ? &occlusionCuller : nullptr;
+		if (occlusion) {
+			occlusion->begin(frame.viewProjection);
+			for (size_t i = 0; i < sceneModels.size(); i++)
+				if (sceneModels[i] && modelVisible[i]) sceneModels[i]->addOccluders(*occlusion, model, 16);
+			occlusion->rasterize();
+		}
+
+		renderQueue.begin(view);
+		for (size_t i = 0; i < sceneModels.size(); i++) {
+			Model* ourModel = sceneModels[i].get();
+			if (!ourModel || !modelVisible[i]) continue;
+			ourModel->updateVisibility(draw.modelViewProjection);
+			ourModel->frustumCulling = useFrustumCulling;
+			ourModel->occlusionCuller = occlusion;
+			// with the batch on, only the meshes that were not loaded when it was built
+			ourModel->staticBatch = useStaticBatch ? &staticBatch : nullptr;
+			ourModel->submit(renderQueue, modelShaders, draw);
+		}
+		if (useStaticBatch)
+			staticBatch.submit(renderQueue, modelShaders, frame.viewProjection);
+		renderQueue.sort();
+		if ((renderQueue.depthPrepass() != DepthPrepass::Off) != useDepthPrepass)
+			renderQueue.setDepthPrepass(useDepthPrepass ? DepthPrepass::PerMaterial : DepthPrepass::Off);
+		bool measureFragments = currentFrame - statStart >= 1.0f && !fragmentQueryPending;
+		if (measureFragments)
+			glBeginQuery(fragmentQueryTarget, fragmentQuery);
+		GpuCuller* culler = useGpuCulling ? gpuCuller.get() : nullptr;
+		if (useIndirect && indirectRenderer) {
+			if (culler)
+				culler->setCamera(frame.viewProjection);
+			renderQueue.execute(*indirectRenderer, culler);
+		}
+		else {
+			renderQueue.execute(stream);
+		}
+		if (measureFragments) {
+			glEndQuery(fragmentQueryTarget);
+			fragmentQueryPending = true;
+			fragmentQueryPrepass = useDepthPrepass;
+		}
+		else if (fragmentQueryPending) {
+			GLuint available = 0;
+			glGetQueryObjectuiv(fragmentQuery, GL_QUERY_RESULT_AVAILABLE, &available);
+			if (available) {
+				glGetQueryObjectuiv(fragmentQuery, GL_QUERY_RESULT, &fragments);
+				fragmentsWithPrepass = fragmentQueryPrepass;
+				fragmentQueryPending = false;
+			}
+		}
 
-		ourShader.setMat4("model", model);
-		ourShader.setMat4("view", view);
-		ourShader.setMat4("projection", projection);
+		// this frame's depth is next frame's occluder pyramid
+		if (useIndirect && culler) {
+			int framebufferWidth, framebufferHeight;
+			glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+			culler->captureDepth(0, framebufferWidth, framebufferHeight);
+		}
 
-		ourModel.Draw(ourShader);
+		stream.endFrame();
+
+		GLState::Stats frameCalls = GLState::frameStats();
+		callTotals.issued += frameCalls.issued;
+		callTotals.elided += frameCalls.elided;
+		callTotals.draws += frameCalls.draws;
+		StreamBuffer::Stats streamFrame = stream.frameStats();
+		streamTotals.bytes += streamFrame.bytes;
+		streamTotals.stallMs += streamFrame.stallMs;
+		streamTotals.stalls += streamFrame.stalls;
+		statFrames++;
+		if (currentFrame - statStart >= 1.0f) {
+			std::cout << "GL state calls per frame: " << callTotals.issued / statFrames << " issued, "
+				<< callTotals.elided / statFrames << " elided (" << (callTotals.issued + callTotals.elided) / statFrames
+				<< " without tracking), " << callTotals.draws / statFrames << " draws" << std::endl;
+			const RenderQueue::Stats& queueStats = renderQueue.stats();
+			std::cout << "Render queue: " << queueStats.draws << " draws, " << queueStats.programChanges << " program / "
+				<< queueStats.materialChanges << " material / " << queueStats.meshChanges << " mesh changes, sort "
+				<< queueStats.sortMs << " ms" << std::endl;
+			std::cout << (GLExt::pipelineStatistics ? "Fragment shader invocations: " : "Samples passed: ") << fragments
+				<< (fragmentsWithPrepass ? " with" : " without") << " depth prepass (last measured), " << queueStats.prepassDraws
+				<< " prepass draws, "
+				<< 1000.0f * (currentFrame - statStart) / statFrames << " ms per frame" << std::endl;
+			std::cout << "Stream buffer: " << streamTotals.bytes / statFrames / 1024 << " KB per frame ("
+				<< (stream.persistent() ? "persistent" : "unsynchronized map") << "), " << streamTotals.stalls << " stalls, "
+				<< streamTotals.stallMs / statFrames << " ms stalled per frame" << std::endl;
+			if (useFrustumCulling && !useStaticBatch) {
+				FrustumCuller::Stats cullTotals;
+				size_t modelsVisible = 0;
+				for (size_t i = 0; i < sceneModels.size(); i++) {
+					if (!sceneModels[i] || !modelVisible[i]) continue;
+					modelsVisible++;
+					cullTotals.tested += sceneModels[i]->cullStats().tested;
+					cullTotals.visible += sceneModels[i]->cullStats().visible;
+					cullTotals.ms += sceneModels[i]->cullStats().ms;
+				}
+				std::cout << "Frustum culling (" << FrustumCuller::instructionSet() << "): " << modelsVisible << " of "
+					<< sceneModels.size() << " models, " << cullTotals.visible << " of " << cullTotals.tested
+					<< " of their mesh instances visible in " << cullTotals.ms << " ms" << std::endl;
+			}
+			if (useOcclusionCulling && !useStaticBatch) {
+				const OcclusionCuller::Stats& occlusionStats = occlusionCuller.stats();
+				std::cout << "Occlusion culling (" << OcclusionCuller::instructionSet() << "): " << occlusionStats.occluded << " of "
+					<< occlusionStats.tested << " mesh instances occluded (" << occlusionStats.occludedPercent() << "%), "
+					<< occlusionStats.rasterized << " occluder triangles in " << occlusionStats.rasterMs << " ms, tests "
+					<< occlusionStats.testMs << " ms" << std::endl;
+			}
+			if (useStaticBatch) {
+				const StaticBatch::Stats& batchStats = staticBatch.stats();
+				std::cout << "Static batch: " << batchStats.submitted << " of " << batchStats.chunks << " chunks visible, "
+					<< batchStats.sourceInstances << " mesh instances merged" << std::endl;
+			}
+			if (useIndirect && indirectRenderer) {
+				const IndirectRenderer::Stats& indirectStats = indirectRenderer->stats();
+				std::cout << "Multi-draw indirect: " << indirectStats.commands << " commands, " << indirectStats.instances
+					<< " instances in " << indirectStats.multiDraws << " calls" << std::endl;
+			}
+			if (useIndirect && culler) {
+				const GpuCuller::Stats& cullStats = culler->stats();
+				std::cout << "GPU culling: " << cullStats.tested << " tested, " << cullStats.frustumCulled << " outside the frustum, "
+					<< cullStats.occlusionCulled << " occluded, " << cullStats.drawn << " drawn (" << cullStats.latency
+					<< " frames old)" << std::endl;
+			}
+			callTotals = GLState::Stats();
+			streamTotals = StreamBuffer::Stats();
+			statFrames = 0;
+			statStart = currentFrame;
+		}
 
 		glfwSwapBuffers(window);
 		glfwPollEvents();
@@ -210,11 +492,13 @@ int main() {
 	}
 	
 
+	glDeleteQueries(1, &fragmentQuery);
+	GLState::forgetVertexArray(gridVAO);
+	GLState::forgetBuffer(gridVBO);
 	glDeleteVertexArrays(1, &gridVAO);
 	glDeleteBuffers(1, &gridVBO);
 
 
-	ourShader.~Shader();
 	gridShader.~Shader();
 
 	glfwTerminate();
@@ -281,6 +565,84 @@ void processInput(GLFWwindow* window) {
 
 	
 
+	static bool iKeyWasPressed = false;
+
+	if (glfwGetKey(window, GLFW_KEY_I) == GLFW_PRESS && !iKeyWasPressed)
+	{
+		useIndirect = !useIndirect;
+		iKeyWasPressed = true;
+	}
+
+	if (glfwGetKey(window, GLFW_KEY_I) == GLFW_RELEASE)
+	{
+		iKeyWasPressed = false;
+	}
+
+	static bool cKeyWasPressed = false;
+
+	if (glfwGetKey(window, GLFW_KEY_C) == GLFW_PRESS && !cKeyWasPressed)
+	{
+		useGpuCulling = !useGpuCulling;
+		cKeyWasPressed = true;
+	}
+
+	if (glfwGetKey(window, GLFW_KEY_C) == GLFW_RELEASE)
+	{
+		cKeyWasPressed = false;
+	}
+
+	static bool pKeyWasPressed = false;
+
+	if (glfwGetKey(window, GLFW_KEY_P) == GLFW_PRESS && !pKeyWasPressed)
+	{
+		useDepthPrepass = !useDepthPrepass;
+		pKeyWasPressed = true;
+	}
+
+	if (glfwGetKey(window, GLFW_KEY_P) == GLFW_RELEASE)
+	{
+		pKeyWasPressed = false;
+	}
+
+	static bool fKeyWasPressed = false;
+
+	if (glfwGetKey(window, GLFW_KEY_F) == GLFW_PRESS && !fKeyWasPressed)
+	{
+		useFrustumCulling = !useFrustumCulling;
+		fKeyWasPressed = true;
+	}
+
+	if (glfwGetKey(window, GLFW_KEY_F) == GLFW_RELEASE)
+	{
+		fKeyWasPressed = false;
+	}
+
+	static bool bKeyWasPressed = false;
+
+	if (glfwGetKey(window, GLFW_KEY_B) == GLFW_PRESS && !bKeyWasPressed)
+	{
+		useStaticBatch = !useStaticBatch;
+		bKeyWasPressed = true;
+	}
+
+	if (glfwGetKey(window, GLFW_KEY_B) == GLFW_RELEASE)
+	{
+		bKeyWasPressed = false;
+	}
+
+	static bool oKeyWasPressed = false;
+
+	if (glfwGetKey(window, GLFW_KEY_O) == GLFW_PRESS && !oKeyWasPressed)
+	{
+		useOcclusionCulling = !useOcclusionCulling;
+		oKeyWasPressed = true;
+	}
+
+	if (glfwGetKey(window, GLFW_KEY_O) == GLFW_RELEASE)
+	{
+		oKeyWasPressed = false;
+	}
+
 	if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS) {
 
 		glfwSetWindowShouldClose(window, true);
@@ -317,6 +679,9 @@ void mouse_callback(GLFWwindow* window, double xpos, double ypos)
 
 void mouse_button_callback(GLFWwindow* window, int button, int action, int mods)
 {
+	if (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_PRESS)
+		pickRequested = true;
+
 	if (button == GLFW_MOUSE_BUTTON_RIGHT)
 	{
 		if (action == GLFW_PRESS)
@@ -332,6 +697,8 @@ void mouse_button_callback(GLFWwindow* window, int button, int action, int mods)
 		else if (action == GLFW_RELEASE)
 			isMiddleMousePressed = false;
 	}
+
+	glfwSetInputMode(window, GLFW_CURSOR, isRightMousePressed || isMiddleMousePressed ? GLFW_CURSOR_DISABLED : GLFW_CURSOR_NORMAL);
 }
 void scroll_callback(GLFWwindow* window, double xoffset, double yoffset)
 {
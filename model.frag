@@ -2,10 +2,20 @@
 out vec4 FragColor;
 
 in vec2 TexCoords;
+in vec4 InstanceColor;
 
+// units are fixed by Material.h, HAS_* come from ShaderVariants (Material::features)
 uniform sampler2D texture_diffuse1;
+uniform sampler2D texture_ao1;
+
+#include <MaterialData>
 
 void main()
 {    
-    FragColor = texture(texture_diffuse1, TexCoords);
-}
\ No newline at end of file
+    vec4 color = diffuseColor;
+    if (HAS_DIFFUSE_MAP)
+        color = texture(texture_diffuse1, TexCoords);
+    if (HAS_AO_MAP)
+        color.rgb *= texture(texture_ao1, TexCoords).r;
+    FragColor = color * InstanceColor;
+}
@@ -2,15 +2,22 @@
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aNormal;
 layout (location = 2) in vec2 aTexCoords;
+layout (location = 3) in mat4 aInstanceMatrix; // node transform, or copy * node for Model::DrawInstanced
+layout (location = 7) in vec4 aInstanceColor;  // white unless streamed
+layout (location = 8) in uint aInstanceId;
 
 out vec2 TexCoords;
+out vec4 InstanceColor;
+flat out uint InstanceId;
+// the depth prepass (depth.vert) computes the same position, GL_EQUAL needs bit-identical depths
+invariant gl_Position;
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+#include <DrawData>
 
 void main()
 {
     TexCoords = aTexCoords;    
-    gl_Position = projection * view * model * vec4(aPos, 1.0);
-}
\ No newline at end of file
+    InstanceColor = aInstanceColor;
+    InstanceId = aInstanceId;
+    gl_Position = modelViewProjection * (aInstanceMatrix * vec4(aPos, 1.0));
+}
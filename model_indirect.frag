@@ -0,0 +1,34 @@
+#version 430 core
+out vec4 FragColor;
+
+in vec2 TexCoords;
+flat in uint MaterialIndex;
+
+// units are fixed by Material.h, HAS_* come from ShaderVariants (Material::features)
+uniform sampler2D texture_diffuse1;
+uniform sampler2D texture_ao1;
+
+// std430 layout of MaterialData
+struct Material
+{
+    vec4 diffuseColor;
+    vec4 specularColor;
+    float shininess;
+    float roughness;
+};
+
+// IndirectRenderer.h: MATERIAL_RECORD_BINDING
+layout (std430, binding = 1) readonly buffer Materials
+{
+    Material materials[];
+};
+
+void main()
+{
+    vec4 color = materials[MaterialIndex].diffuseColor;
+    if (HAS_DIFFUSE_MAP)
+        color = texture(texture_diffuse1, TexCoords);
+    if (HAS_AO_MAP)
+        color.rgb *= texture(texture_ao1, TexCoords).r;
+    FragColor = color;
+}
@@ -0,0 +1,30 @@
+#version 430 core
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec3 aNormal;
+layout (location = 2) in vec2 aTexCoords;
+layout (location = 8) in uint aDrawIndex; // baseInstance + instance, see GeometryArena::bindIndirect
+
+struct DrawRecord
+{
+    mat4 model;
+    uint material;
+};
+
+// IndirectRenderer.h: DRAW_RECORD_BINDING
+layout (std430, binding = 0) readonly buffer DrawRecords
+{
+    DrawRecord records[];
+};
+
+out vec2 TexCoords;
+flat out uint MaterialIndex;
+
+#include <FrameData>
+
+void main()
+{
+    DrawRecord record = records[aDrawIndex];
+    TexCoords = aTexCoords;
+    MaterialIndex = record.material;
+    gl_Position = viewProjection * (record.model * vec4(aPos, 1.0));
+}